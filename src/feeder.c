@@ -0,0 +1,878 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "node.h"
+#include "class.h"
+#include "feeder.h"
+#include "symbols.h"
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static void cg_feeder_release(SEXP ptr);
+
+static void cg_feeder_wait(cg_feeder_t *feeder)
+{
+#ifndef _WIN32
+  if(feeder->running)
+  {
+    pthread_join(feeder->thread, NULL);
+
+    feeder->running = 0;
+  }
+#endif
+}
+
+static cg_feeder_t* cg_feeder_state(SEXP feeder)
+{
+  if(!cg_is(feeder, "cg_feeder"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'feeder' must be a cg_feeder object");
+  }
+
+  SEXP ptr = PROTECT(CG_GET(feeder, CG_STATE_SYMBOL));
+
+  if(TYPEOF(ptr) != EXTPTRSXP || R_ExternalPtrAddr(ptr) == NULL)
+  {
+    Rf_errorcall(R_NilValue, "feeder has been closed");
+  }
+
+  UNPROTECT(1);
+
+  return (cg_feeder_t*)R_ExternalPtrAddr(ptr);
+}
+
+// Note: the state of a feeder is owned by an external pointer which protects
+// a list holding the data source and the buffers of the inputs. The state is
+// released when the feeder is closed or garbage collected.
+static SEXP cg_feeder_object(SEXP inputs, SEXP data, cg_feeder_t **state)
+{
+  if(TYPEOF(inputs) != VECSXP || XLENGTH(inputs) < 1)
+  {
+    Rf_errorcall(R_NilValue, "argument 'inputs' must be a non-empty list of inputs");
+  }
+
+  R_xlen_t m = XLENGTH(inputs);
+
+  for(int i = 0; i < m; i++)
+  {
+    SEXP input = VECTOR_ELT(inputs, i);
+
+    if(!cg_is(input, "cg_node") || cg_node_type(input) != CGIPT)
+    {
+      Rf_errorcall(R_NilValue, "argument 'inputs' has an invalid input at index %d", i + 1);
+    }
+  }
+
+  SEXP feeder = PROTECT(cg_class("cg_feeder"));
+
+  SEXP prot = PROTECT(Rf_allocVector(VECSXP, 2));
+
+  SET_VECTOR_ELT(prot, 0, data);
+
+  SEXP ptr = PROTECT(R_MakeExternalPtr(NULL, R_NilValue, prot));
+
+  R_RegisterCFinalizerEx(ptr, cg_feeder_release, TRUE);
+
+  cg_feeder_t *f = Calloc(1, cg_feeder_t);
+
+  f->m = m;
+
+  R_SetExternalPtrAddr(ptr, f);
+
+  CG_SET(feeder, CG_INPUTS_SYMBOL, inputs);
+
+  CG_SET(feeder, CG_STATE_SYMBOL, ptr);
+
+  *state = f;
+
+  UNPROTECT(3);
+
+  return feeder;
+}
+
+static void cg_feeder_bind(cg_feeder_t *feeder, SEXP columns)
+{
+  int m = feeder->m;
+
+  if(Rf_isNull(columns))
+  {
+    if(m > 1)
+    {
+      Rf_errorcall(R_NilValue, "argument 'columns' must be supplied if multiple inputs are fed");
+    }
+
+    feeder->offsets = Calloc(2, int);
+    feeder->columns = Calloc(feeder->ncol, int);
+
+    for(int c = 0; c < feeder->ncol; c++)
+    {
+      feeder->columns[c] = c;
+    }
+
+    feeder->offsets[1] = feeder->ncol;
+
+    return;
+  }
+
+  if(TYPEOF(columns) != VECSXP)
+  {
+    if(m > 1 || !Rf_isNumeric(columns))
+    {
+      Rf_errorcall(R_NilValue, "argument 'columns' must be a list of numeric vectors");
+    }
+
+    columns = Rf_list1(columns);
+  }
+
+  PROTECT(columns);
+
+  if(XLENGTH(columns) != m)
+  {
+    Rf_errorcall(R_NilValue, "argument 'columns' must have a numeric vector for each input");
+  }
+
+  feeder->offsets = Calloc(m + 1, int);
+
+  for(int i = 0; i < m; i++)
+  {
+    SEXP index = VECTOR_ELT(columns, i);
+
+    if(!Rf_isNumeric(index) || XLENGTH(index) < 1)
+    {
+      Rf_errorcall(R_NilValue, "argument 'columns' has an invalid numeric vector at index %d", i + 1);
+    }
+
+    feeder->offsets[i + 1] = feeder->offsets[i] + XLENGTH(index);
+  }
+
+  feeder->columns = Calloc(feeder->offsets[m], int);
+
+  for(int i = 0; i < m; i++)
+  {
+    SEXP index = PROTECT(Rf_coerceVector(VECTOR_ELT(columns, i), INTSXP));
+
+    int *pi = INTEGER(index);
+
+    for(int c = 0; c < XLENGTH(index); c++)
+    {
+      if(pi[c] == NA_INTEGER || pi[c] < 1 || pi[c] > feeder->ncol)
+      {
+        Rf_errorcall(R_NilValue, "argument 'columns' has an index out of bounds for input %d", i + 1);
+      }
+
+      feeder->columns[feeder->offsets[i] + c] = pi[c] - 1;
+    }
+
+    UNPROTECT(1);
+  }
+
+  UNPROTECT(1);
+}
+
+static SEXP cg_feeder_alloc(const cg_feeder_t *feeder, const int i)
+{
+  int k = feeder->offsets[i + 1] - feeder->offsets[i];
+
+  if(feeder->transpose)
+  {
+    return Rf_allocMatrix(REALSXP, k, feeder->batch);
+  }
+
+  return Rf_allocMatrix(REALSXP, feeder->batch, k);
+}
+
+static void cg_feeder_shuffle(cg_feeder_t *feeder)
+{
+  GetRNGstate();
+
+  for(R_xlen_t i = feeder->nrow - 1; i > 0; i--)
+  {
+    R_xlen_t j = (R_xlen_t)R_unif_index((double)(i + 1));
+
+    R_xlen_t tmp = feeder->order[i];
+
+    feeder->order[i] = feeder->order[j];
+    feeder->order[j] = tmp;
+  }
+
+  PutRNGstate();
+}
+
+// Note: an observation is read from 'x' with the columns 'stride' apart and
+// written to row (or column) 'r' of the buffers.
+static void cg_feeder_scatter(cg_feeder_t *feeder, double **targets, const double *x,
+                              const R_xlen_t stride, const int r)
+{
+  for(int i = 0; i < feeder->m; i++)
+  {
+    const int *columns = feeder->columns + feeder->offsets[i];
+
+    int k = feeder->offsets[i + 1] - feeder->offsets[i];
+
+    double *out = targets[i];
+
+    if(feeder->transpose)
+    {
+      out += (R_xlen_t)r * k;
+
+      for(int c = 0; c < k; c++)
+      {
+        out[c] = x[columns[c] * stride];
+      }
+    }
+    else
+    {
+      out += r;
+
+      for(int c = 0; c < k; c++)
+      {
+        out[(R_xlen_t)c * feeder->batch] = x[columns[c] * stride];
+      }
+    }
+  }
+}
+
+// Note: reads the next non-empty line of the CSV file into the line buffer.
+// Returns 1 if a line is read, 0 at the end of the file, and -1 on failure.
+static int cg_feeder_read_line(cg_feeder_t *feeder)
+{
+  for(;;)
+  {
+    size_t n = 0;
+
+    int eof = 0;
+
+    for(;;)
+    {
+      if(feeder->text_size - n < 2)
+      {
+        char *text = (char*)realloc(feeder->text, 2 * feeder->text_size);
+
+        if(text == NULL)
+        {
+          snprintf(feeder->error, sizeof(feeder->error), "cannot allocate a line buffer");
+
+          return -1;
+        }
+
+        feeder->text = text;
+
+        feeder->text_size *= 2;
+      }
+
+      if(fgets(feeder->text + n, (int)(feeder->text_size - n), feeder->file) == NULL)
+      {
+        eof = 1;
+
+        break;
+      }
+
+      n += strlen(feeder->text + n);
+
+      if(n > 0 && feeder->text[n - 1] == '\n')
+      {
+        break;
+      }
+    }
+
+    if(eof && n == 0)
+    {
+      return 0;
+    }
+
+    feeder->line++;
+
+    while(n > 0 && (feeder->text[n - 1] == '\n' || feeder->text[n - 1] == '\r'))
+    {
+      feeder->text[--n] = '\0';
+    }
+
+    if(n > 0)
+    {
+      return 1;
+    }
+  }
+}
+
+static int cg_feeder_is_blank(const char c, const char sep)
+{
+  return (c == ' ' || c == '\t') && c != sep;
+}
+
+static int cg_feeder_parse_line(cg_feeder_t *feeder)
+{
+  char *s = feeder->text;
+
+  for(int j = 0; j < feeder->ncol; j++)
+  {
+    while(cg_feeder_is_blank(*s, feeder->sep))
+    {
+      s++;
+    }
+
+    int quoted = (*s == '"');
+
+    if(quoted)
+    {
+      s++;
+    }
+
+    int empty = (*s == feeder->sep || *s == '\0' || *s == '"');
+
+    char *end = s;
+
+    // Note: empty fields are checked first since strtod skips white space
+    if(!empty)
+    {
+      feeder->row[j] = strtod(s, &end);
+    }
+
+    if(end != s)
+    {
+      s = end;
+    }
+    else if(empty)
+    {
+      feeder->row[j] = NA_REAL;
+    }
+    else if(strncmp(s, "NA", 2) == 0)
+    {
+      feeder->row[j] = NA_REAL;
+
+      s += 2;
+    }
+    else
+    {
+      snprintf(feeder->error, sizeof(feeder->error),
+               "line %ld of the CSV file has a non-numeric value in column %d", feeder->line, j + 1);
+
+      return 0;
+    }
+
+    if(quoted && *s == '"')
+    {
+      s++;
+    }
+
+    while(cg_feeder_is_blank(*s, feeder->sep))
+    {
+      s++;
+    }
+
+    if(j < feeder->ncol - 1 ? *s != feeder->sep : *s != '\0')
+    {
+      snprintf(feeder->error, sizeof(feeder->error),
+               "line %ld of the CSV file does not have %d columns", feeder->line, feeder->ncol);
+
+      return 0;
+    }
+
+    s++;
+  }
+
+  return 1;
+}
+
+// Note: batches never span two passes over the data. The observations that
+// remain at the end of a pass are skipped.
+static void cg_feeder_fill(cg_feeder_t *feeder)
+{
+  double **targets = feeder->buffers + (size_t)feeder->current * feeder->m;
+
+  if(feeder->source == CGCSV)
+  {
+    int rewound = 0;
+
+    for(int r = 0; r < feeder->batch;)
+    {
+      int status = cg_feeder_read_line(feeder);
+
+      if(status < 0)
+      {
+        return;
+      }
+
+      if(status == 0)
+      {
+        if(rewound || fseek(feeder->file, feeder->start, SEEK_SET) != 0)
+        {
+          snprintf(feeder->error, sizeof(feeder->error),
+                   "the CSV file has fewer observations than the batch size");
+
+          return;
+        }
+
+        feeder->line = feeder->header;
+
+        rewound = 1;
+
+        r = 0;
+
+        continue;
+      }
+
+      if(!cg_feeder_parse_line(feeder))
+      {
+        return;
+      }
+
+      cg_feeder_scatter(feeder, targets, feeder->row, 1, r++);
+    }
+
+    return;
+  }
+
+  for(int r = 0; r < feeder->batch; r++)
+  {
+    R_xlen_t i = feeder->first + r;
+
+    R_xlen_t row = feeder->order != NULL ? feeder->order[i] : i;
+
+    if(feeder->source == CGMATRIX)
+    {
+      cg_feeder_scatter(feeder, targets, feeder->data + row, feeder->nrow, r);
+    }
+    else
+    {
+      cg_feeder_scatter(feeder, targets, feeder->data + row * feeder->ncol, 1, r);
+    }
+  }
+}
+
+#ifndef _WIN32
+static void* cg_feeder_run(void *arg)
+{
+  cg_feeder_fill((cg_feeder_t*)arg);
+
+  return NULL;
+}
+#endif
+
+static void cg_feeder_prefetch(cg_feeder_t *feeder)
+{
+  if(feeder->source != CGCSV)
+  {
+    if(feeder->position + feeder->batch > feeder->nrow)
+    {
+      feeder->position = 0;
+
+      if(feeder->order != NULL)
+      {
+        cg_feeder_shuffle(feeder);
+      }
+    }
+
+    feeder->first = feeder->position;
+
+    feeder->position += feeder->batch;
+  }
+
+#ifndef _WIN32
+  if(pthread_create(&feeder->thread, NULL, cg_feeder_run, feeder) == 0)
+  {
+    feeder->running = 1;
+
+    return;
+  }
+#endif
+
+  // The batch is laid out by the main thread if no thread can be started
+  cg_feeder_fill(feeder);
+}
+
+static void cg_feeder_setup(SEXP feeder, cg_feeder_t *state, SEXP columns, SEXP batch_size,
+                            SEXP shuffle, SEXP transpose)
+{
+  if(!Rf_isNumeric(batch_size) || XLENGTH(batch_size) != 1 || Rf_asInteger(batch_size) < 1)
+  {
+    Rf_errorcall(R_NilValue, "argument 'batch_size' must be a positive numeric scalar");
+  }
+
+  if(!IS_SCALAR(shuffle, LGLSXP) || LOGICAL(shuffle)[0] == NA_LOGICAL)
+  {
+    Rf_errorcall(R_NilValue, "argument 'shuffle' must be a logical scalar");
+  }
+
+  if(!IS_SCALAR(transpose, LGLSXP) || LOGICAL(transpose)[0] == NA_LOGICAL)
+  {
+    Rf_errorcall(R_NilValue, "argument 'transpose' must be a logical scalar");
+  }
+
+  state->batch = Rf_asInteger(batch_size);
+
+  state->transpose = LOGICAL(transpose)[0];
+
+  if(state->source != CGCSV && state->nrow < state->batch)
+  {
+    Rf_errorcall(R_NilValue, "data has fewer observations than the batch size");
+  }
+
+  cg_feeder_bind(state, columns);
+
+  if(LOGICAL(shuffle)[0])
+  {
+    state->order = Calloc(state->nrow, R_xlen_t);
+
+    for(R_xlen_t i = 0; i < state->nrow; i++)
+    {
+      state->order[i] = i;
+    }
+  }
+
+  SEXP ptr = PROTECT(CG_GET(feeder, CG_STATE_SYMBOL));
+
+  SEXP buffers = PROTECT(Rf_allocVector(VECSXP, 2 * state->m));
+
+  SET_VECTOR_ELT(R_ExternalPtrProtected(ptr), 1, buffers);
+
+  state->buffers = Calloc(2 * state->m, double*);
+
+  for(int i = 0; i < 2 * state->m; i++)
+  {
+    SEXP buffer = cg_feeder_alloc(state, i % state->m);
+
+    SET_VECTOR_ELT(buffers, i, buffer);
+
+    state->buffers[i] = REAL(buffer);
+  }
+
+  // Note: the position starts at the end of the data so that the first batch
+  // starts a new pass (and shuffles the observations)
+  state->position = state->nrow;
+
+  cg_feeder_prefetch(state);
+
+  UNPROTECT(2);
+}
+
+static void cg_feeder_release(SEXP ptr)
+{
+  cg_feeder_t *feeder = (cg_feeder_t*)R_ExternalPtrAddr(ptr);
+
+  if(feeder != NULL)
+  {
+    cg_feeder_wait(feeder);
+
+    if(feeder->addr != NULL)
+    {
+#ifndef _WIN32
+      munmap(feeder->addr, feeder->size);
+#else
+      Free(feeder->addr);
+#endif
+    }
+
+    if(feeder->file != NULL)
+    {
+      fclose(feeder->file);
+    }
+
+    free(feeder->text);
+
+    Free(feeder->row);
+    Free(feeder->offsets);
+    Free(feeder->columns);
+    Free(feeder->order);
+    Free(feeder->buffers);
+
+    Free(feeder);
+
+    R_ClearExternalPtr(ptr);
+  }
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+SEXP cg_feeder_next(SEXP feeder)
+{
+  cg_feeder_t *state = cg_feeder_state(feeder);
+
+  cg_feeder_wait(state);
+
+  if(state->error[0] != '\0')
+  {
+    Rf_errorcall(R_NilValue, "%s", state->error);
+  }
+
+  SEXP inputs = PROTECT(CG_GET(feeder, CG_INPUTS_SYMBOL));
+
+  SEXP buffers = VECTOR_ELT(R_ExternalPtrProtected(CG_GET(feeder, CG_STATE_SYMBOL)), 1);
+
+  int m = state->m, b = state->current;
+
+  for(int i = 0; i < m; i++)
+  {
+    cg_node_set_value(VECTOR_ELT(inputs, i), VECTOR_ELT(buffers, b * m + i));
+  }
+
+  // The buffers of the previous batch are overwritten by the next batch
+  // unless they are still referenced elsewhere
+  state->current = 1 - b;
+
+  for(int i = 0; i < m; i++)
+  {
+    int j = state->current * m + i;
+
+    if(MAYBE_SHARED(VECTOR_ELT(buffers, j)))
+    {
+      SEXP buffer = cg_feeder_alloc(state, i);
+
+      SET_VECTOR_ELT(buffers, j, buffer);
+
+      state->buffers[j] = REAL(buffer);
+    }
+  }
+
+  cg_feeder_prefetch(state);
+
+  UNPROTECT(1);
+
+  return R_NilValue;
+}
+
+SEXP cg_feeder_close(SEXP feeder)
+{
+  cg_feeder_state(feeder);
+
+  cg_feeder_release(CG_GET(feeder, CG_STATE_SYMBOL));
+
+  return R_NilValue;
+}
+
+/*
+ * PUBLIC CONSTRUCTORS
+ */
+
+SEXP cg_feeder(SEXP inputs, SEXP data, SEXP batch_size, SEXP columns, SEXP shuffle, SEXP transpose)
+{
+  if(!Rf_isMatrix(data) || !Rf_isNumeric(data))
+  {
+    Rf_errorcall(R_NilValue, "argument 'data' must be a numeric matrix");
+  }
+
+  data = PROTECT(Rf_coerceVector(data, REALSXP));
+
+  // The values of the matrix are read by the background thread
+  MARK_NOT_MUTABLE(data);
+
+  cg_feeder_t *state;
+
+  SEXP feeder = PROTECT(cg_feeder_object(inputs, data, &state));
+
+  state->source = CGMATRIX;
+
+  state->nrow = Rf_nrows(data);
+
+  state->ncol = Rf_ncols(data);
+
+  state->data = REAL(data);
+
+  cg_feeder_setup(feeder, state, columns, batch_size, shuffle, transpose);
+
+  UNPROTECT(2);
+
+  return feeder;
+}
+
+SEXP cg_feeder_binary(SEXP inputs, SEXP file, SEXP ncol, SEXP batch_size, SEXP columns, SEXP shuffle,
+                      SEXP transpose)
+{
+  if(!IS_SCALAR(file, STRSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'file' must be a character scalar");
+  }
+
+  if(!Rf_isNumeric(ncol) || XLENGTH(ncol) != 1 || Rf_asInteger(ncol) < 1)
+  {
+    Rf_errorcall(R_NilValue, "argument 'ncol' must be a positive numeric scalar");
+  }
+
+  cg_feeder_t *state;
+
+  SEXP feeder = PROTECT(cg_feeder_object(inputs, R_NilValue, &state));
+
+  state->source = CGBINARY;
+
+  state->ncol = Rf_asInteger(ncol);
+
+  const char *path = R_ExpandFileName(CHAR(STRING_ELT(file, 0)));
+
+  FILE *f = fopen(path, "rb");
+
+  if(f == NULL)
+  {
+    Rf_errorcall(R_NilValue, "cannot open file '%s'", path);
+  }
+
+  if(fseek(f, 0, SEEK_END) != 0)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "cannot read file '%s'", path);
+  }
+
+  long size = ftell(f);
+
+  size_t row_size = (size_t)state->ncol * sizeof(double);
+
+  if(size <= 0 || (size_t)size % row_size != 0)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "file '%s' does not hold observations of %d doubles", path, state->ncol);
+  }
+
+  state->nrow = (R_xlen_t)((size_t)size / row_size);
+
+  // Note: the file is memory-mapped so that observations are only read once
+  // they are accessed. Platforms without mmap read the file at once.
+#ifndef _WIN32
+  void *addr = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+
+  if(addr == MAP_FAILED)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "cannot map file '%s'", path);
+  }
+
+  state->addr = addr;
+#else
+  state->addr = Calloc(size, char);
+
+  if(fseek(f, 0, SEEK_SET) != 0 || fread(state->addr, size, 1, f) != 1)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "cannot read file '%s'", path);
+  }
+#endif
+
+  fclose(f);
+
+  state->size = (size_t)size;
+
+  state->data = (const double*)state->addr;
+
+  cg_feeder_setup(feeder, state, columns, batch_size, shuffle, transpose);
+
+  UNPROTECT(1);
+
+  return feeder;
+}
+
+SEXP cg_feeder_csv(SEXP inputs, SEXP file, SEXP batch_size, SEXP columns, SEXP header, SEXP sep,
+                   SEXP transpose)
+{
+  if(!IS_SCALAR(file, STRSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'file' must be a character scalar");
+  }
+
+  if(!IS_SCALAR(header, LGLSXP) || LOGICAL(header)[0] == NA_LOGICAL)
+  {
+    Rf_errorcall(R_NilValue, "argument 'header' must be a logical scalar");
+  }
+
+  if(!IS_SCALAR(sep, STRSXP) || strlen(CHAR(STRING_ELT(sep, 0))) != 1)
+  {
+    Rf_errorcall(R_NilValue, "argument 'sep' must be a single character");
+  }
+
+  cg_feeder_t *state;
+
+  SEXP feeder = PROTECT(cg_feeder_object(inputs, R_NilValue, &state));
+
+  state->source = CGCSV;
+
+  state->header = LOGICAL(header)[0];
+
+  state->sep = CHAR(STRING_ELT(sep, 0))[0];
+
+  const char *path = R_ExpandFileName(CHAR(STRING_ELT(file, 0)));
+
+  state->file = fopen(path, "rb");
+
+  if(state->file == NULL)
+  {
+    Rf_errorcall(R_NilValue, "cannot open file '%s'", path);
+  }
+
+  state->text_size = 256;
+
+  state->text = (char*)malloc(state->text_size);
+
+  if(state->text == NULL)
+  {
+    Rf_errorcall(R_NilValue, "cannot allocate a line buffer");
+  }
+
+  // The number of columns is determined by the first line
+  if(cg_feeder_read_line(state) != 1)
+  {
+    Rf_errorcall(R_NilValue, "file '%s' is empty", path);
+  }
+
+  state->ncol = 1;
+
+  int quoted = 0;
+
+  for(const char *s = state->text; *s != '\0'; s++)
+  {
+    if(*s == '"')
+    {
+      quoted = !quoted;
+    }
+    else if(*s == state->sep && !quoted)
+    {
+      state->ncol++;
+    }
+  }
+
+  if(!state->header)
+  {
+    rewind(state->file);
+
+    state->line = 0;
+  }
+
+  state->start = ftell(state->file);
+
+  state->row = Calloc(state->ncol, double);
+
+  cg_feeder_setup(feeder, state, columns, batch_size, Rf_ScalarLogical(FALSE), transpose);
+
+  UNPROTECT(1);
+
+  return feeder;
+}
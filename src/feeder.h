@@ -0,0 +1,109 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef FEEDER_H
+#define FEEDER_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/*
+ * A feeder binds one or more inputs to a data source and sets the values of
+ * the inputs to consecutive minibatches of observations. The observations are
+ * the rows of a matrix, a binary file of doubles, or a CSV file, and each
+ * input is bound to a subset of their columns. The feeder keeps two buffers
+ * for each input. While the inputs hold the current batch, a background thread
+ * lays out the next batch in the other buffers. The background thread does not
+ * call the R API. Platforms without POSIX threads lay out a batch once it is
+ * requested.
+ */
+
+/*
+ * ENUMERATIONS
+ */
+
+typedef enum {
+    CGMATRIX = 0, /* Matrix in memory */
+    CGBINARY = 1, /* Binary file of doubles */
+    CGCSV    = 2  /* CSV file */
+} cg_feeder_source_t;
+
+/*
+ * FEEDER STRUCTURES
+ */
+
+typedef struct
+{
+  cg_feeder_source_t source;              /* Type of the data source */
+  R_xlen_t nrow;                          /* Number of observations (unknown for CSV files) */
+  int ncol;                               /* Number of columns */
+  const double *data;                     /* Values of the matrix or binary file */
+  void *addr;                             /* Address of the mapped binary file */
+  size_t size;                            /* Size of the mapped binary file */
+  FILE *file;                             /* CSV file */
+  long start;                             /* Offset of the first observation in the CSV file */
+  long line;                              /* Number of lines read from the CSV file */
+  int header;                             /* Set if the CSV file has a header */
+  char sep;                               /* Field separator of the CSV file */
+  char *text;                             /* Buffer holding a line of the CSV file */
+  size_t text_size;                       /* Size of the line buffer */
+  double *row;                            /* Values of a parsed line */
+  int batch;                              /* Number of observations per batch */
+  int m;                                  /* Number of inputs */
+  int *offsets;                           /* Offsets of the columns of each input */
+  int *columns;                           /* Columns bound to the inputs (zero-based) */
+  int transpose;                          /* Set if observations are stored in columns */
+  R_xlen_t *order;                        /* Order in which the observations are visited */
+  R_xlen_t position;                      /* Position of the batch after the prefetched one */
+  R_xlen_t first;                         /* Position of the prefetched batch */
+  double **buffers;                       /* Buffers of the inputs (two for each input) */
+  int current;                            /* Set of buffers holding the prefetched batch */
+  int running;                            /* Set if the background thread is running */
+#ifndef _WIN32
+  pthread_t thread;                       /* Background thread */
+#endif
+  char error[256];                        /* Error raised by the background thread */
+} cg_feeder_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+SEXP cg_feeder_next(SEXP feeder);
+
+SEXP cg_feeder_close(SEXP feeder);
+
+/*
+ * PUBLIC CONSTRUCTORS
+ */
+
+SEXP cg_feeder(SEXP inputs, SEXP data, SEXP batch_size, SEXP columns, SEXP shuffle, SEXP transpose);
+
+SEXP cg_feeder_binary(SEXP inputs, SEXP file, SEXP ncol, SEXP batch_size, SEXP columns, SEXP shuffle,
+                      SEXP transpose);
+
+SEXP cg_feeder_csv(SEXP inputs, SEXP file, SEXP batch_size, SEXP columns, SEXP header, SEXP sep,
+                   SEXP transpose);
+
+#endif
@@ -33,10 +33,78 @@ extern inline SEXP cg_function_grads(SEXP function);
 
 extern inline void cg_function_set_grads(SEXP function, SEXP grads);
 
+extern inline SEXP cg_function_tangents(SEXP function);
+
+extern inline void cg_function_set_tangents(SEXP function, SEXP tangents);
+
+extern inline const cg_kernel_t* cg_function_kernel(SEXP function);
+
 /*
  * PUBLIC FUNCTIONS
  */
 
+SEXP cg_function_namespace()
+{
+  SEXP name = PROTECT(Rf_mkString("cgraph"));
+
+  SEXP ns = PROTECT(R_FindNamespace(name));
+
+  UNPROTECT(2);
+
+  return ns;
+}
+
+// Note: the functions provided by the package are bound to (delayed)
+// variables in the namespace of the package whose names start with a dot
+SEXP cg_function_builtins()
+{
+  SEXP ns = PROTECT(cg_function_namespace());
+
+  SEXP names = PROTECT(R_lsInternal3(ns, TRUE, FALSE));
+
+  R_len_t n = XLENGTH(names);
+
+  SEXP functions = PROTECT(Rf_allocVector(VECSXP, n));
+
+  for(int i = 0; i < n; i++)
+  {
+    const char *name = CHAR(STRING_ELT(names, i));
+
+    if(name[0] != '.')
+    {
+      continue;
+    }
+
+    SEXP function = Rf_eval(Rf_install(name), ns);
+
+    if(cg_is(function, "cg_function"))
+    {
+      SET_VECTOR_ELT(functions, i, function);
+    }
+  }
+
+  Rf_setAttrib(functions, R_NamesSymbol, names);
+
+  UNPROTECT(3);
+
+  return functions;
+}
+
+SEXP cg_function_builtin_name(SEXP builtins, SEXP function)
+{
+  R_len_t n = XLENGTH(builtins);
+
+  for(int i = 0; i < n; i++)
+  {
+    if(VECTOR_ELT(builtins, i) == function)
+    {
+      return STRING_ELT(Rf_getAttrib(builtins, R_NamesSymbol), i);
+    }
+  }
+
+  return R_NilValue;
+}
+
 SEXP cg_function_print(SEXP function)
 {
   Rprintf("<cg_function>\n");
@@ -48,7 +116,7 @@ SEXP cg_function_print(SEXP function)
  * PUBLIC CONSTRUCTORS
  */
 
-SEXP cg_function(SEXP def, SEXP grads)
+SEXP cg_function(SEXP def, SEXP grads, SEXP tangents, SEXP kernel)
 {
   if(!Rf_isFunction(def))
   {
@@ -72,12 +140,54 @@ SEXP cg_function(SEXP def, SEXP grads)
     }
   }
 
+  if(TYPEOF(tangents) != VECSXP)
+  {
+    Rf_errorcall(R_NilValue, "argument 'tangents' must be a list of tangent functions");
+  }
+
+  n = XLENGTH(tangents);
+
+  for(int i = 0; i < n; i++)
+  {
+    SEXP tangent = VECTOR_ELT(tangents, i);
+
+    if(!Rf_isFunction(tangent))
+    {
+      Rf_errorcall(R_NilValue, "invalid tangent provided to argument 'tangents' at index %d", i + 1);
+    }
+  }
+
+  if(!Rf_isNull(kernel) && !IS_SCALAR(kernel, STRSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'kernel' must be NULL or a character scalar");
+  }
+
   SEXP function = PROTECT(cg_class("cg_function"));
 
   CG_SET(function, CG_GRADS_SYMBOL, grads);
 
+  CG_SET(function, CG_TANGENTS_SYMBOL, tangents);
+
   CG_SET(function, CG_DEF_SYMBOL, def);
 
+  if(!Rf_isNull(kernel))
+  {
+    const char *kernel_name = CHAR(STRING_ELT(kernel, 0));
+
+    const cg_kernel_t *k = cg_kernel_find(kernel_name);
+
+    if(k == NULL)
+    {
+      Rf_errorcall(R_NilValue, "cannot find kernel '%s'", kernel_name);
+    }
+
+    CG_SET(function, CG_KERNEL_SYMBOL, R_MakeExternalPtr((void*)k, kernel, R_NilValue));
+  }
+  else
+  {
+    CG_SET(function, CG_KERNEL_SYMBOL, R_NilValue);
+  }
+
   UNPROTECT(1);
 
   return function;
@@ -23,6 +23,7 @@ limitations under the License.
 #include <Rinternals.h>
 
 #include "class.h"
+#include "kernel.h"
 #include "symbols.h"
 
 /*
@@ -77,16 +78,81 @@ inline void cg_function_set_grads(SEXP function, SEXP grads)
     CG_SET(function, CG_GRADS_SYMBOL, grads);
 }
 
+// Note: the tangent functions are optional, an empty list is returned if the
+// function has none (e.g. when it was created by an older version)
+inline SEXP cg_function_tangents(SEXP function)
+{
+    SEXP tangents = PROTECT(CG_GET(function, CG_TANGENTS_SYMBOL));
+
+    if(TYPEOF(tangents) != VECSXP)
+    {
+        UNPROTECT(1);
+
+        return Rf_allocVector(VECSXP, 0);
+    }
+
+    UNPROTECT(1);
+
+    return tangents;
+}
+
+inline void cg_function_set_tangents(SEXP function, SEXP tangents)
+{
+    if(TYPEOF(tangents) != VECSXP)
+    {
+        Rf_errorcall(R_NilValue, "argument 'tangents' must be a list of tangent functions");
+    }
+
+    CG_SET(function, CG_TANGENTS_SYMBOL, tangents);
+}
+
+inline const cg_kernel_t* cg_function_kernel(SEXP function)
+{
+    SEXP kernel = PROTECT(CG_GET(function, CG_KERNEL_SYMBOL));
+
+    if(TYPEOF(kernel) != EXTPTRSXP)
+    {
+        UNPROTECT(1);
+
+        return NULL;
+    }
+
+    const cg_kernel_t *k = (const cg_kernel_t*)R_ExternalPtrAddr(kernel);
+
+    // Restore the kernel after the function has been deserialized
+    if(k == NULL)
+    {
+        SEXP name = R_ExternalPtrTag(kernel);
+
+        if(IS_SCALAR(name, STRSXP))
+        {
+            k = cg_kernel_find(CHAR(STRING_ELT(name, 0)));
+
+            R_SetExternalPtrAddr(kernel, (void*)k);
+        }
+    }
+
+    UNPROTECT(1);
+
+    return k;
+}
+
 /*
  * PUBLIC FUNCTIONS
  */
 
+SEXP cg_function_namespace();
+
+SEXP cg_function_builtins();
+
+SEXP cg_function_builtin_name(SEXP builtins, SEXP function);
+
 SEXP cg_function_print(SEXP function);
 
 /*
  * PUBLIC CONSTRUCTORS
  */
 
-SEXP cg_function(SEXP def, SEXP grads);
+SEXP cg_function(SEXP def, SEXP grads, SEXP tangents, SEXP kernel);
 
 #endif
@@ -0,0 +1,628 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "node.h"
+#include "table.h"
+#include "fusion.h"
+#include "kernel.h"
+#include "trace.h"
+
+/*
+ * FUSION STRUCTURES
+ */
+
+typedef struct
+{
+  const cg_kernel_elementwise_t *def;     /* Scalar definition of the operator */
+  int n;                                  /* Number of inputs */
+  int inputs[2];                          /* Operator index (>= 0) or leaf index (< 0) */
+} cg_fusion_op_t;
+
+typedef struct
+{
+  int m;                                  /* Number of operators */
+  int l;                                  /* Number of leaves */
+  R_xlen_t n;                             /* Length of the value of the group */
+  SEXP attrib;                            /* Leaf holding the attributes of the value */
+  cg_fusion_op_t ops[CG_FUSION_MAX_OPS];
+  int leaves[2 * CG_FUSION_MAX_OPS];
+  const double *x[2 * CG_FUSION_MAX_OPS];
+  R_xlen_t len[2 * CG_FUSION_MAX_OPS];
+} cg_fusion_t;
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static const cg_kernel_elementwise_t* cg_fusion_def(const cg_table_entry_t *entry)
+{
+  if(entry->type != CGDOP || entry->kernel == NULL || entry->kernel->n > 2)
+  {
+    return NULL;
+  }
+
+  return entry->kernel->elementwise;
+}
+
+static int cg_fusion_find(int *parent, int id)
+{
+  while(parent[id] != id)
+  {
+    parent[id] = parent[parent[id]];
+
+    id = parent[id];
+  }
+
+  return id;
+}
+
+static int cg_fusion_prepare(const cg_table_t *table, SEXP group, cg_fusion_t *fusion)
+{
+  int *ids = INTEGER(group);
+
+  fusion->m = XLENGTH(group);
+  fusion->l = 0;
+  fusion->n = 0;
+  fusion->attrib = R_NilValue;
+
+  for(int j = 0; j < fusion->m; j++)
+  {
+    const cg_table_entry_t *entry = cg_table_entry(table, ids[j]);
+
+    cg_fusion_op_t *op = &fusion->ops[j];
+
+    op->def = cg_fusion_def(entry);
+
+    if(op->def == NULL)
+    {
+      return 0;
+    }
+
+    int *inputs = cg_table_inputs(table, entry);
+
+    op->n = entry->n;
+
+    for(int r = 0; r < op->n; r++)
+    {
+      int input_id = inputs[r], found = 0;
+
+      for(int k = 0; k < j && !found; k++)
+      {
+        if(ids[k] == input_id)
+        {
+          op->inputs[r] = k;
+
+          found = 1;
+        }
+      }
+
+      for(int k = 0; k < fusion->l && !found; k++)
+      {
+        if(fusion->leaves[k] == input_id)
+        {
+          op->inputs[r] = -(k + 1);
+
+          found = 1;
+        }
+      }
+
+      if(found)
+      {
+        continue;
+      }
+
+      SEXP value = cg_node_value(table->entries[input_id - 1].node);
+
+      if(TYPEOF(value) != REALSXP || OBJECT(value))
+      {
+        return 0;
+      }
+
+      int k = fusion->l++;
+
+      fusion->leaves[k] = input_id;
+      fusion->x[k] = REAL(value);
+      fusion->len[k] = XLENGTH(value);
+
+      if(fusion->len[k] > fusion->n)
+      {
+        fusion->n = fusion->len[k];
+      }
+
+      op->inputs[r] = -(k + 1);
+    }
+  }
+
+  if(fusion->n == 0)
+  {
+    return 0;
+  }
+
+  // Note: the leaves must either have the same length as the value of the
+  // group or be a scalar without attributes (otherwise the attributes of the
+  // value of the group cannot be determined unambiguously).
+  for(int k = 0; k < fusion->l; k++)
+  {
+    SEXP value = cg_node_value(table->entries[fusion->leaves[k] - 1].node);
+
+    if(fusion->len[k] != fusion->n)
+    {
+      if(fusion->len[k] != 1 || ATTRIB(value) != R_NilValue)
+      {
+        return 0;
+      }
+    }
+    else if(ATTRIB(value) != R_NilValue)
+    {
+      if(Rf_isNull(fusion->attrib))
+      {
+        fusion->attrib = value;
+      }
+      else if(!R_compute_identical(ATTRIB(fusion->attrib), ATTRIB(value), 16))
+      {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+static inline double cg_fusion_arg(const cg_fusion_t *fusion, const int index,
+                                   const double *tmp, const R_xlen_t i)
+{
+  if(index >= 0)
+  {
+    return tmp[index];
+  }
+
+  int k = -index - 1;
+
+  return fusion->x[k][fusion->len[k] == 1 ? 0 : i];
+}
+
+static inline void cg_fusion_eval(const cg_fusion_t *fusion, const R_xlen_t i,
+                                  double *tmp, int *naflag)
+{
+  for(int j = 0; j < fusion->m; j++)
+  {
+    const cg_fusion_op_t *op = &fusion->ops[j];
+
+    double x = cg_fusion_arg(fusion, op->inputs[0], tmp, i);
+
+    double y = (op->n > 1) ? cg_fusion_arg(fusion, op->inputs[1], tmp, i) : 0;
+
+    tmp[j] = op->def->f(x, y);
+
+    if(op->def->naflag && ISNAN(tmp[j]) && !ISNAN(x))
+    {
+      *naflag = 1;
+    }
+  }
+}
+
+// Note: the previous value of the last operator in the group (or else the
+// buffer that was preallocated by shape inference) is overwritten if it has
+// the length and attributes of a newly allocated value and is not referenced
+// elsewhere
+static int cg_fusion_reuse_value(SEXP value, const cg_fusion_t *fusion)
+{
+  SEXP attrib = Rf_isNull(fusion->attrib) ? R_NilValue : ATTRIB(fusion->attrib);
+
+  return TYPEOF(value) == REALSXP && !MAYBE_SHARED(value) && XLENGTH(value) == fusion->n &&
+    R_compute_identical(ATTRIB(value), attrib, 16);
+}
+
+static SEXP cg_fusion_alloc_value(SEXP node, const cg_fusion_t *fusion)
+{
+  SEXP value = PROTECT(CG_GET(node, CG_VALUE_SYMBOL));
+
+  if(cg_fusion_reuse_value(value, fusion))
+  {
+    UNPROTECT(1);
+
+    return value;
+  }
+
+  SEXP buffer = PROTECT(cg_node_take_buffer(node));
+
+  if(cg_fusion_reuse_value(buffer, fusion))
+  {
+    UNPROTECT(2);
+
+    return buffer;
+  }
+
+  value = PROTECT(Rf_allocVector(REALSXP, fusion->n));
+
+  if(!Rf_isNull(fusion->attrib))
+  {
+    SHALLOW_DUPLICATE_ATTRIB(value, fusion->attrib);
+  }
+
+  UNPROTECT(3);
+
+  return value;
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+SEXP cg_fusion_groups(const cg_table_t *table, SEXP target, SEXP forward)
+{
+  R_len_t n = table->size;
+
+  int *uses = (int*)R_alloc(n + 1, sizeof(int));
+  int *size = (int*)R_alloc(n + 1, sizeof(int));
+  int *parent = (int*)R_alloc(n + 1, sizeof(int));
+
+  memset(uses, 0, (n + 1) * sizeof(int));
+
+  for(int i = 0; i < n; i++)
+  {
+    const cg_table_entry_t *entry = &table->entries[i];
+
+    int *inputs = cg_table_inputs(table, entry);
+
+    size[i + 1] = 0;
+
+    parent[i + 1] = i + 1;
+
+    for(int j = 0; j < entry->n; j++)
+    {
+      uses[inputs[j]]++;
+    }
+  }
+
+  int *order = INTEGER(forward);
+
+  R_len_t k = XLENGTH(forward);
+
+  int target_id = cg_node_id(target);
+
+  // Merge each element-wise operator with the groups of its inputs
+  for(int i = 0; i < k; i++)
+  {
+    const cg_table_entry_t *entry = cg_table_entry(table, order[i]);
+
+    if(cg_fusion_def(entry) == NULL)
+    {
+      continue;
+    }
+
+    size[order[i]] = 1;
+
+    int *inputs = cg_table_inputs(table, entry);
+
+    for(int j = 0; j < entry->n; j++)
+    {
+      int id = inputs[j];
+
+      if(id == target_id || uses[id] != 1 || size[id] == 0)
+      {
+        continue;
+      }
+
+      int root = cg_fusion_find(parent, id);
+
+      if(size[order[i]] + size[root] > CG_FUSION_MAX_OPS)
+      {
+        continue;
+      }
+
+      parent[root] = order[i];
+
+      size[order[i]] += size[root];
+    }
+  }
+
+  // Collect the groups consisting of multiple operators
+  int l = 0;
+
+  int *index = (int*)R_alloc(n + 1, sizeof(int));
+
+  for(int i = 0; i < k; i++)
+  {
+    int id = order[i];
+
+    index[id] = -1;
+
+    if(size[id] > 1 && parent[id] == id)
+    {
+      index[id] = l++;
+    }
+  }
+
+  if(l == 0)
+  {
+    return R_NilValue;
+  }
+
+  SEXP groups = PROTECT(Rf_allocVector(VECSXP, l));
+
+  int *count = (int*)R_alloc(l, sizeof(int));
+
+  memset(count, 0, l * sizeof(int));
+
+  for(int i = 0; i < k; i++)
+  {
+    int id = order[i];
+
+    if(size[id] == 0)
+    {
+      continue;
+    }
+
+    int root = cg_fusion_find(parent, id);
+
+    int g = index[root];
+
+    if(g < 0)
+    {
+      continue;
+    }
+
+    if(Rf_isNull(VECTOR_ELT(groups, g)))
+    {
+      SET_VECTOR_ELT(groups, g, Rf_allocVector(INTSXP, size[root]));
+    }
+
+    INTEGER(VECTOR_ELT(groups, g))[count[g]++] = id;
+  }
+
+  UNPROTECT(1);
+
+  return groups;
+}
+
+void cg_fusion_forward(const cg_table_t *table, SEXP group)
+{
+  cg_fusion_t fusion;
+
+  int *ids = INTEGER(group);
+
+  R_len_t m = XLENGTH(group);
+
+  if(!cg_fusion_prepare(table, group, &fusion))
+  {
+    for(int j = 0; j < m; j++)
+    {
+      cg_table_forward(table, ids[j]);
+    }
+
+    return;
+  }
+
+  cg_profile_sample_t sample;
+
+  double start = cg_trace_active() ? cg_profile_time() : 0;
+
+  if(table->profiling)
+  {
+    cg_table_profile_begin(table, ids, m, CGPFORWARD, &sample);
+  }
+
+  SEXP value = PROTECT(cg_fusion_alloc_value(cg_table_entry(table, ids[m - 1])->node, &fusion));
+
+  double *pv = REAL(value);
+
+  double tmp[CG_FUSION_MAX_OPS];
+
+  int naflag = 0;
+
+  for(R_xlen_t i = 0; i < fusion.n; i++)
+  {
+    cg_fusion_eval(&fusion, i, tmp, &naflag);
+
+    pv[i] = tmp[m - 1];
+  }
+
+  if(naflag)
+  {
+    Rf_warningcall(R_NilValue, "NaNs produced");
+  }
+
+  for(int j = 0; j < m - 1; j++)
+  {
+    SEXP node = cg_table_entry(table, ids[j])->node;
+
+    CG_SET(node, CG_VALUE_SYMBOL, R_NilValue);
+
+    CG_SET(node, CG_GRAD_SYMBOL, R_NilValue);
+  }
+
+  CG_SET(cg_table_entry(table, ids[m - 1])->node, CG_VALUE_SYMBOL, value);
+
+  if(table->profiling)
+  {
+    cg_table_profile_end(table, ids, m, &sample);
+  }
+
+  if(cg_trace_active())
+  {
+    cg_trace_node(cg_table_entry(table, ids[m - 1])->node, "forward", start);
+  }
+
+  UNPROTECT(1);
+}
+
+void cg_fusion_zero_grad(const cg_table_t *table, SEXP group, const int *states)
+{
+  cg_fusion_t fusion;
+
+  int *ids = INTEGER(group);
+
+  R_len_t m = XLENGTH(group);
+
+  // The intermediate operators only have a gradient if the group could not
+  // be fused (in which case the operators are differentiated one by one)
+  if(!cg_fusion_prepare(table, group, &fusion))
+  {
+    for(int j = 0; j < m - 1; j++)
+    {
+      if(states[ids[j]] == CGGPENDING)
+      {
+        cg_node_zero_grad(cg_table_entry(table, ids[j])->node);
+      }
+    }
+  }
+}
+
+void cg_fusion_backward(const cg_table_t *table, SEXP group, int *states)
+{
+  cg_fusion_t fusion;
+
+  int *ids = INTEGER(group);
+
+  R_len_t m = XLENGTH(group);
+
+  // The last operator in the group depends on all other operators
+  if(states != NULL && states[ids[m - 1]] == CGGPRUNED)
+  {
+    return;
+  }
+
+  if(!cg_fusion_prepare(table, group, &fusion))
+  {
+    for(int j = m - 1; j >= 0; j--)
+    {
+      cg_table_backward(table, ids[j], states);
+    }
+
+    return;
+  }
+
+  cg_profile_sample_t sample;
+
+  double start = cg_trace_active() ? cg_profile_time() : 0;
+
+  if(table->profiling)
+  {
+    cg_table_profile_begin(table, ids, m, CGPBACKWARD, &sample);
+  }
+
+  SEXP node = cg_table_entry(table, ids[m - 1])->node;
+
+  SEXP grad = PROTECT(cg_node_grad(node));
+
+  int batch = cg_node_grad_batch(node);
+
+  if(!Rf_isReal(grad) || XLENGTH(grad) != fusion.n * batch)
+  {
+    Rf_errorcall(R_NilValue, "cannot differentiate node '%s'", cg_node_name_char(node));
+  }
+
+  double *pl[2 * CG_FUSION_MAX_OPS];
+
+  for(int k = 0; k < fusion.l; k++)
+  {
+    const cg_table_entry_t *leaf = cg_table_entry(table, fusion.leaves[k]);
+
+    pl[k] = NULL;
+
+    if(!cg_node_differentiate(leaf->type, states, fusion.leaves[k]))
+    {
+      continue;
+    }
+
+    // Note: the gradients of the leaves are accumulated element by element,
+    // so a leaf to which no gradient was propagated yet is zeroed first
+    if(states != NULL && states[fusion.leaves[k]] != CGGWRITTEN)
+    {
+      SEXP leaf_grad = cg_node_alloc_grad(leaf->node, batch);
+
+      memset(REAL(leaf_grad), 0, XLENGTH(leaf_grad) * sizeof(double));
+
+      states[fusion.leaves[k]] = CGGWRITTEN;
+    }
+
+    SEXP leaf_grad = cg_node_grad(leaf->node);
+
+    if(!Rf_isReal(leaf_grad) || XLENGTH(leaf_grad) != fusion.len[k] * batch)
+    {
+      Rf_errorcall(R_NilValue, "cannot accumulate gradients of lengths %d and %d for node '%s'",
+                   XLENGTH(leaf_grad), fusion.len[k] * batch, cg_node_name_char(leaf->node));
+    }
+
+    pl[k] = REAL(leaf_grad);
+  }
+
+  double *pg = REAL(grad);
+
+  double tmp[CG_FUSION_MAX_OPS], adj[CG_FUSION_MAX_OPS];
+
+  int naflag = 0;
+
+  // Note: the values of the intermediate operators are evaluated once for
+  // each element and shared by all blocks of a batched gradient
+  for(R_xlen_t i = 0; i < fusion.n; i++)
+  {
+    cg_fusion_eval(&fusion, i, tmp, &naflag);
+
+    for(int b = 0; b < batch; b++)
+    {
+      memset(adj, 0, m * sizeof(double));
+
+      adj[m - 1] = pg[i + b * fusion.n];
+
+      for(int j = m - 1; j >= 0; j--)
+      {
+        const cg_fusion_op_t *op = &fusion.ops[j];
+
+        double x = cg_fusion_arg(&fusion, op->inputs[0], tmp, i);
+
+        double y = (op->n > 1) ? cg_fusion_arg(&fusion, op->inputs[1], tmp, i) : 0;
+
+        for(int r = 0; r < op->n; r++)
+        {
+          int index = op->inputs[r];
+
+          if(index >= 0)
+          {
+            adj[index] += op->def->grads[r](x, y, tmp[j], adj[j]);
+          }
+          else
+          {
+            int k = -index - 1;
+
+            if(pl[k] != NULL)
+            {
+              pl[k][(fusion.len[k] == 1 ? 0 : i) + b * fusion.len[k]] += op->def->grads[r](x, y, tmp[j], adj[j]);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if(table->profiling)
+  {
+    cg_table_profile_end(table, ids, m, &sample);
+  }
+
+  if(cg_trace_active())
+  {
+    cg_trace_node(node, "backward", start);
+  }
+
+  UNPROTECT(1);
+}
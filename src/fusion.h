@@ -0,0 +1,54 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef FUSION_H
+#define FUSION_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "table.h"
+
+/*
+ * MACROS
+ */
+
+#define CG_FUSION_MAX_OPS 32
+
+/*
+ * A fusion group is a set of element-wise operators that is evaluated by a
+ * single loop over the elements of its inputs. Each operator in the group
+ * (except the last one) is consumed by exactly one other operator in the same
+ * group. A group is stored as an integer vector containing the ids of its
+ * operators in topological order. Only the last operator in the group stores
+ * its value and gradient, the intermediate operators are never materialized.
+ */
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+SEXP cg_fusion_groups(const cg_table_t *table, SEXP target, SEXP forward);
+
+void cg_fusion_forward(const cg_table_t *table, SEXP group);
+
+void cg_fusion_zero_grad(const cg_table_t *table, SEXP group, const int *states);
+
+void cg_fusion_backward(const cg_table_t *table, SEXP group, int *states);
+
+#endif
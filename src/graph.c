@@ -20,129 +20,319 @@ limitations under the License.
 #include <Rinternals.h>
 
 #include "node.h"
+#include "plan.h"
 #include "graph.h"
-#include "stack.h"
+#include "fusion.h"
+#include "table.h"
+#include "memory.h"
 #include "session.h"
+#include "schedule.h"
+#include "trace.h"
 #include "function.h"
 
 /*
  * INLINED GET/SET FUNCTIONS
  */
 
-extern inline SEXP cg_graph_nodes(SEXP graph);
+extern inline int cg_graph_size(SEXP graph);
 
 extern inline int cg_graph_eager(SEXP graph);
 
 extern inline void cg_graph_set_eager(SEXP graph, const int eager);
 
+extern inline int cg_graph_fuse(SEXP graph);
+
+extern inline int cg_graph_profiling(SEXP graph);
+
+extern inline int cg_graph_threads(SEXP graph);
+
+extern inline int cg_graph_version(SEXP graph);
+
 /*
  * PRIVATE FUNCTIONS
  */
 
-SEXP* cg_graph_dfs_from(SEXP graph, SEXP target, int (*filter)(SEXP node), int *k)
+static SEXP cg_graph_target_plan(SEXP graph, SEXP target)
 {
-  SEXP nodes = PROTECT(cg_graph_nodes(graph));
+  if(cg_is(target, "cg_plan"))
+  {
+    if(cg_plan_graph(target) != graph)
+    {
+      Rf_errorcall(R_NilValue, "argument 'target' must be a plan of argument 'graph'");
+    }
+
+    return cg_plan_update(target);
+  }
 
-  int id = cg_node_id(target);
+  if(!cg_is(target, "cg_node"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'target' must be a cg_node or cg_plan object");
+  }
 
-  R_len_t n = XLENGTH(nodes);
+  return cg_graph_plan(graph, target);
+}
 
-  if(id < 1 || id > n)
+// Note: only the nodes that lie on a path from one of the requested nodes to
+// the target are differentiated, the other nodes in the backward order are
+// pruned. The backward order lists the inputs of a node before the node.
+static void cg_graph_prune(const cg_table_t *table, SEXP backward, SEXP groups, SEXP wrt, int *states)
+{
+  if(TYPEOF(wrt) != VECSXP)
   {
-    Rf_errorcall(R_NilValue, "cannot retrieve node with id %d", id);
+    Rf_errorcall(R_NilValue, "argument 'wrt' must be NULL or a list of cg_node objects");
   }
 
-  int *visited = Calloc(n, int);
+  int *reach = (int*)R_alloc(table->size + 1, sizeof(int));
+
+  memset(reach, 0, (table->size + 1) * sizeof(int));
+
+  R_len_t n = XLENGTH(wrt);
 
-  SEXP *queue = (SEXP*)R_alloc(n, sizeof(SEXP));
+  for(int i = 0; i < n; i++)
+  {
+    SEXP node = VECTOR_ELT(wrt, i);
 
-  cg_stack_t *stack = cg_stack_allocate(n);
+    if(!cg_is(node, "cg_node"))
+    {
+      Rf_errorcall(R_NilValue, "argument 'wrt' must be NULL or a list of cg_node objects");
+    }
 
-  cg_stack_push(stack, target);
+    int id = cg_table_id(table, node);
 
-  visited[id - 1] = 1;
+    reach[id] = 1;
 
-  *k = 0;
+    if(cg_table_entry(table, id)->type == CGIPT)
+    {
+      states[id] = CGGREQUESTED;
+    }
+  }
 
-  while(!cg_stack_is_empty(stack))
-  {
-    int can_traverse = 0;
+  int *order = INTEGER(backward);
 
-    SEXP node = cg_stack_peek(stack);
+  R_len_t k = XLENGTH(backward);
 
-    SEXP inputs = PROTECT(CG_GET(node, CG_INPUTS_SYMBOL));
+  for(int i = 0; i < k; i++)
+  {
+    int m, *members = cg_plan_members(groups, &order[i], &m);
 
-    if(TYPEOF(inputs) == VECSXP)
+    for(int j = 0; j < m; j++)
     {
-      R_len_t m = XLENGTH(inputs);
+      const cg_table_entry_t *entry = cg_table_entry(table, members[j]);
+
+      int *inputs = cg_table_inputs(table, entry);
 
-      for(int i = 0; i < m; i++)
+      for(int q = 0; q < entry->n && !reach[members[j]]; q++)
       {
-        SEXP input = VECTOR_ELT(inputs, i);
+        reach[members[j]] = reach[inputs[q]];
+      }
 
-        if(TYPEOF(input) != ENVSXP)
-        {
-          Rf_errorcall(R_NilValue, "node '%s' has an invalid input at index %d",
-                       cg_node_name(node), i + 1);
-        }
+      if(!reach[members[j]])
+      {
+        states[members[j]] = CGGPRUNED;
+      }
+    }
+  }
+}
 
-        int input_id = cg_node_id(input);
+// Note: the gradients of the target and the states of the nodes must have
+// been initialized before calling this function
+static void cg_graph_differentiate(SEXP graph, SEXP plan, const cg_table_t *table, int *states)
+{
+  SEXP groups = PROTECT(cg_plan_groups(plan));
 
-        if(input_id < 1 || input_id > n)
-        {
-          Rf_errorcall(R_NilValue, "cannot retrieve node with id %d", input_id);
-        }
+  SEXP backward = PROTECT(cg_plan_backward(plan));
 
-        if(!visited[input_id - 1] && filter(input))
-        {
-          cg_stack_push(stack, input);
+  // The values of the operators were released up to checkpoints by the
+  // forward pass
+  SEXP segments = PROTECT(cg_plan_segments(plan));
 
-          visited[input_id - 1] = 1;
+  int threads = table->profiling ? 1 : cg_graph_threads(graph);
 
-          can_traverse = 1;
+  if(!Rf_isNull(segments))
+  {
+    cg_memory_backward(table, cg_plan_forward(plan), backward, groups, segments, states);
+  }
+  else if(threads > 1)
+  {
+    cg_schedule_backward(table, backward, groups, cg_plan_backward_levels(plan), threads, states);
+  }
+  else
+  {
+    int *order = INTEGER(backward);
 
-          break;
-        }
+    for(int i = XLENGTH(backward) - 1; i >= 0; i--)
+    {
+      if(cg_plan_is_group(order[i]))
+      {
+        cg_fusion_backward(table, cg_plan_group(groups, order[i]), states);
+      }
+      else
+      {
+        cg_table_backward(table, order[i], states);
       }
     }
+  }
+
+  UNPROTECT(3);
+}
+
+static SEXP cg_graph_seed_tangent(SEXP node, SEXP direction)
+{
+  SEXP value = PROTECT(cg_node_value(node));
+
+  if(!Rf_isNumeric(value))
+  {
+    Rf_errorcall(R_NilValue, "cannot differentiate object of type '%s' for node '%s'",
+                 Rf_type2char(TYPEOF(value)), cg_node_name_char(node));
+  }
+
+  if(XLENGTH(direction) != XLENGTH(value))
+  {
+    Rf_errorcall(R_NilValue, "argument 'direction' must have the same length as the value of node '%s'",
+                 cg_node_name_char(node));
+  }
+
+  R_xlen_t n = XLENGTH(value);
+
+  SEXP tangent = PROTECT(Rf_allocVector(REALSXP, n));
+
+  double *pt = REAL(tangent);
 
-    if(!can_traverse)
+  if(Rf_isReal(direction))
+  {
+    memcpy(pt, REAL(direction), n * sizeof(double));
+  }
+  else
+  {
+    int *pd = INTEGER(direction);
+
+    for(R_xlen_t i = 0; i < n; i++)
     {
-      queue[(*k)++] = cg_stack_pop(stack);
+      pt[i] = (pd[i] == NA_INTEGER) ? NA_REAL : pd[i];
     }
-
-    UNPROTECT(1);
   }
 
-  Free(visited);
+  SHALLOW_DUPLICATE_ATTRIB(tangent, value);
 
-  UNPROTECT(1);
+  UNPROTECT(2);
 
-  return queue;
+  return tangent;
 }
 
-static inline int forward_filter(SEXP node)
+// Note: the values and tangents of the nodes are evaluated by a single sweep
+// over the forward order. The tangents are stored in a list that is indexed
+// by the ids of the nodes, where NULL denotes a zero tangent. The operators
+// in a fusion group are evaluated one by one, since the tangents of the
+// intermediate operators are needed. The tangent of an operator that is
+// seeded is set once its value has been evaluated.
+static void cg_graph_propagate_tangents(const cg_table_t *table, SEXP plan, SEXP tangents,
+                                        SEXP node, SEXP direction)
 {
-  cg_node_type_t type = cg_node_type(node);
+  SEXP groups = PROTECT(cg_plan_groups(plan));
 
-  if(type == CGDOP || type == CGNOP)
+  SEXP forward = PROTECT(cg_plan_forward(plan));
+
+  int *order = INTEGER(forward), seed = Rf_isNull(node) ? 0 : cg_node_id(node);
+
+  R_len_t k = XLENGTH(forward);
+
+  for(int i = 0; i < k; i++)
   {
-    return 1;
+    int m, *members = cg_plan_members(groups, &order[i], &m);
+
+    for(int j = 0; j < m; j++)
+    {
+      int id = members[j];
+
+      cg_table_forward(table, id);
+
+      if(id == seed)
+      {
+        SET_VECTOR_ELT(tangents, seed - 1, cg_graph_seed_tangent(node, direction));
+      }
+      else
+      {
+        cg_table_tangent(table, id, tangents);
+      }
+    }
+  }
+
+  UNPROTECT(2);
+}
+
+// Note: the backward order is traversed member by member (i.e. fusion groups
+// are not fused), so that the gradients of all operators are materialized.
+// Only the operators whose gradient has been written propagate their
+// gradient.
+static void cg_graph_propagate_grads(const cg_table_t *table, SEXP plan, int *states)
+{
+  SEXP groups = PROTECT(cg_plan_groups(plan));
+
+  SEXP backward = PROTECT(cg_plan_backward(plan));
+
+  int *order = INTEGER(backward);
+
+  for(int i = XLENGTH(backward) - 1; i >= 0; i--)
+  {
+    int m, *members = cg_plan_members(groups, &order[i], &m);
+
+    for(int j = m - 1; j >= 0; j--)
+    {
+      if(states[members[j]] == CGGWRITTEN)
+      {
+        cg_table_backward(table, members[j], states);
+      }
+    }
   }
 
-  return 0;
+  UNPROTECT(2);
 }
 
-static inline int backward_filter(SEXP node)
+static int cg_graph_default_id(const char *name)
 {
-  cg_node_type_t type = cg_node_type(node);
+  if(name[0] != 'v' || name[1] < '1' || name[1] > '9')
+  {
+    return 0;
+  }
 
-  if(type == CGDOP || type == CGPRM)
+  int id = 0;
+
+  for(const char *p = name + 1; *p != '\0'; p++)
   {
-    return 1;
+    if(*p < '0' || *p > '9' || id > (INT_MAX - 9) / 10)
+    {
+      return 0;
+    }
+
+    id = 10 * id + (*p - '0');
   }
 
-  return 0;
+  return id;
+}
+
+static void cg_graph_table_finalize(SEXP ptr)
+{
+  cg_table_free((cg_table_t*)R_ExternalPtrAddr(ptr));
+
+  R_ClearExternalPtr(ptr);
+}
+
+// Note: data member 'nodes' is a read-only active binding that retrieves the
+// nodes in the buffer of the graph. The binding is installed by the
+// constructor, so that graphs that are loaded from a file also have it.
+static void cg_graph_bind_nodes(SEXP graph)
+{
+  SEXP body = PROTECT(Rf_lang4(Rf_install(".Call"), Rf_mkString("cg_graph_nodes"), graph, Rf_mkString("cgraph")));
+
+  SET_TAG(CDR(CDDR(body)), Rf_install("PACKAGE"));
+
+  SEXP definition = PROTECT(Rf_lang3(Rf_install("function"), R_NilValue, body));
+
+  SEXP fun = PROTECT(Rf_eval(definition, R_BaseEnv));
+
+  R_MakeActiveBinding(CG_NODES_SYMBOL, fun, graph);
+
+  UNPROTECT(3);
 }
 
 /*
@@ -161,135 +351,753 @@ SEXP cg_graph_get(SEXP graph, SEXP name)
     Rf_errorcall(R_NilValue, "argument 'name' must be a character scalar");
   }
 
-  SEXP nodes = PROTECT(CG_GET(graph, CG_NODES_SYMBOL));
-
   const char *pn = CHAR(STRING_ELT(name, 0));
 
-  if(TYPEOF(nodes) == VECSXP)
+  cg_table_t *table = cg_graph_table(graph);
+
+  int id = cg_table_find(table, STRING_ELT(name, 0)), k = cg_graph_default_id(pn);
+
+  // Nodes without a name are named by their id (e.g. 'v1')
+  if(k > id && k <= table->size && Rf_isNull(cg_node_name(table->entries[k - 1].node)))
   {
-    R_len_t n = XLENGTH(nodes);
+    id = k;
+  }
 
-    for(int i = n - 1; i >= 0; i--)
+  if(id > 0 && strcmp(cg_node_name_char(table->entries[id - 1].node), pn) == 0)
+  {
+    return table->entries[id - 1].node;
+  }
+
+  Rf_errorcall(R_NilValue, "cannot find node '%s'", pn);
+}
+
+SEXP cg_graph_nodes(SEXP graph)
+{
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  if(table->size == 0)
+  {
+    return R_NilValue;
+  }
+
+  SEXP nodes = PROTECT(Rf_allocVector(VECSXP, table->size));
+
+  for(int i = 0; i < table->size; i++)
+  {
+    SET_VECTOR_ELT(nodes, i, table->entries[i].node);
+  }
+
+  UNPROTECT(1);
+
+  return nodes;
+}
+
+void cg_graph_add_node(SEXP graph, SEXP node)
+{
+  SEXP nodes = PROTECT(Rf_allocVector(VECSXP, 1));
+
+  SET_VECTOR_ELT(nodes, 0, node);
+
+  cg_graph_add_nodes(graph, nodes);
+
+  UNPROTECT(1);
+}
+
+void cg_graph_add_nodes(SEXP graph, SEXP nodes)
+{
+  if(TYPEOF(nodes) != VECSXP)
+  {
+    Rf_errorcall(R_NilValue, "argument 'nodes' must be a list of nodes");
+  }
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  int index;
+
+  SEXP storage = R_NilValue;
+
+  PROTECT_WITH_INDEX(storage = CG_GET(graph, CG_STORAGE_SYMBOL), &index);
+
+  R_len_t n = table->size, m = XLENGTH(nodes);
+
+  R_len_t capacity = (TYPEOF(storage) == VECSXP) ? XLENGTH(storage) : 0;
+
+  // Note: the storage grows geometrically so that adding a node takes
+  // amortized constant time. Only the first 'size' elements are nodes.
+  if(n + m > capacity)
+  {
+    while(n + m > capacity)
+    {
+      capacity = (capacity > 0) ? 2 * capacity : 16;
+    }
+
+    SEXP grown = PROTECT(Rf_allocVector(VECSXP, capacity));
+
+    for(int i = 0; i < n; i++)
+    {
+      SET_VECTOR_ELT(grown, i, VECTOR_ELT(storage, i));
+    }
+
+    REPROTECT(storage = grown, index);
+
+    UNPROTECT(1);
+
+    CG_SET(graph, CG_STORAGE_SYMBOL, storage);
+
+    // The table keeps the storage alive. The table is rebuilt if the
+    // storage no longer matches the storage that is held by the graph.
+    R_SetExternalPtrProtected(CG_GET(graph, CG_TABLE_SYMBOL), storage);
+  }
+
+  for(int i = 0; i < m; i++)
+  {
+    SEXP node = VECTOR_ELT(nodes, i);
+
+    if(!cg_is(node, "cg_node"))
+    {
+      Rf_errorcall(R_NilValue, "argument 'nodes' must be a list of nodes");
+    }
+
+    SET_VECTOR_ELT(storage, n + i, node);
+
+    cg_node_set_id(node, n + i + 1);
+
+    // The graph is stored so that the name index can be updated once the
+    // node is renamed
+    CG_SET(node, CG_GRAPH_SYMBOL, graph);
+
+    cg_table_add(table, node);
+
+    CG_SET(graph, CG_SIZE_SYMBOL, Rf_ScalarInteger(n + i + 1));
+  }
+
+  CG_SET(graph, CG_VERSION_SYMBOL, Rf_ScalarInteger(cg_graph_version(graph) + 1));
+
+  CG_SET(graph, CG_PLANS_SYMBOL, R_NilValue);
+
+  UNPROTECT(1);
+}
+
+cg_table_t* cg_graph_table(SEXP graph)
+{
+  SEXP storage = PROTECT(CG_GET(graph, CG_STORAGE_SYMBOL));
+
+  SEXP ptr = PROTECT(CG_GET(graph, CG_TABLE_SYMBOL));
+
+  int n = cg_graph_size(graph);
+
+  if(TYPEOF(ptr) == EXTPTRSXP && R_ExternalPtrAddr(ptr) != NULL &&
+     R_ExternalPtrProtected(ptr) == storage &&
+     ((cg_table_t*)R_ExternalPtrAddr(ptr))->size == n)
+  {
+    cg_table_t *table = (cg_table_t*)R_ExternalPtrAddr(ptr);
+
+    cg_table_set_profiling(table, cg_graph_profiling(graph));
+
+    UNPROTECT(2);
+
+    return table;
+  }
+
+  if(TYPEOF(storage) != VECSXP || XLENGTH(storage) < n)
+  {
+    n = 0;
+  }
+
+  cg_table_t *table = cg_table_allocate(n);
+
+  ptr = PROTECT(R_MakeExternalPtr(table, R_NilValue, storage));
+
+  R_RegisterCFinalizerEx(ptr, cg_graph_table_finalize, TRUE);
+
+  for(int i = 0; i < n; i++)
+  {
+    cg_table_add(table, VECTOR_ELT(storage, i));
+  }
+
+  CG_SET(graph, CG_TABLE_SYMBOL, ptr);
+
+  cg_table_set_profiling(table, cg_graph_profiling(graph));
+
+  UNPROTECT(3);
+
+  return table;
+}
+
+SEXP cg_graph_plan(SEXP graph, SEXP target)
+{
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  if(!cg_is(target, "cg_node"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'target' must be a cg_node object");
+  }
+
+  int index;
+
+  SEXP plans = R_NilValue;
+
+  PROTECT_WITH_INDEX(plans = CG_GET(graph, CG_PLANS_SYMBOL), &index);
+
+  R_len_t n = 0;
+
+  if(TYPEOF(plans) == VECSXP)
+  {
+    n = XLENGTH(plans);
+
+    for(int i = 0; i < n; i++)
     {
-      SEXP node = VECTOR_ELT(nodes, i);
+      SEXP plan = VECTOR_ELT(plans, i);
 
-      if(strcmp(cg_node_name_char(node), pn) == 0)
+      if(cg_plan_target(plan) == target)
       {
         UNPROTECT(1);
 
-        return node;
+        return cg_plan_update(plan);
       }
     }
+
+    REPROTECT(plans = Rf_lengthgets(plans, n + 1), index);
+  }
+  else
+  {
+    REPROTECT(plans = Rf_allocVector(VECSXP, 1), index);
   }
 
-  Rf_errorcall(R_NilValue, "cannot find node '%s'", pn);
+  SEXP plan = PROTECT(cg_plan(graph, target));
+
+  SET_VECTOR_ELT(plans, n, plan);
+
+  CG_SET(graph, CG_PLANS_SYMBOL, plans);
+
+  UNPROTECT(2);
+
+  return plan;
 }
 
-void cg_graph_add_node(SEXP graph, SEXP node)
+SEXP cg_graph_forward(SEXP graph, SEXP target, SEXP free, SEXP checkpoints)
 {
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  cg_release_t mode = cg_memory_mode(free);
+
+  double start = cg_trace_active() ? cg_profile_time() : 0;
+
+  SEXP plan = PROTECT(cg_graph_target_plan(graph, target));
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  SEXP groups = PROTECT(cg_plan_groups(plan));
+
+  SEXP forward = PROTECT(cg_plan_forward(plan));
+
+  SEXP backward = PROTECT(CG_GET(plan, CG_BACKWARD_SYMBOL));
+
+  // Note: the operators are evaluated one by one if the graph is profiled
+  int threads = table->profiling ? 1 : cg_graph_threads(graph);
+
+  SEXP levels = (threads > 1) ? cg_plan_forward_levels(plan) : R_NilValue;
+
   int index;
 
-  SEXP nodes = R_NilValue;
+  SEXP segments = R_NilValue;
 
-  PROTECT_WITH_INDEX(nodes = CG_GET(graph, CG_NODES_SYMBOL), &index);
+  PROTECT_WITH_INDEX(segments = R_NilValue, &index);
 
-  if(TYPEOF(nodes) != VECSXP)
+  if(mode == CGRCHECKPOINT && !Rf_isNull(backward))
   {
-    REPROTECT(nodes = Rf_allocVector(VECSXP, 1), index);
+    REPROTECT(segments = cg_memory_segments(table, forward, groups, checkpoints), index);
+  }
+  else if(mode == CGRCHECKPOINT)
+  {
+    mode = CGRALL;
+  }
+
+  cg_plan_set_segments(plan, segments);
 
-    SET_VECTOR_ELT(nodes, 0, node);
+  cg_memory_plan_t *memory = NULL;
 
-    cg_node_set_id(node, 1);
+  if(mode != CGRNONE)
+  {
+    memory = cg_memory_plan(table, cg_node_id(cg_plan_target(plan)), forward,
+                            groups, backward, levels, segments, mode);
+  }
+
+  if(threads > 1)
+  {
+    cg_schedule_forward(table, forward, groups, levels, threads, memory);
   }
   else
   {
-    R_len_t n = XLENGTH(nodes);
+    int *order = INTEGER(forward);
 
-    REPROTECT(nodes = Rf_lengthgets(nodes, n + 1), index);
+    R_len_t k = XLENGTH(forward);
+
+    for(int i = 0; i < k; i++)
+    {
+      if(cg_plan_is_group(order[i]))
+      {
+        cg_fusion_forward(table, cg_plan_group(groups, order[i]));
+      }
+      else
+      {
+        cg_table_forward(table, order[i]);
+      }
 
-    SET_VECTOR_ELT(nodes, n, node);
+      cg_memory_release(table, memory, i);
+    }
+  }
 
-    cg_node_set_id(node, n + 1);
+  if(cg_trace_active())
+  {
+    cg_trace_event("cg_graph_forward", "graph", 0, start, cg_profile_time(), cg_node_id(cg_plan_target(plan)));
   }
 
-  CG_SET(graph, CG_NODES_SYMBOL, nodes);
+  UNPROTECT(5);
 
-  UNPROTECT(1);
+  return R_NilValue;
 }
 
-SEXP cg_graph_forward(SEXP graph, SEXP target)
+SEXP cg_graph_backward(SEXP graph, SEXP target, SEXP index, SEXP wrt)
 {
   if(!cg_is(graph, "cg_graph"))
   {
     Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
   }
 
-  if(!cg_is(target, "cg_node"))
+  if(!Rf_isNull(index) && (!Rf_isNumeric(index) || XLENGTH(index) != 1))
   {
-    Rf_errorcall(R_NilValue, "argument 'target' must be a cg_node object");
+    Rf_errorcall(R_NilValue, "argument 'index' must be NULL or a numeric scalar");
   }
 
-  cg_node_type_t type = cg_node_type(target);
+  double start = cg_trace_active() ? cg_profile_time() : 0;
+
+  SEXP plan = PROTECT(cg_graph_target_plan(graph, target));
 
-  if(type != CGDOP && type != CGNOP)
+  SEXP plan_target = PROTECT(cg_plan_target(plan));
+
+  if(cg_node_type(plan_target) != CGDOP)
   {
-    Rf_errorcall(R_NilValue, "argument 'target' must be an operator");
+    Rf_errorcall(R_NilValue, "argument 'target' must be a differentiable operator");
   }
 
-  int k = 0;
+  cg_table_t *table = cg_graph_table(graph);
 
-  SEXP *queue = cg_graph_dfs_from(graph, target, forward_filter, &k);
+  SEXP groups = PROTECT(cg_plan_groups(plan));
 
-  for(int i = 0; i < k; i++)
+  SEXP backward = PROTECT(cg_plan_backward(plan));
+
+  int *order = INTEGER(backward);
+
+  R_len_t k = XLENGTH(backward);
+
+  // Note: the gradients are not zeroed before the backward pass, the first
+  // gradient that is propagated to a node overwrites its gradient instead
+  int *states = (int*)R_alloc(table->size + 1, sizeof(int));
+
+  memset(states, 0, (table->size + 1) * sizeof(int));
+
+  if(!Rf_isNull(wrt))
   {
-    cg_node_forward(queue[i]);
+    cg_graph_prune(table, backward, groups, wrt, states);
+  }
+
+  cg_node_init_grad(plan_target, index);
+
+  states[cg_node_id(plan_target)] = CGGWRITTEN;
+
+  cg_graph_differentiate(graph, plan, table, states);
+
+  // Zero the gradients of the nodes to which no gradient was propagated
+  if(Rf_isNull(cg_plan_segments(plan)))
+  {
+    for(int i = k - 1; i >= 0; i--)
+    {
+      if(cg_plan_is_group(order[i]))
+      {
+        cg_fusion_zero_grad(table, cg_plan_group(groups, order[i]), states);
+      }
+
+      int m, *members = cg_plan_members(groups, &order[i], &m), id = members[m - 1];
+
+      if(states[id] == CGGPENDING)
+      {
+        cg_node_zero_grad(cg_table_entry(table, id)->node);
+      }
+    }
+  }
+
+  for(int id = 1; id <= table->size; id++)
+  {
+    if(states[id] == CGGREQUESTED)
+    {
+      cg_node_zero_grad(cg_table_entry(table, id)->node);
+    }
   }
 
+  if(cg_trace_active())
+  {
+    cg_trace_event("cg_graph_backward", "graph", 0, start, cg_profile_time(), cg_node_id(plan_target));
+  }
+
+  UNPROTECT(4);
+
   return R_NilValue;
 }
 
-SEXP cg_graph_backward(SEXP graph, SEXP target, SEXP index)
+SEXP cg_graph_jacobian(SEXP graph, SEXP target, SEXP wrt)
 {
   if(!cg_is(graph, "cg_graph"))
   {
     Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
   }
 
-  if(!cg_is(target, "cg_node"))
+  SEXP plan = PROTECT(cg_graph_target_plan(graph, target));
+
+  SEXP plan_target = PROTECT(cg_plan_target(plan));
+
+  if(cg_node_type(plan_target) != CGDOP)
   {
-    Rf_errorcall(R_NilValue, "argument 'target' must be a cg_node object");
+    Rf_errorcall(R_NilValue, "argument 'target' must be a differentiable operator");
+  }
+
+  SEXP value = PROTECT(cg_node_value(plan_target));
+
+  if(!Rf_isNumeric(value) || XLENGTH(value) < 1)
+  {
+    Rf_errorcall(R_NilValue, "cannot differentiate object of type '%s' for node '%s'",
+                 Rf_type2char(TYPEOF(value)), cg_node_name_char(plan_target));
+  }
+
+  if(TYPEOF(wrt) != VECSXP)
+  {
+    Rf_errorcall(R_NilValue, "argument 'wrt' must be a list of cg_node objects");
+  }
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  int *states = (int*)R_alloc(table->size + 1, sizeof(int));
+
+  memset(states, 0, (table->size + 1) * sizeof(int));
+
+  cg_graph_prune(table, cg_plan_backward(plan), cg_plan_groups(plan), wrt, states);
+
+  // Note: each element of the target is seeded by a separate block of the
+  // gradient of the target, so that all rows of the Jacobian are obtained
+  // by a single batched backward pass
+  R_xlen_t m = XLENGTH(value);
+
+  SEXP seed = PROTECT(Rf_allocVector(REALSXP, m * m));
+
+  double *ps = REAL(seed);
+
+  memset(ps, 0, m * m * sizeof(double));
+
+  for(R_xlen_t b = 0; b < m; b++)
+  {
+    ps[b + b * m] = 1;
+  }
+
+  CG_SET(plan_target, CG_GRAD_SYMBOL, seed);
+
+  states[cg_node_id(plan_target)] = CGGWRITTEN;
+
+  cg_graph_differentiate(graph, plan, table, states);
+
+  R_len_t n = XLENGTH(wrt);
+
+  SEXP jacobian = PROTECT(Rf_allocVector(VECSXP, n));
+
+  SEXP names = PROTECT(Rf_allocVector(STRSXP, n));
+
+  for(int i = 0; i < n; i++)
+  {
+    SEXP node = VECTOR_ELT(wrt, i);
+
+    int id = cg_node_id(node);
+
+    R_xlen_t l = XLENGTH(cg_node_value(node));
+
+    SEXP block = PROTECT(Rf_allocMatrix(REALSXP, m, l));
+
+    double *pj = REAL(block);
+
+    if(states[id] == CGGWRITTEN)
+    {
+      double *pg = REAL(cg_node_grad(node));
+
+      for(R_xlen_t b = 0; b < m; b++)
+      {
+        for(R_xlen_t j = 0; j < l; j++)
+        {
+          pj[b + j * m] = pg[j + b * l];
+        }
+      }
+    }
+    else
+    {
+      memset(pj, 0, m * l * sizeof(double));
+    }
+
+    SET_VECTOR_ELT(jacobian, i, block);
+
+    SET_STRING_ELT(names, i, Rf_mkChar(cg_node_name_char(node)));
+
+    UNPROTECT(1);
   }
 
-  if(cg_node_type(target) != CGDOP)
+  Rf_setAttrib(jacobian, R_NamesSymbol, names);
+
+  // The batched gradients do not have the shape of the values of the nodes
+  for(int id = 1; id <= table->size; id++)
+  {
+    if(states[id] == CGGWRITTEN)
+    {
+      CG_SET(cg_table_entry(table, id)->node, CG_GRAD_SYMBOL, R_NilValue);
+    }
+  }
+
+  UNPROTECT(6);
+
+  return jacobian;
+}
+
+SEXP cg_graph_jvp(SEXP graph, SEXP target, SEXP node, SEXP direction)
+{
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  if(!cg_is(node, "cg_node"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'node' must be a cg_node object");
+  }
+
+  if(!Rf_isNumeric(direction))
+  {
+    Rf_errorcall(R_NilValue, "argument 'direction' must be a numeric vector or array");
+  }
+
+  SEXP plan = PROTECT(cg_graph_target_plan(graph, target));
+
+  SEXP plan_target = PROTECT(cg_plan_target(plan));
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  int seed = cg_table_id(table, node);
+
+  SEXP tangents = PROTECT(Rf_allocVector(VECSXP, table->size));
+
+  if(cg_node_type(node) != CGDOP)
+  {
+    SET_VECTOR_ELT(tangents, seed - 1, cg_graph_seed_tangent(node, direction));
+  }
+
+  cg_graph_propagate_tangents(table, plan, tangents, node, direction);
+
+  SEXP tangent = VECTOR_ELT(tangents, cg_node_id(plan_target) - 1);
+
+  // The target does not depend on the node
+  if(Rf_isNull(tangent))
+  {
+    SEXP value = PROTECT(cg_node_value(plan_target));
+
+    if(!Rf_isNumeric(value))
+    {
+      Rf_errorcall(R_NilValue, "cannot differentiate object of type '%s' for node '%s'",
+                   Rf_type2char(TYPEOF(value)), cg_node_name_char(plan_target));
+    }
+
+    tangent = Rf_allocVector(REALSXP, XLENGTH(value));
+
+    memset(REAL(tangent), 0, XLENGTH(value) * sizeof(double));
+
+    SHALLOW_DUPLICATE_ATTRIB(tangent, value);
+
+    UNPROTECT(1);
+  }
+
+  UNPROTECT(3);
+
+  return tangent;
+}
+
+// Note: the Hessian-vector product is evaluated by forward-over-reverse
+// differentiation. The tangent of the gradient of a node is the sum of the
+// gradients that are propagated back from the tangents of the gradients of
+// its consumers and the second-order terms of these gradients (i.e. the
+// derivatives of the gradient functions along the tangents of the inputs
+// while holding the gradients fixed). Hence, the second-order terms are
+// computed first and then propagated by a second backward pass. The
+// second-order terms of operators without a native kernel are only
+// approximated if argument 'approx' is TRUE.
+SEXP cg_graph_hvp(SEXP graph, SEXP target, SEXP parms, SEXP v, SEXP approx)
+{
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  if(TYPEOF(parms) != VECSXP)
+  {
+    Rf_errorcall(R_NilValue, "argument 'parms' must be a list of cg_node objects");
+  }
+
+  if(TYPEOF(v) != VECSXP || XLENGTH(v) != XLENGTH(parms))
+  {
+    Rf_errorcall(R_NilValue, "argument 'v' must be a list with a direction for each node in argument 'parms'");
+  }
+
+  if(!IS_SCALAR(approx, LGLSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'approx' must be a logical scalar");
+  }
+
+  SEXP plan = PROTECT(cg_graph_target_plan(graph, target));
+
+  SEXP plan_target = PROTECT(cg_plan_target(plan));
+
+  if(cg_node_type(plan_target) != CGDOP)
   {
     Rf_errorcall(R_NilValue, "argument 'target' must be a differentiable operator");
   }
 
-  if(!Rf_isNull(index) && (!Rf_isNumeric(index) || XLENGTH(index) != 1))
+  cg_table_t *table = cg_graph_table(graph);
+
+  R_len_t n = XLENGTH(parms);
+
+  SEXP tangents = PROTECT(Rf_allocVector(VECSXP, table->size));
+
+  for(int i = 0; i < n; i++)
   {
-    Rf_errorcall(R_NilValue, "argument 'index' must be NULL or a numeric scalar");
+    SEXP node = VECTOR_ELT(parms, i);
+
+    if(!cg_is(node, "cg_node"))
+    {
+      Rf_errorcall(R_NilValue, "argument 'parms' must be a list of cg_node objects");
+    }
+
+    int id = cg_table_id(table, node);
+
+    if(cg_node_type(node) != CGPRM && cg_node_type(node) != CGIPT)
+    {
+      Rf_errorcall(R_NilValue, "node '%s' must be a parameter or input", cg_node_name_char(node));
+    }
+
+    SEXP direction = VECTOR_ELT(v, i);
+
+    if(!Rf_isNumeric(direction))
+    {
+      Rf_errorcall(R_NilValue, "argument 'v' must be a list of numeric vectors or arrays");
+    }
+
+    SET_VECTOR_ELT(tangents, id - 1, cg_graph_seed_tangent(node, direction));
   }
 
-  int k = 0;
+  cg_graph_propagate_tangents(table, plan, tangents, R_NilValue, R_NilValue);
+
+  int *states = (int*)R_alloc(table->size + 1, sizeof(int));
+
+  memset(states, 0, (table->size + 1) * sizeof(int));
+
+  cg_graph_prune(table, cg_plan_backward(plan), cg_plan_groups(plan), parms, states);
+
+  int *pruned = (int*)R_alloc(table->size + 1, sizeof(int));
+
+  memcpy(pruned, states, (table->size + 1) * sizeof(int));
+
+  cg_node_init_grad(plan_target, R_NilValue);
+
+  states[cg_node_id(plan_target)] = CGGWRITTEN;
 
-  SEXP *queue = cg_graph_dfs_from(graph, target, backward_filter, &k);
+  cg_graph_propagate_grads(table, plan, states);
 
-  cg_node_init_grad(target, index);
+  SEXP grads = PROTECT(Rf_allocVector(VECSXP, n));
 
-  for(int i = k - 2; i >= 0; i--)
+  for(int i = 0; i < n; i++)
   {
-    cg_node_zero_grad(queue[i]);
+    SEXP node = VECTOR_ELT(parms, i);
+
+    if(states[cg_node_id(node)] == CGGWRITTEN)
+    {
+      SET_VECTOR_ELT(grads, i, Rf_duplicate(cg_node_grad(node)));
+    }
+  }
+
+  SEXP sources = PROTECT(Rf_allocVector(VECSXP, table->size));
+
+  for(int id = 1; id <= table->size; id++)
+  {
+    cg_table_hessian(table, id, tangents, sources, states, LOGICAL(approx)[0]);
   }
 
-  for(int i = k - 1; i >= 0; i--)
+  for(int id = 1; id <= table->size; id++)
   {
-    if(cg_node_type(queue[i]) == CGDOP)
+    SEXP source = VECTOR_ELT(sources, id - 1);
+
+    if(!Rf_isNull(source))
     {
-      cg_node_backward(queue[i]);
+      CG_SET(cg_table_entry(table, id)->node, CG_GRAD_SYMBOL, source);
+
+      pruned[id] = CGGWRITTEN;
     }
   }
 
-  return R_NilValue;
+  cg_graph_propagate_grads(table, plan, pruned);
+
+  SEXP hvp = PROTECT(Rf_allocVector(VECSXP, n));
+
+  SEXP names = PROTECT(Rf_allocVector(STRSXP, n));
+
+  for(int i = 0; i < n; i++)
+  {
+    SEXP node = VECTOR_ELT(parms, i);
+
+    int id = cg_node_id(node);
+
+    if(pruned[id] == CGGWRITTEN)
+    {
+      SET_VECTOR_ELT(hvp, i, cg_node_grad(node));
+    }
+    else
+    {
+      cg_node_zero_grad(node);
+
+      SET_VECTOR_ELT(hvp, i, cg_node_grad(node));
+    }
+
+    SET_STRING_ELT(names, i, Rf_mkChar(cg_node_name_char(node)));
+
+    // Restore the gradient of the target with respect to the node
+    if(Rf_isNull(VECTOR_ELT(grads, i)))
+    {
+      CG_SET(node, CG_GRAD_SYMBOL, R_NilValue);
+
+      cg_node_zero_grad(node);
+    }
+    else
+    {
+      CG_SET(node, CG_GRAD_SYMBOL, VECTOR_ELT(grads, i));
+    }
+  }
+
+  Rf_setAttrib(hvp, R_NamesSymbol, names);
+
+  UNPROTECT(7);
+
+  return hvp;
 }
 
 SEXP cg_graph_print(SEXP graph)
@@ -303,18 +1111,44 @@ SEXP cg_graph_print(SEXP graph)
  * PUBLIC CONSTRUCTORS
  */
 
-SEXP cg_graph(SEXP eager)
+SEXP cg_graph(SEXP eager, SEXP fuse, SEXP threads)
 {
   if(!IS_SCALAR(eager, LGLSXP))
   {
     Rf_errorcall(R_NilValue, "argument 'eager' must be a logical scalar");
   }
 
+  if(!IS_SCALAR(fuse, LGLSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'fuse' must be a logical scalar");
+  }
+
+  if(!Rf_isNumeric(threads) || XLENGTH(threads) != 1 || Rf_asInteger(threads) < 1)
+  {
+    Rf_errorcall(R_NilValue, "argument 'threads' must be a positive numeric scalar");
+  }
+
   SEXP graph = PROTECT(cg_class("cg_graph"));
 
   CG_SET(graph, CG_EAGER_SYMBOL, eager);
 
-  CG_SET(graph, CG_NODES_SYMBOL, R_NilValue);
+  CG_SET(graph, CG_FUSE_SYMBOL, fuse);
+
+  CG_SET(graph, CG_THREADS_SYMBOL, Rf_ScalarInteger(Rf_asInteger(threads)));
+
+  CG_SET(graph, CG_PROFILE_SYMBOL, Rf_ScalarLogical(FALSE));
+
+  CG_SET(graph, CG_SIZE_SYMBOL, Rf_ScalarInteger(0));
+
+  CG_SET(graph, CG_STORAGE_SYMBOL, R_NilValue);
+
+  CG_SET(graph, CG_PLANS_SYMBOL, R_NilValue);
+
+  CG_SET(graph, CG_TABLE_SYMBOL, R_NilValue);
+
+  CG_SET(graph, CG_VERSION_SYMBOL, Rf_ScalarInteger(0));
+
+  cg_graph_bind_nodes(graph);
 
   cg_session_set_graph(graph);
 
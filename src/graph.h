@@ -23,24 +23,27 @@ limitations under the License.
 #include <Rinternals.h>
 
 #include "class.h"
+#include "table.h"
 #include "symbols.h"
 
 /*
  * INLINED GET/SET FUNCTIONS
  */
 
-inline SEXP cg_graph_nodes(SEXP graph)
+inline int cg_graph_size(SEXP graph)
 {
-    SEXP nodes = PROTECT(CG_GET(graph, CG_NODES_SYMBOL));
+    SEXP size = PROTECT(CG_GET(graph, CG_SIZE_SYMBOL));
 
-    if(TYPEOF(nodes) != VECSXP)
+    if(!IS_SCALAR(size, INTSXP))
     {
-        Rf_errorcall(R_NilValue, "graph does not have any nodes");
+        UNPROTECT(1);
+
+        return 0;
     }
 
     UNPROTECT(1);
 
-    return nodes;
+    return INTEGER(size)[0];
 }
 
 inline int cg_graph_eager(SEXP graph)
@@ -64,17 +67,97 @@ inline void cg_graph_set_eager(SEXP graph, const int eager)
     CG_SET(graph, CG_EAGER_SYMBOL, Rf_ScalarLogical(eager));
 }
 
+inline int cg_graph_fuse(SEXP graph)
+{
+    SEXP fuse = PROTECT(CG_GET(graph, CG_FUSE_SYMBOL));
+
+    if(!IS_SCALAR(fuse, LGLSXP))
+    {
+        UNPROTECT(1);
+
+        return 0;
+    }
+
+    UNPROTECT(1);
+
+    return INTEGER(fuse)[0];
+}
+
+inline int cg_graph_profiling(SEXP graph)
+{
+    SEXP profile = PROTECT(CG_GET(graph, CG_PROFILE_SYMBOL));
+
+    if(!IS_SCALAR(profile, LGLSXP))
+    {
+        UNPROTECT(1);
+
+        return 0;
+    }
+
+    UNPROTECT(1);
+
+    return INTEGER(profile)[0] == TRUE;
+}
+
+inline int cg_graph_threads(SEXP graph)
+{
+    SEXP threads = PROTECT(CG_GET(graph, CG_THREADS_SYMBOL));
+
+    if(!Rf_isNumeric(threads) || XLENGTH(threads) != 1)
+    {
+        UNPROTECT(1);
+
+        return 1;
+    }
+
+    int n = Rf_asInteger(threads);
+
+    UNPROTECT(1);
+
+    return (n > 1) ? n : 1;
+}
+
+inline int cg_graph_version(SEXP graph)
+{
+    SEXP version = PROTECT(CG_GET(graph, CG_VERSION_SYMBOL));
+
+    if(!IS_SCALAR(version, INTSXP))
+    {
+        UNPROTECT(1);
+
+        return 0;
+    }
+
+    UNPROTECT(1);
+
+    return INTEGER(version)[0];
+}
+
 /*
  * PUBLIC FUNCTIONS
  */
 
 SEXP cg_graph_get(SEXP graph, SEXP name);
 
+SEXP cg_graph_nodes(SEXP graph);
+
 void cg_graph_add_node(SEXP graph, SEXP node);
 
-SEXP cg_graph_forward(SEXP graph, SEXP target);
+void cg_graph_add_nodes(SEXP graph, SEXP nodes);
+
+cg_table_t* cg_graph_table(SEXP graph);
+
+SEXP cg_graph_plan(SEXP graph, SEXP target);
+
+SEXP cg_graph_forward(SEXP graph, SEXP target, SEXP free, SEXP checkpoints);
+
+SEXP cg_graph_backward(SEXP graph, SEXP target, SEXP index, SEXP wrt);
+
+SEXP cg_graph_jacobian(SEXP graph, SEXP target, SEXP wrt);
+
+SEXP cg_graph_jvp(SEXP graph, SEXP target, SEXP node, SEXP direction);
 
-SEXP cg_graph_backward(SEXP graph, SEXP target, SEXP index);
+SEXP cg_graph_hvp(SEXP graph, SEXP target, SEXP parms, SEXP v, SEXP approx);
 
 SEXP cg_graph_print(SEXP graph);
 
@@ -82,6 +165,6 @@ SEXP cg_graph_print(SEXP graph);
  * PUBLIC CONSTRUCTORS
  */
 
-SEXP cg_graph();
+SEXP cg_graph(SEXP eager, SEXP fuse, SEXP threads);
 
 #endif
@@ -20,10 +20,18 @@ limitations under the License.
 #include <Rinternals.h>
 #include <R_ext/Rdynload.h>
 
+#include "io.h"
 #include "node.h"
+#include "plan.h"
 #include "class.h"
 #include "graph.h"
+#include "shape.h"
+#include "trace.h"
+#include "feeder.h"
+#include "kernel.h"
 #include "vector.h"
+#include "rewrite.h"
+#include "profile.h"
 #include "session.h"
 #include "symbols.h"
 #include "function.h"
@@ -46,8 +54,10 @@ SEXP CG_DEF_SYMBOL      = NULL;
 SEXP CG_EPS_SYMBOL      = NULL;
 SEXP CG_ETA_SYMBOL      = NULL;
 SEXP CG_FUN_SYMBOL      = NULL;
+SEXP CG_FUSE_SYMBOL     = NULL;
 SEXP CG_GRAD_SYMBOL     = NULL;
 SEXP CG_NAME_SYMBOL     = NULL;
+SEXP CG_SIZE_SYMBOL     = NULL;
 SEXP CG_TYPE_SYMBOL     = NULL;
 SEXP CG_BETAS_SYMBOL    = NULL;
 SEXP CG_EAGER_SYMBOL    = NULL;
@@ -56,11 +66,30 @@ SEXP CG_GRADS_SYMBOL    = NULL;
 SEXP CG_GRAPH_SYMBOL    = NULL;
 SEXP CG_NODES_SYMBOL    = NULL;
 SEXP CG_PARMS_SYMBOL    = NULL;
+SEXP CG_PLANS_SYMBOL    = NULL;
+SEXP CG_SHAPE_SYMBOL    = NULL;
+SEXP CG_STATE_SYMBOL    = NULL;
+SEXP CG_TABLE_SYMBOL    = NULL;
 SEXP CG_VALUE_SYMBOL    = NULL;
+SEXP CG_BUFFER_SYMBOL   = NULL;
 SEXP CG_GAMMAS_SYMBOL   = NULL;
+SEXP CG_GROUPS_SYMBOL   = NULL;
 SEXP CG_INPUTS_SYMBOL   = NULL;
+SEXP CG_KERNEL_SYMBOL   = NULL;
+SEXP CG_TARGET_SYMBOL   = NULL;
 SEXP CG_BUFFER0_SYMBOL  = NULL;
 SEXP CG_BUFFER1_SYMBOL  = NULL;
+SEXP CG_FORWARD_SYMBOL  = NULL;
+SEXP CG_PROFILE_SYMBOL  = NULL;
+SEXP CG_STORAGE_SYMBOL  = NULL;
+SEXP CG_TANGENT_SYMBOL  = NULL;
+SEXP CG_THREADS_SYMBOL  = NULL;
+SEXP CG_VERSION_SYMBOL  = NULL;
+SEXP CG_BACKWARD_SYMBOL = NULL;
+SEXP CG_SEGMENTS_SYMBOL = NULL;
+SEXP CG_TANGENTS_SYMBOL = NULL;
+SEXP CG_FORWARD_LEVELS_SYMBOL  = NULL;
+SEXP CG_BACKWARD_LEVELS_SYMBOL = NULL;
 
 /*
  * LIBRARY INITIALIZATION
@@ -73,17 +102,39 @@ static const R_CallMethodDef CallEntries[] = {
   {"cg_input",                (DL_FUNC) &cg_input,                1},
   {"cg_operator",             (DL_FUNC) &cg_operator,             3},
   {"cg_node_print",           (DL_FUNC) &cg_node_print,           1},
+  {"cg_node_rename",          (DL_FUNC) &cg_node_rename,          2},
   // Graph
-  {"cg_graph",                (DL_FUNC) &cg_graph,                1},
+  {"cg_graph",                (DL_FUNC) &cg_graph,                3},
   {"cg_graph_get",            (DL_FUNC) &cg_graph_get,            2},
-  {"cg_graph_forward",        (DL_FUNC) &cg_graph_forward,        2},
-  {"cg_graph_backward",       (DL_FUNC) &cg_graph_backward,       3},
+  {"cg_graph_nodes",          (DL_FUNC) &cg_graph_nodes,          1},
+  {"cg_graph_plan",           (DL_FUNC) &cg_graph_plan,           2},
+  {"cg_graph_forward",        (DL_FUNC) &cg_graph_forward,        4},
+  {"cg_graph_backward",       (DL_FUNC) &cg_graph_backward,       4},
+  {"cg_graph_jacobian",       (DL_FUNC) &cg_graph_jacobian,       3},
+  {"cg_graph_jvp",            (DL_FUNC) &cg_graph_jvp,            4},
+  {"cg_graph_hvp",            (DL_FUNC) &cg_graph_hvp,            5},
   {"cg_graph_print",          (DL_FUNC) &cg_graph_print,          1},
+  {"cg_graph_profile",        (DL_FUNC) &cg_graph_profile,        2},
+  {"cg_graph_optimize",       (DL_FUNC) &cg_graph_optimize,       2},
+  {"cg_graph_infer_shapes",   (DL_FUNC) &cg_graph_infer_shapes,   1},
+  {"cg_graph_save",           (DL_FUNC) &cg_graph_save,           2},
+  {"cg_graph_load",           (DL_FUNC) &cg_graph_load,           1},
+  // Plan
+  {"cg_plan_print",           (DL_FUNC) &cg_plan_print,           1},
   // Session
   {"cg_session_graph",        (DL_FUNC) &cg_session_graph,        0},
   {"cg_session_set_graph",    (DL_FUNC) &cg_session_set_graph,    1},
+  // Trace
+  {"cg_trace_start",          (DL_FUNC) &cg_trace_start,          1},
+  {"cg_trace_stop",           (DL_FUNC) &cg_trace_stop,           0},
+  // Feeder
+  {"cg_feeder",               (DL_FUNC) &cg_feeder,               6},
+  {"cg_feeder_binary",        (DL_FUNC) &cg_feeder_binary,        7},
+  {"cg_feeder_csv",           (DL_FUNC) &cg_feeder_csv,           7},
+  {"cg_feeder_next",          (DL_FUNC) &cg_feeder_next,          1},
+  {"cg_feeder_close",         (DL_FUNC) &cg_feeder_close,         1},
   // Function
-  {"cg_function",             (DL_FUNC) &cg_function,             2},
+  {"cg_function",             (DL_FUNC) &cg_function,             4},
   {"cg_function_print",       (DL_FUNC) &cg_function_print,       1},
   // Optimizer
   {"cg_optim_gd",             (DL_FUNC) &cg_optim_gd,             2},
@@ -115,24 +166,55 @@ void R_init_cgraph(DllInfo *dll)
   R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
   R_useDynamicSymbols(dll, FALSE);
 
+  // Register kernels
+  cg_kernel_init();
+
+  // Register the class of memory-mapped parameter values
+  cg_io_init(dll);
+
+  // Expose the kernel registry to other packages
+  R_RegisterCCallable("cgraph", "cg_kernel_register", (DL_FUNC) &cg_kernel_register);
+
   // Install symbols
   CG_ID_SYMBOL        = Rf_install("id");
   CG_DEF_SYMBOL       = Rf_install("def");
   CG_EPS_SYMBOL       = Rf_install("eps");
   CG_ETA_SYMBOL       = Rf_install("eta");
   CG_FUN_SYMBOL       = Rf_install("fun");
+  CG_FUSE_SYMBOL      = Rf_install("fuse");
   CG_GRAD_SYMBOL      = Rf_install("grad");
   CG_NAME_SYMBOL      = Rf_install("name");
+  CG_SIZE_SYMBOL      = Rf_install("size");
   CG_TYPE_SYMBOL      = Rf_install("type");
   CG_BETAS_SYMBOL     = Rf_install("betas");
   CG_EAGER_SYMBOL     = Rf_install("eager");
   CG_GAMMA_SYMBOL     = Rf_install("gamma");
   CG_GRADS_SYMBOL     = Rf_install("grads");
+  CG_GRAPH_SYMBOL     = Rf_install("graph");
   CG_NODES_SYMBOL     = Rf_install("nodes");
   CG_PARMS_SYMBOL     = Rf_install("parms");
+  CG_PLANS_SYMBOL     = Rf_install("plans");
+  CG_SHAPE_SYMBOL     = Rf_install("shape");
+  CG_STATE_SYMBOL     = Rf_install("state");
+  CG_TABLE_SYMBOL     = Rf_install("table");
   CG_VALUE_SYMBOL     = Rf_install("value");
+  CG_BUFFER_SYMBOL    = Rf_install("buffer");
   CG_GAMMAS_SYMBOL    = Rf_install("gammas");
+  CG_GROUPS_SYMBOL    = Rf_install("groups");
   CG_INPUTS_SYMBOL    = Rf_install("inputs");
+  CG_KERNEL_SYMBOL    = Rf_install("kernel");
+  CG_TARGET_SYMBOL    = Rf_install("target");
   CG_BUFFER0_SYMBOL   = Rf_install("buffer0");
   CG_BUFFER1_SYMBOL   = Rf_install("buffer1");
+  CG_FORWARD_SYMBOL   = Rf_install("forward");
+  CG_PROFILE_SYMBOL   = Rf_install("profile");
+  CG_STORAGE_SYMBOL   = Rf_install("storage");
+  CG_TANGENT_SYMBOL   = Rf_install("tangent");
+  CG_THREADS_SYMBOL   = Rf_install("threads");
+  CG_VERSION_SYMBOL   = Rf_install("version");
+  CG_BACKWARD_SYMBOL  = Rf_install("backward");
+  CG_SEGMENTS_SYMBOL  = Rf_install("segments");
+  CG_TANGENTS_SYMBOL  = Rf_install("tangents");
+  CG_FORWARD_LEVELS_SYMBOL  = Rf_install("forward_levels");
+  CG_BACKWARD_LEVELS_SYMBOL = Rf_install("backward_levels");
 }
@@ -20,10 +20,200 @@ limitations under the License.
 #include <Rinternals.h>
 
 #include "node.h"
+#include "plan.h"
 #include "class.h"
 #include "graph.h"
+#include "table.h"
 #include "internal.h"
 
+/*
+ * PRIVATE STRUCTURES
+ */
+
+/*
+ * A step evaluates the native kernel of an operator in the cone of the
+ * perturbed node on a replica of the graph. The inputs of the step refer to
+ * the position of the input in the cone (or -1 if the input lies outside the
+ * cone and -2 if the input is the perturbed node).
+ */
+typedef struct
+{
+  cg_kernel_eval_t eval;
+  cg_kernel_data_t data;
+  int inputs[CG_KERNEL_MAX_INPUTS];
+} approx_step_t;
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+// Note: the operators in the forward order (including the members of fusion
+// groups) are evaluated one by one, so that the values of all operators are
+// materialized
+static void approx_forward(const cg_table_t *table, SEXP plan)
+{
+  SEXP groups = PROTECT(cg_plan_groups(plan));
+
+  SEXP forward = PROTECT(cg_plan_forward(plan));
+
+  int *order = INTEGER(forward);
+
+  R_len_t k = XLENGTH(forward);
+
+  for(int i = 0; i < k; i++)
+  {
+    int m, *members = cg_plan_members(groups, &order[i], &m);
+
+    for(int j = 0; j < m; j++)
+    {
+      cg_table_forward(table, members[j]);
+    }
+  }
+
+  UNPROTECT(2);
+}
+
+// Note: the cone of a node consists of the operators in the forward order
+// that directly or indirectly consume the node (in topological order)
+static int* approx_cone(const cg_table_t *table, SEXP plan, const int id, int *n)
+{
+  SEXP groups = PROTECT(cg_plan_groups(plan));
+
+  SEXP forward = PROTECT(cg_plan_forward(plan));
+
+  int *reach = (int*)R_alloc(table->size + 1, sizeof(int));
+
+  memset(reach, 0, (table->size + 1) * sizeof(int));
+
+  reach[id] = 1;
+
+  int *cone = (int*)R_alloc(table->size, sizeof(int)), l = 0;
+
+  int *order = INTEGER(forward);
+
+  R_len_t k = XLENGTH(forward);
+
+  for(int i = 0; i < k; i++)
+  {
+    int m, *members = cg_plan_members(groups, &order[i], &m);
+
+    for(int j = 0; j < m; j++)
+    {
+      const cg_table_entry_t *entry = cg_table_entry(table, members[j]);
+
+      int *inputs = cg_table_inputs(table, entry);
+
+      for(int q = 0; q < entry->n && !reach[members[j]]; q++)
+      {
+        reach[members[j]] = reach[inputs[q]];
+      }
+
+      if(reach[members[j]] && members[j] != id)
+      {
+        cone[l++] = members[j];
+      }
+    }
+  }
+
+  *n = l;
+
+  UNPROTECT(2);
+
+  return cone;
+}
+
+// Note: the cone can only be evaluated on replicas if the kernels of all
+// operators in the cone can process the values of their inputs
+static approx_step_t* approx_steps(const cg_table_t *table, const int *cone, const int l, const int id)
+{
+  int *position = (int*)R_alloc(table->size + 1, sizeof(int));
+
+  for(int i = 0; i <= table->size; i++)
+  {
+    position[i] = -1;
+  }
+
+  position[id] = -2;
+
+  approx_step_t *steps = (approx_step_t*)R_alloc(l, sizeof(approx_step_t));
+
+  for(int s = 0; s < l; s++)
+  {
+    const cg_table_entry_t *entry = cg_table_entry(table, cone[s]);
+
+    cg_node_call_t call;
+
+    if(!cg_table_call(table, entry, &call))
+    {
+      return NULL;
+    }
+
+    const cg_kernel_t *kernel = call.kernel;
+
+    if(!kernel->check(call.args, kernel->n) || kernel->length(call.args, kernel->n) != XLENGTH(cg_node_value(entry->node)))
+    {
+      return NULL;
+    }
+
+    cg_kernel_data_init(&steps[s].data, call.args, kernel->n);
+
+    steps[s].data.out_len = kernel->length(call.args, kernel->n);
+
+    steps[s].eval = kernel->forward;
+
+    for(int j = 0; j < kernel->n; j++)
+    {
+      steps[s].inputs[j] = position[call.ids[j]];
+    }
+
+    position[cone[s]] = s;
+  }
+
+  return steps;
+}
+
+static void approx_replica(const approx_step_t *steps, const int l, double **values, double *x,
+                           const double *target, const int k, const double eps, double *pg,
+                           const int from, const int n, const int stride)
+{
+  for(int i = from; i < n; i += stride)
+  {
+    double x0 = x[i], t[2];
+
+    for(int d = 0; d < 2; d++)
+    {
+      x[i] = (d == 0) ? x0 + eps : x0 - eps;
+
+      for(int s = 0; s < l; s++)
+      {
+        cg_kernel_data_t data = steps[s].data;
+
+        for(int j = 0; j < data.n; j++)
+        {
+          if(steps[s].inputs[j] == -2)
+          {
+            data.x[j] = x;
+          }
+          else if(steps[s].inputs[j] >= 0)
+          {
+            data.x[j] = values[steps[s].inputs[j]];
+          }
+        }
+
+        data.out = values[s];
+
+        steps[s].eval(&data);
+      }
+
+      t[d] = target[k - 1];
+    }
+
+    x[i] = x0;
+
+    pg[i] = (t[0] - t[1]) / (2 * eps);
+  }
+}
+
 /*
  * PUBLIC FUNCTIONS
  */
@@ -223,34 +413,99 @@ SEXP approx_gradient(SEXP graph, SEXP target, SEXP node, SEXP index, SEXP epsilo
 
   double eps = Rf_asReal(epsilon);
 
-  for(int i = 0; i < n; i++)
+  SEXP plan = PROTECT(cg_graph_plan(graph, target));
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  approx_forward(table, plan);
+
+  // Only the operators in the cone of the node are affected by perturbing
+  // the node, the other values are evaluated once
+  int l, id = cg_table_id(table, node), target_id = cg_table_id(table, target);
+
+  int *cone = approx_cone(table, plan, id, &l), target_position = -1;
+
+  for(int s = 0; s < l; s++)
   {
-    pn[i] += eps;
+    if(cone[s] == target_id)
+    {
+      target_position = s;
+    }
+  }
+
+  int threads = cg_graph_threads(graph);
+
+  approx_step_t *steps = (threads > 1 && target_position >= 0) ? approx_steps(table, cone, l, id) : NULL;
+
+  if(target_id != id && target_position < 0)
+  {
+    memset(pg, 0, n * sizeof(double));
+  }
+  else if(steps != NULL)
+  {
+    // Note: each replica holds its own copy of the node and of the values of
+    // the operators in the cone. The perturbations are distributed over the
+    // replicas in a round-robin fashion.
+    int r = (threads < n) ? threads : n;
+
+    double **replicas = (double**)R_alloc((size_t)r * l, sizeof(double*));
+
+    double **x = (double**)R_alloc(r, sizeof(double*));
 
-    cg_graph_forward(graph, target);
+    for(int q = 0; q < r; q++)
+    {
+      x[q] = (double*)R_alloc(n, sizeof(double));
 
-    REPROTECT(target_value = cg_node_value(target), target_index);
+      memcpy(x[q], pn, n * sizeof(double));
 
-    double t1 = REAL(target_value)[k - 1];
+      for(int s = 0; s < l; s++)
+      {
+        replicas[q * l + s] = (double*)R_alloc(steps[s].data.out_len, sizeof(double));
+      }
+    }
 
-    pn[i] -= 2 * eps;
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(r) schedule(static, 1)
+#endif
+    for(int q = 0; q < r; q++)
+    {
+      approx_replica(steps, l, &replicas[q * l], x[q], replicas[q * l + target_position],
+                     k, eps, pg, q, n, r);
+    }
+  }
+  else
+  {
+    for(int i = 0; i < n; i++)
+    {
+      double x0 = pn[i], t[2];
+
+      for(int d = 0; d < 2; d++)
+      {
+        pn[i] = (d == 0) ? x0 + eps : x0 - eps;
 
-    cg_graph_forward(graph, target);
+        for(int s = 0; s < l; s++)
+        {
+          cg_table_forward(table, cone[s]);
+        }
 
-    REPROTECT(target_value = cg_node_value(target), target_index);
+        REPROTECT(target_value = cg_node_value(target), target_index);
 
-    double t2 = REAL(target_value)[k - 1];
+        t[d] = REAL(target_value)[k - 1];
+      }
 
-    pg[i] = (t1 - t2) / (2 * eps);
+      pn[i] = x0;
 
-    pn[i] += eps;
+      pg[i] = (t[0] - t[1]) / (2 * eps);
+    }
   }
 
+  SEXP free = PROTECT(Rf_mkString("none"));
+
   SHALLOW_DUPLICATE_ATTRIB(grad, node_value);
 
-  cg_graph_forward(graph, target);
+  cg_graph_forward(graph, target, free, R_NilValue);
 
-  UNPROTECT(3);
+  UNPROTECT(5);
 
   return grad;
 }
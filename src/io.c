@@ -0,0 +1,870 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Rdynload.h>
+#include <R_ext/Altrep.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "io.h"
+#include "node.h"
+#include "class.h"
+#include "graph.h"
+#include "table.h"
+#include "function.h"
+
+/*
+ * ENUMERATIONS
+ */
+
+typedef enum {
+    CGFNONE   = 0, /* No function */
+    CGFNAME   = 1, /* Function of the package identified by name */
+    CGFSERIAL = 2  /* Serialized function */
+} cg_io_function_t;
+
+typedef enum {
+    CGVNONE   = 0, /* No value */
+    CGVBUFFER = 1, /* Raw double buffer in the data section */
+    CGVSERIAL = 2  /* Serialized value */
+} cg_io_value_t;
+
+/*
+ * IO STRUCTURES
+ */
+
+typedef struct
+{
+  char magic[8];                          /* File signature */
+  uint32_t order;                         /* Byte order mark */
+  uint32_t version;                       /* Version of the format */
+  int32_t eager;                          /* Eager evaluation of the graph */
+  int32_t fuse;                           /* Fusion of the graph */
+  int32_t threads;                        /* Number of threads of the graph */
+  int32_t size;                           /* Number of nodes */
+  int64_t table;                          /* Size of the node table */
+  int64_t data;                           /* Offset of the data section */
+  int64_t length;                         /* Size of the data section */
+  char padding[8];                        /* Padding to 64 bytes */
+} cg_io_header_t;
+
+typedef struct
+{
+  char *data;                             /* Contents of the buffer */
+  size_t size;                            /* Size of the contents */
+  size_t capacity;                        /* Capacity of the buffer */
+} cg_io_buffer_t;
+
+typedef struct
+{
+  const char *data;                       /* Contents of the node table */
+  size_t size;                            /* Size of the node table */
+  size_t pos;                             /* Read position */
+  const char *file;                       /* Name of the file */
+} cg_io_reader_t;
+
+typedef struct
+{
+  void *addr;                             /* Address of the mapping */
+  size_t size;                            /* Size of the mapping */
+} cg_io_mapping_t;
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+static const char cg_io_magic[8] = "CGRAPH\0";
+
+static const uint32_t cg_io_order = 0x01020304;
+
+static R_altrep_class_t cg_io_real_class;
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static int64_t cg_io_align(const int64_t offset)
+{
+  return (offset + CG_IO_ALIGN - 1) / CG_IO_ALIGN * CG_IO_ALIGN;
+}
+
+static void cg_io_write(cg_io_buffer_t *buffer, const void *x, const size_t n)
+{
+  if(buffer->size + n > buffer->capacity)
+  {
+    size_t capacity = (buffer->capacity > 0) ? 2 * buffer->capacity : 1024;
+
+    while(buffer->size + n > capacity)
+    {
+      capacity *= 2;
+    }
+
+    char *grown = R_alloc(capacity, sizeof(char));
+
+    if(buffer->size > 0)
+    {
+      memcpy(grown, buffer->data, buffer->size);
+    }
+
+    buffer->data = grown;
+
+    buffer->capacity = capacity;
+  }
+
+  memcpy(buffer->data + buffer->size, x, n);
+
+  buffer->size += n;
+}
+
+static void cg_io_write_int(cg_io_buffer_t *buffer, const int32_t x)
+{
+  cg_io_write(buffer, &x, sizeof(int32_t));
+}
+
+static void cg_io_write_long(cg_io_buffer_t *buffer, const int64_t x)
+{
+  cg_io_write(buffer, &x, sizeof(int64_t));
+}
+
+// Note: a NULL string is stored as length -1
+static void cg_io_write_string(cg_io_buffer_t *buffer, SEXP x)
+{
+  if(x == R_NilValue || x == R_NaString)
+  {
+    cg_io_write_int(buffer, -1);
+  }
+  else
+  {
+    const char *s = Rf_translateCharUTF8(x);
+
+    int32_t n = (int32_t)strlen(s);
+
+    cg_io_write_int(buffer, n);
+
+    cg_io_write(buffer, s, n);
+  }
+}
+
+static void cg_io_write_raw(cg_io_buffer_t *buffer, SEXP x)
+{
+  PROTECT(x);
+
+  cg_io_write_long(buffer, XLENGTH(x));
+
+  cg_io_write(buffer, RAW(x), XLENGTH(x));
+
+  UNPROTECT(1);
+}
+
+static void cg_io_read(cg_io_reader_t *reader, void *x, const size_t n)
+{
+  if(reader->pos + n > reader->size)
+  {
+    Rf_errorcall(R_NilValue, "file '%s' is corrupted", reader->file);
+  }
+
+  memcpy(x, reader->data + reader->pos, n);
+
+  reader->pos += n;
+}
+
+static int32_t cg_io_read_int(cg_io_reader_t *reader)
+{
+  int32_t x;
+
+  cg_io_read(reader, &x, sizeof(int32_t));
+
+  return x;
+}
+
+static int64_t cg_io_read_long(cg_io_reader_t *reader)
+{
+  int64_t x;
+
+  cg_io_read(reader, &x, sizeof(int64_t));
+
+  return x;
+}
+
+static SEXP cg_io_read_string(cg_io_reader_t *reader)
+{
+  int32_t n = cg_io_read_int(reader);
+
+  if(n < 0)
+  {
+    return R_NilValue;
+  }
+
+  if(reader->pos + n > reader->size)
+  {
+    Rf_errorcall(R_NilValue, "file '%s' is corrupted", reader->file);
+  }
+
+  SEXP x = Rf_mkCharLenCE(reader->data + reader->pos, n, CE_UTF8);
+
+  reader->pos += n;
+
+  return x;
+}
+
+static SEXP cg_io_read_raw(cg_io_reader_t *reader)
+{
+  int64_t n = cg_io_read_long(reader);
+
+  if(n < 0 || reader->pos + n > reader->size)
+  {
+    Rf_errorcall(R_NilValue, "file '%s' is corrupted", reader->file);
+  }
+
+  SEXP x = Rf_allocVector(RAWSXP, n);
+
+  cg_io_read(reader, RAW(x), n);
+
+  return x;
+}
+
+static SEXP cg_io_serialize(SEXP x)
+{
+  SEXP call = PROTECT(Rf_lang3(Rf_install("serialize"), x, R_NilValue));
+
+  SEXP raw = PROTECT(Rf_eval(call, R_BaseEnv));
+
+  UNPROTECT(2);
+
+  return raw;
+}
+
+static SEXP cg_io_unserialize(SEXP raw)
+{
+  PROTECT(raw);
+
+  SEXP call = PROTECT(Rf_lang2(Rf_install("unserialize"), raw));
+
+  SEXP x = PROTECT(Rf_eval(call, R_BaseEnv));
+
+  UNPROTECT(3);
+
+  return x;
+}
+
+// Note: only double vectors and arrays without attributes other than their
+// dimensions are stored as raw buffers
+static int cg_io_is_buffer(SEXP value)
+{
+  if(TYPEOF(value) != REALSXP)
+  {
+    return 0;
+  }
+
+  for(SEXP attrib = ATTRIB(value); attrib != R_NilValue; attrib = CDR(attrib))
+  {
+    if(TAG(attrib) != R_DimSymbol)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void cg_io_mapping_finalize(SEXP ptr)
+{
+  cg_io_mapping_t *mapping = (cg_io_mapping_t*)R_ExternalPtrAddr(ptr);
+
+  if(mapping != NULL)
+  {
+#ifndef _WIN32
+    munmap(mapping->addr, mapping->size);
+#endif
+
+    Free(mapping);
+
+    R_ClearExternalPtr(ptr);
+  }
+}
+
+// Note: the state of a mapped vector holds the offset of its buffer in the
+// file and its length (both stored as doubles to support long vectors)
+static R_xlen_t cg_io_real_length(SEXP x)
+{
+  return (R_xlen_t)REAL(R_altrep_data2(x))[1];
+}
+
+static void* cg_io_real_dataptr(SEXP x, Rboolean writeable)
+{
+  cg_io_mapping_t *mapping = (cg_io_mapping_t*)R_ExternalPtrAddr(R_altrep_data1(x));
+
+  if(mapping == NULL)
+  {
+    Rf_errorcall(R_NilValue, "cannot access a released mapping");
+  }
+
+  return (char*)mapping->addr + (size_t)REAL(R_altrep_data2(x))[0];
+}
+
+static const void* cg_io_real_dataptr_or_null(SEXP x)
+{
+  return cg_io_real_dataptr(x, FALSE);
+}
+
+static SEXP cg_io_buffer_value(SEXP mapping, const char *data, const int64_t offset, const R_xlen_t length)
+{
+#ifndef _WIN32
+  if(length > 0)
+  {
+    SEXP state = PROTECT(Rf_allocVector(REALSXP, 2));
+
+    REAL(state)[0] = (double)offset;
+    REAL(state)[1] = (double)length;
+
+    SEXP value = R_new_altrep(cg_io_real_class, mapping, state);
+
+    UNPROTECT(1);
+
+    return value;
+  }
+#endif
+
+  SEXP value = Rf_allocVector(REALSXP, length);
+
+  if(length > 0)
+  {
+    memcpy(REAL(value), data + offset, length * sizeof(double));
+  }
+
+  return value;
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void cg_io_init(DllInfo *dll)
+{
+  cg_io_real_class = R_make_altreal_class("cg_mapped_real", "cgraph", dll);
+
+  R_set_altrep_Length_method(cg_io_real_class, cg_io_real_length);
+
+  R_set_altvec_Dataptr_method(cg_io_real_class, cg_io_real_dataptr);
+
+  R_set_altvec_Dataptr_or_null_method(cg_io_real_class, cg_io_real_dataptr_or_null);
+}
+
+SEXP cg_graph_save(SEXP graph, SEXP file)
+{
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  if(!IS_SCALAR(file, STRSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'file' must be a character scalar");
+  }
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  int n = table->size;
+
+  cg_io_buffer_t records = {NULL, 0, 0};
+
+  SEXP blocks = PROTECT(Rf_allocVector(VECSXP, n));
+
+  int index;
+
+  SEXP functions = R_NilValue;
+
+  PROTECT_WITH_INDEX(functions, &index);
+
+  int64_t length = 0;
+
+  for(int id = 1; id <= n; id++)
+  {
+    SEXP node = cg_table_entry(table, id)->node;
+
+    cg_node_type_t type = cg_node_type(node);
+
+    cg_io_write_int(&records, type);
+
+    SEXP name = PROTECT(cg_node_name(node));
+
+    cg_io_write_string(&records, Rf_isNull(name) ? R_NilValue : STRING_ELT(name, 0));
+
+    if(type == CGDOP || type == CGNOP)
+    {
+      SEXP function = PROTECT(cg_node_function(node));
+
+      if(Rf_isNull(functions))
+      {
+        REPROTECT(functions = cg_function_builtins(), index);
+      }
+
+      SEXP function_name = cg_function_builtin_name(functions, function);
+
+      if(!Rf_isNull(function_name))
+      {
+        cg_io_write_int(&records, CGFNAME);
+
+        cg_io_write_string(&records, function_name);
+      }
+      else
+      {
+        cg_io_write_int(&records, CGFSERIAL);
+
+        cg_io_write_raw(&records, cg_io_serialize(function));
+      }
+
+      SEXP inputs = PROTECT(cg_node_inputs(node));
+
+      SEXP input_tags = PROTECT(Rf_getAttrib(inputs, R_NamesSymbol));
+
+      R_len_t m = XLENGTH(inputs);
+
+      cg_io_write_int(&records, m);
+
+      for(int i = 0; i < m; i++)
+      {
+        cg_io_write_int(&records, cg_node_id(VECTOR_ELT(inputs, i)));
+
+        cg_io_write_string(&records, Rf_isNull(input_tags) ? R_NilValue : STRING_ELT(input_tags, i));
+      }
+
+      UNPROTECT(3);
+    }
+    else
+    {
+      cg_io_write_int(&records, CGFNONE);
+
+      cg_io_write_int(&records, 0);
+    }
+
+    // Only the values of constants and parameters are stored, the values of
+    // inputs and operators are evaluated at run-time
+    SEXP value = PROTECT(cg_node_value(node));
+
+    if((type != CGCST && type != CGPRM) || Rf_isNull(value))
+    {
+      cg_io_write_int(&records, CGVNONE);
+    }
+    else if(cg_io_is_buffer(value))
+    {
+      cg_io_write_int(&records, CGVBUFFER);
+
+      SEXP dim = Rf_getAttrib(value, R_DimSymbol);
+
+      if(Rf_isNull(dim))
+      {
+        cg_io_write_int(&records, -1);
+      }
+      else
+      {
+        cg_io_write_int(&records, XLENGTH(dim));
+
+        for(int i = 0; i < XLENGTH(dim); i++)
+        {
+          cg_io_write_int(&records, INTEGER(dim)[i]);
+        }
+      }
+
+      cg_io_write_long(&records, length);
+
+      cg_io_write_long(&records, XLENGTH(value));
+
+      SET_VECTOR_ELT(blocks, id - 1, value);
+
+      length += cg_io_align(XLENGTH(value) * sizeof(double));
+    }
+    else
+    {
+      cg_io_write_int(&records, CGVSERIAL);
+
+      cg_io_write_raw(&records, cg_io_serialize(value));
+    }
+
+    UNPROTECT(2);
+  }
+
+  cg_io_header_t header;
+
+  memset(&header, 0, sizeof(cg_io_header_t));
+
+  memcpy(header.magic, cg_io_magic, sizeof(header.magic));
+
+  header.order = cg_io_order;
+  header.version = CG_IO_VERSION;
+  header.eager = cg_graph_eager(graph);
+  header.fuse = cg_graph_fuse(graph);
+  header.threads = cg_graph_threads(graph);
+  header.size = n;
+  header.table = records.size;
+  header.data = cg_io_align(sizeof(cg_io_header_t) + records.size);
+  header.length = length;
+
+  const char *path = R_ExpandFileName(CHAR(STRING_ELT(file, 0)));
+
+  // Note: the graph is written to a temporary file that replaces the file
+  // once it is complete. The file may be mapped by the values of a loaded
+  // graph (which are possibly written to the file), so it must not be
+  // truncated while it is mapped.
+  char *temp = R_alloc(strlen(path) + 5, sizeof(char));
+
+  sprintf(temp, "%s.tmp", path);
+
+  FILE *f = fopen(temp, "wb");
+
+  if(f == NULL)
+  {
+    Rf_errorcall(R_NilValue, "cannot open file '%s'", path);
+  }
+
+  static const char zero[CG_IO_ALIGN] = {0};
+
+  int ok = fwrite(&header, sizeof(cg_io_header_t), 1, f) == 1 &&
+    (records.size == 0 || fwrite(records.data, records.size, 1, f) == 1);
+
+  int64_t pos = sizeof(cg_io_header_t) + records.size;
+
+  ok = ok && fwrite(zero, 1, header.data - pos, f) == (size_t)(header.data - pos);
+
+  for(int i = 0; i < n && ok; i++)
+  {
+    SEXP block = VECTOR_ELT(blocks, i);
+
+    if(Rf_isNull(block) || XLENGTH(block) == 0)
+    {
+      continue;
+    }
+
+    size_t size = XLENGTH(block) * sizeof(double);
+
+    size_t padding = cg_io_align(size) - size;
+
+    ok = fwrite(REAL(block), size, 1, f) == 1 &&
+      (padding == 0 || fwrite(zero, padding, 1, f) == 1);
+  }
+
+  if(fclose(f) != 0 || !ok)
+  {
+    remove(temp);
+
+    Rf_errorcall(R_NilValue, "cannot write to file '%s'", path);
+  }
+
+#ifdef _WIN32
+  remove(path);
+#endif
+
+  if(rename(temp, path) != 0)
+  {
+    remove(temp);
+
+    Rf_errorcall(R_NilValue, "cannot write to file '%s'", path);
+  }
+
+  UNPROTECT(2);
+
+  return R_NilValue;
+}
+
+SEXP cg_graph_load(SEXP file)
+{
+  if(!IS_SCALAR(file, STRSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'file' must be a character scalar");
+  }
+
+  const char *path = R_ExpandFileName(CHAR(STRING_ELT(file, 0)));
+
+  FILE *f = fopen(path, "rb");
+
+  if(f == NULL)
+  {
+    Rf_errorcall(R_NilValue, "cannot open file '%s'", path);
+  }
+
+  cg_io_header_t header;
+
+  if(fread(&header, sizeof(cg_io_header_t), 1, f) != 1 ||
+     memcmp(header.magic, cg_io_magic, sizeof(header.magic)) != 0)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "file '%s' is not a cgraph file", path);
+  }
+
+  if(header.order != cg_io_order)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "file '%s' was saved on a platform with a different byte order", path);
+  }
+
+  if(header.version > CG_IO_VERSION)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "file '%s' was saved by a newer version of cgraph", path);
+  }
+
+  if(header.size < 0 || header.table < 0 || header.length < 0 ||
+     header.table > INT64_MAX - (int64_t)sizeof(cg_io_header_t) ||
+     header.data < (int64_t)sizeof(cg_io_header_t) + header.table ||
+     header.data > INT64_MAX - header.length)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+  }
+
+  // Note: the data section must lie within the file, otherwise accessing the
+  // mapping past the end of the file raises SIGBUS
+  struct stat st;
+
+  if(fstat(fileno(f), &st) != 0 || header.data + header.length > (int64_t)st.st_size)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "file '%s' is truncated or corrupted", path);
+  }
+
+  char *records = R_alloc(header.table + 1, sizeof(char));
+
+  if(header.table > 0 && fread(records, header.table, 1, f) != 1)
+  {
+    fclose(f);
+
+    Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+  }
+
+  // Note: the data section is memory-mapped so that the buffers are only
+  // read once they are accessed. Platforms without mmap read the data
+  // section at once.
+  SEXP mapping = PROTECT(R_MakeExternalPtr(NULL, R_NilValue, R_NilValue));
+
+  R_RegisterCFinalizerEx(mapping, cg_io_mapping_finalize, TRUE);
+
+  char *data = NULL;
+
+  if(header.length > 0)
+  {
+#ifndef _WIN32
+    size_t size = header.data + header.length;
+
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+
+    if(addr == MAP_FAILED)
+    {
+      fclose(f);
+
+      Rf_errorcall(R_NilValue, "cannot map file '%s'", path);
+    }
+
+    cg_io_mapping_t *m = Calloc(1, cg_io_mapping_t);
+
+    m->addr = addr;
+    m->size = size;
+
+    R_SetExternalPtrAddr(mapping, m);
+
+    data = (char*)addr;
+#else
+    data = R_alloc(header.data + header.length, sizeof(char));
+
+    if(fseek(f, header.data, SEEK_SET) != 0 ||
+       fread(data + header.data, header.length, 1, f) != 1)
+    {
+      fclose(f);
+
+      Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+    }
+#endif
+  }
+
+  fclose(f);
+
+  cg_io_reader_t reader = {records, header.table, 0, path};
+
+  SEXP graph = PROTECT(cg_graph(Rf_ScalarLogical(header.eager), Rf_ScalarLogical(header.fuse),
+                                Rf_ScalarInteger(header.threads)));
+
+  int n = header.size;
+
+  SEXP nodes = PROTECT(Rf_allocVector(VECSXP, n));
+
+  SEXP ns = PROTECT(cg_function_namespace());
+
+  for(int id = 1; id <= n; id++)
+  {
+    int32_t type = cg_io_read_int(&reader);
+
+    if(type < CGCST || type > CGNOP)
+    {
+      Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+    }
+
+    SEXP node = PROTECT(cg_class("cg_node"));
+
+    SET_VECTOR_ELT(nodes, id - 1, node);
+
+    SEXP name = cg_io_read_string(&reader);
+
+    CG_SET(node, CG_NAME_SYMBOL, Rf_isNull(name) ? R_NilValue : Rf_ScalarString(name));
+
+    CG_SET(node, CG_GRAD_SYMBOL, R_NilValue);
+
+    CG_SET(node, CG_VALUE_SYMBOL, R_NilValue);
+
+    CG_SET(node, CG_TYPE_SYMBOL, Rf_ScalarInteger(type));
+
+    CG_SET(node, CG_ID_SYMBOL, R_NilValue);
+
+    int32_t kind = cg_io_read_int(&reader);
+
+    if(kind == CGFNAME)
+    {
+      SEXP function_name = cg_io_read_string(&reader);
+
+      if(Rf_isNull(function_name))
+      {
+        Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+      }
+
+      SEXP function = Rf_eval(Rf_installChar(function_name), ns);
+
+      if(!cg_is(function, "cg_function"))
+      {
+        Rf_errorcall(R_NilValue, "cannot find function '%s'", CHAR(function_name));
+      }
+
+      CG_SET(node, CG_FUN_SYMBOL, function);
+    }
+    else if(kind == CGFSERIAL)
+    {
+      CG_SET(node, CG_FUN_SYMBOL, cg_io_unserialize(cg_io_read_raw(&reader)));
+    }
+    else if(kind != CGFNONE)
+    {
+      Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+    }
+
+    int32_t m = cg_io_read_int(&reader);
+
+    if(m < 0 || (m > 0 && kind == CGFNONE))
+    {
+      Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+    }
+
+    if(kind != CGFNONE)
+    {
+      SEXP inputs = PROTECT(Rf_allocVector(VECSXP, m));
+
+      SEXP input_tags = PROTECT(Rf_allocVector(STRSXP, m));
+
+      int tagged = 0;
+
+      for(int i = 0; i < m; i++)
+      {
+        int32_t input_id = cg_io_read_int(&reader);
+
+        if(input_id < 1 || input_id >= id)
+        {
+          Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+        }
+
+        SET_VECTOR_ELT(inputs, i, VECTOR_ELT(nodes, input_id - 1));
+
+        SEXP input_tag = cg_io_read_string(&reader);
+
+        SET_STRING_ELT(input_tags, i, Rf_isNull(input_tag) ? R_BlankString : input_tag);
+
+        tagged = tagged || !Rf_isNull(input_tag);
+      }
+
+      if(tagged)
+      {
+        Rf_setAttrib(inputs, R_NamesSymbol, input_tags);
+      }
+
+      CG_SET(node, CG_INPUTS_SYMBOL, inputs);
+
+      UNPROTECT(2);
+    }
+
+    kind = cg_io_read_int(&reader);
+
+    if(kind == CGVBUFFER)
+    {
+      int32_t k = cg_io_read_int(&reader);
+
+      SEXP dim = R_NilValue;
+
+      if(k >= 0)
+      {
+        dim = PROTECT(Rf_allocVector(INTSXP, k));
+
+        for(int i = 0; i < k; i++)
+        {
+          INTEGER(dim)[i] = cg_io_read_int(&reader);
+        }
+      }
+
+      int64_t offset = cg_io_read_long(&reader), length = cg_io_read_long(&reader);
+
+      if(offset < 0 || length < 0 || offset > header.length ||
+         length > (header.length - offset) / (int64_t)sizeof(double))
+      {
+        Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+      }
+
+      SEXP value = PROTECT(cg_io_buffer_value(mapping, data, header.data + offset, length));
+
+      if(k >= 0)
+      {
+        Rf_setAttrib(value, R_DimSymbol, dim);
+      }
+
+      CG_SET(node, CG_VALUE_SYMBOL, value);
+
+      UNPROTECT(k >= 0 ? 2 : 1);
+    }
+    else if(kind == CGVSERIAL)
+    {
+      CG_SET(node, CG_VALUE_SYMBOL, cg_io_unserialize(cg_io_read_raw(&reader)));
+    }
+    else if(kind != CGVNONE)
+    {
+      Rf_errorcall(R_NilValue, "file '%s' is corrupted", path);
+    }
+
+    UNPROTECT(1);
+  }
+
+  cg_graph_add_nodes(graph, nodes);
+
+  UNPROTECT(4);
+
+  return graph;
+}
@@ -0,0 +1,62 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef IO_H
+#define IO_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Rdynload.h>
+
+/*
+ * A graph is saved to a versioned binary file that consists of a header, a
+ * node table, and a data section. The node table stores the type, name,
+ * function identifier, inputs (and the names of the inputs), and value of
+ * each node in the order in which the nodes were added to the graph.
+ * Functions provided by the package are identified by their name, other
+ * functions and values that cannot be stored as raw double buffers are
+ * stored by R's serialization format. The values of parameters and
+ * constants that are double vectors or arrays are stored as raw buffers in
+ * the data section, each aligned to 64 bytes.
+ *
+ * The data section is memory-mapped when the graph is loaded. The values of
+ * the parameters refer to the mapped buffers directly (via an ALTREP class)
+ * so that the buffers are only read from disk once they are accessed. The
+ * mapping is private, changes to the values are never written to the file.
+ */
+
+/*
+ * MACROS
+ */
+
+#define CG_IO_VERSION 1
+
+#define CG_IO_ALIGN 64
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void cg_io_init(DllInfo *dll);
+
+SEXP cg_graph_save(SEXP graph, SEXP file);
+
+SEXP cg_graph_load(SEXP file);
+
+#endif
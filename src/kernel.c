@@ -0,0 +1,1080 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+#define USE_FC_LEN_T
+
+#include <R.h>
+#include <Rmath.h>
+#include <Rinternals.h>
+#include <R_ext/BLAS.h>
+
+#include "kernel.h"
+
+#ifndef FCONE
+#define FCONE
+#endif
+
+/*
+ * REGISTRY
+ */
+
+#define CG_KERNEL_REGISTRY_SIZE 128
+
+static int cg_kernel_registry_size = 0;
+
+static const cg_kernel_t *cg_kernel_registry[CG_KERNEL_REGISTRY_SIZE];
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static inline double cg_sigmoid(const double x)
+{
+  const double min = DBL_EPSILON, max = 1 - DBL_EPSILON;
+
+  double y = 1 / (1 + exp(-x));
+
+  y = (y < min) ? min : y;
+
+  y = (y > max) ? max : y;
+
+  return y;
+}
+
+static int cg_check_unary(SEXP *args, const int n)
+{
+  return TYPEOF(args[0]) == REALSXP && !OBJECT(args[0]);
+}
+
+static R_xlen_t cg_length_unary(SEXP *args, const int n)
+{
+  return XLENGTH(args[0]);
+}
+
+static SEXP cg_alloc_unary(SEXP *args, const int n)
+{
+  SEXP out = PROTECT(Rf_allocVector(REALSXP, cg_length_unary(args, n)));
+
+  SHALLOW_DUPLICATE_ATTRIB(out, args[0]);
+
+  UNPROTECT(1);
+
+  return out;
+}
+
+static int cg_reuse_unary(SEXP *args, const int n, SEXP value)
+{
+  return R_compute_identical(ATTRIB(value), ATTRIB(args[0]), 16);
+}
+
+// Note: only the cases in which the attributes of the result can be
+// determined unambiguously are processed. All other cases (including those
+// which cause R to emit a warning or error) are left to the R definition.
+static int cg_check_binary(SEXP *args, const int n)
+{
+  SEXP x = args[0], y = args[1];
+
+  if(TYPEOF(x) != REALSXP || TYPEOF(y) != REALSXP)
+  {
+    return 0;
+  }
+
+  if(OBJECT(x) || OBJECT(y))
+  {
+    return 0;
+  }
+
+  R_xlen_t nx = XLENGTH(x), ny = XLENGTH(y);
+
+  if(nx == 0 || ny == 0)
+  {
+    return 0;
+  }
+
+  if((nx > ny ? nx % ny : ny % nx) != 0)
+  {
+    return 0;
+  }
+
+  SEXP x_attrib = ATTRIB(x), y_attrib = ATTRIB(y);
+
+  if(x_attrib != R_NilValue && y_attrib != R_NilValue)
+  {
+    return nx == ny && R_compute_identical(x_attrib, y_attrib, 16);
+  }
+
+  if(x_attrib != R_NilValue)
+  {
+    return nx >= ny;
+  }
+
+  if(y_attrib != R_NilValue)
+  {
+    return ny >= nx;
+  }
+
+  return 1;
+}
+
+static R_xlen_t cg_length_binary(SEXP *args, const int n)
+{
+  R_xlen_t nx = XLENGTH(args[0]), ny = XLENGTH(args[1]);
+
+  return (nx > ny) ? nx : ny;
+}
+
+static SEXP cg_alloc_binary(SEXP *args, const int n)
+{
+  SEXP x = args[0], y = args[1];
+
+  R_xlen_t nx = XLENGTH(x), ny = XLENGTH(y);
+
+  R_xlen_t m = cg_length_binary(args, n);
+
+  SEXP out = PROTECT(Rf_allocVector(REALSXP, m));
+
+  if(ATTRIB(x) != R_NilValue && nx == m)
+  {
+    SHALLOW_DUPLICATE_ATTRIB(out, x);
+  }
+  else if(ATTRIB(y) != R_NilValue && ny == m)
+  {
+    SHALLOW_DUPLICATE_ATTRIB(out, y);
+  }
+
+  UNPROTECT(1);
+
+  return out;
+}
+
+static int cg_reuse_binary(SEXP *args, const int n, SEXP value)
+{
+  SEXP x = args[0], y = args[1];
+
+  R_xlen_t m = cg_length_binary(args, n);
+
+  SEXP attrib = R_NilValue;
+
+  if(ATTRIB(x) != R_NilValue && XLENGTH(x) == m)
+  {
+    attrib = ATTRIB(x);
+  }
+  else if(ATTRIB(y) != R_NilValue && XLENGTH(y) == m)
+  {
+    attrib = ATTRIB(y);
+  }
+
+  return R_compute_identical(ATTRIB(value), attrib, 16);
+}
+
+static int cg_check_sum(SEXP *args, const int n)
+{
+  return TYPEOF(args[0]) == REALSXP && !OBJECT(args[0]);
+}
+
+static R_xlen_t cg_length_sum(SEXP *args, const int n)
+{
+  return 1;
+}
+
+static SEXP cg_alloc_sum(SEXP *args, const int n)
+{
+  return Rf_allocVector(REALSXP, 1);
+}
+
+static int cg_reuse_sum(SEXP *args, const int n, SEXP value)
+{
+  return ATTRIB(value) == R_NilValue;
+}
+
+static int cg_check_matmul(SEXP *args, const int n)
+{
+  SEXP x = args[0], y = args[1];
+
+  if(TYPEOF(x) != REALSXP || TYPEOF(y) != REALSXP)
+  {
+    return 0;
+  }
+
+  if(OBJECT(x) || OBJECT(y))
+  {
+    return 0;
+  }
+
+  if(!Rf_isMatrix(x) || !Rf_isMatrix(y))
+  {
+    return 0;
+  }
+
+  if(!Rf_isNull(Rf_getAttrib(x, R_DimNamesSymbol)) ||
+     !Rf_isNull(Rf_getAttrib(y, R_DimNamesSymbol)))
+  {
+    return 0;
+  }
+
+  int x_nrow = Rf_nrows(x), x_ncol = Rf_ncols(x);
+  int y_nrow = Rf_nrows(y), y_ncol = Rf_ncols(y);
+
+  if(x_nrow == 0 || x_ncol == 0 || y_ncol == 0)
+  {
+    return 0;
+  }
+
+  return x_ncol == y_nrow;
+}
+
+static R_xlen_t cg_length_matmul(SEXP *args, const int n)
+{
+  return (R_xlen_t)Rf_nrows(args[0]) * Rf_ncols(args[1]);
+}
+
+static SEXP cg_alloc_matmul(SEXP *args, const int n)
+{
+  return Rf_allocMatrix(REALSXP, Rf_nrows(args[0]), Rf_ncols(args[1]));
+}
+
+static int cg_reuse_matmul(SEXP *args, const int n, SEXP value)
+{
+  SEXP attrib = ATTRIB(value);
+
+  if(TAG(attrib) != R_DimSymbol || CDR(attrib) != R_NilValue)
+  {
+    return 0;
+  }
+
+  SEXP dim = CAR(attrib);
+
+  if(TYPEOF(dim) != INTSXP || XLENGTH(dim) != 2)
+  {
+    return 0;
+  }
+
+  return INTEGER(dim)[0] == Rf_nrows(args[0]) && INTEGER(dim)[1] == Rf_ncols(args[1]);
+}
+
+// Note: the bias is added by c(z), which drops the dimensions of the bias but
+// not its names. Only biases whose length divides the length of the matrix
+// product are processed.
+static int cg_check_bias(SEXP z, const R_xlen_t m)
+{
+  if(TYPEOF(z) != REALSXP || OBJECT(z))
+  {
+    return 0;
+  }
+
+  if(!Rf_isNull(Rf_getAttrib(z, R_NamesSymbol)))
+  {
+    return 0;
+  }
+
+  R_xlen_t n = XLENGTH(z);
+
+  return n > 0 && n <= m && m % n == 0;
+}
+
+static int cg_check_linear1(SEXP *args, const int n)
+{
+  return cg_check_matmul(args, 2) && cg_check_bias(args[2], cg_length_matmul(args, 2));
+}
+
+static int cg_check_linear2(SEXP *args, const int n)
+{
+  if(!cg_check_matmul(args, 2) || !cg_check_matmul(args + 2, 2))
+  {
+    return 0;
+  }
+
+  if(Rf_nrows(args[0]) != Rf_nrows(args[2]) || Rf_ncols(args[1]) != Rf_ncols(args[3]))
+  {
+    return 0;
+  }
+
+  return n < 5 || cg_check_bias(args[4], cg_length_matmul(args, 2));
+}
+
+/*
+ * KERNEL DEFINITIONS
+ */
+
+#define CG_SCALAR(NAME, FX)                                                   \
+static double cg_##NAME##_f(const double x, const double y)                   \
+{                                                                             \
+  return (FX);                                                                \
+}
+
+#define CG_SCALAR_GRAD(NAME, SUFFIX, DX)                                      \
+static double cg_##NAME##_d##SUFFIX(const double x, const double y,           \
+                                    const double value, const double grad)    \
+{                                                                             \
+  return (DX);                                                                \
+}
+
+#define CG_SCALAR_HESSIAN(NAME, SUFFIX, HX)                                   \
+static double cg_##NAME##_h##SUFFIX(const double x, const double y,           \
+                                    const double value, const double grad,    \
+                                    const double tx, const double ty,         \
+                                    const double tv)                          \
+{                                                                             \
+  return (HX);                                                                \
+}
+
+#define CG_UNARY_FORWARD(NAME, NAFLAG)                                        \
+static void cg_##NAME##_forward(cg_kernel_data_t *data)                       \
+{                                                                             \
+  const double *px = data->x[0];                                              \
+                                                                              \
+  double *po = data->out;                                                     \
+                                                                              \
+  R_xlen_t n = data->out_len;                                                 \
+                                                                              \
+  for(R_xlen_t i = 0; i < n; i++)                                             \
+  {                                                                           \
+    po[i] = cg_##NAME##_f(px[i], 0);                                          \
+                                                                              \
+    if(NAFLAG && ISNAN(po[i]) && !ISNAN(px[i]))                               \
+    {                                                                         \
+      data->naflag = 1;                                                       \
+    }                                                                         \
+  }                                                                           \
+}
+
+#define CG_UNARY_GRAD(NAME)                                                   \
+static void cg_##NAME##_grad(cg_kernel_data_t *data)                          \
+{                                                                             \
+  const double *px = data->x[0];                                              \
+  const double *pv = data->value;                                             \
+                                                                              \
+  R_xlen_t n = data->out_len;                                                 \
+                                                                              \
+  for(int b = 0; b < data->batch; b++)                                        \
+  {                                                                           \
+    const double *pg = data->grad + b * n;                                    \
+                                                                              \
+    double *po = data->out + b * n;                                           \
+                                                                              \
+    if(data->accumulate)                                                      \
+    {                                                                         \
+      for(R_xlen_t i = 0; i < n; i++)                                         \
+      {                                                                       \
+        po[i] += cg_##NAME##_dx(px[i], 0, pv[i], pg[i]);                      \
+      }                                                                       \
+    }                                                                         \
+    else                                                                      \
+    {                                                                         \
+      for(R_xlen_t i = 0; i < n; i++)                                         \
+      {                                                                       \
+        po[i] = cg_##NAME##_dx(px[i], 0, pv[i], pg[i]);                       \
+      }                                                                       \
+    }                                                                         \
+  }                                                                           \
+}
+
+#define CG_UNARY_TANGENT(NAME)                                                \
+static void cg_##NAME##_tangent(cg_kernel_data_t *data)                       \
+{                                                                             \
+  const double *px = data->x[0];                                              \
+  const double *pv = data->value;                                             \
+  const double *pt = data->tangent;                                           \
+                                                                              \
+  double *po = data->out;                                                     \
+                                                                              \
+  R_xlen_t n = data->out_len;                                                 \
+                                                                              \
+  for(R_xlen_t i = 0; i < n; i++)                                             \
+  {                                                                           \
+    double d = cg_##NAME##_dx(px[i], 0, pv[i], pt[i]);                        \
+                                                                              \
+    po[i] = data->accumulate ? po[i] + d : d;                                 \
+  }                                                                           \
+}
+
+#define CG_UNARY_HESSIAN(NAME)                                                \
+static void cg_##NAME##_hessian(cg_kernel_data_t *data)                       \
+{                                                                             \
+  const double *px = data->x[0];                                              \
+  const double *pv = data->value;                                             \
+  const double *pg = data->grad;                                              \
+  const double *pt = data->tx[0];                                             \
+  const double *ptv = data->tvalue;                                           \
+                                                                              \
+  double *po = data->out;                                                     \
+                                                                              \
+  R_xlen_t n = data->out_len;                                                 \
+                                                                              \
+  for(R_xlen_t i = 0; i < n; i++)                                             \
+  {                                                                           \
+    po[i] += cg_##NAME##_hx(px[i], 0, pv[i], pg[i], pt[i], 0, ptv[i]);        \
+  }                                                                           \
+}
+
+#define CG_UNARY_KERNEL(NAME, FX, DX, HX, NAFLAG)                             \
+CG_SCALAR(NAME, FX)                                                           \
+CG_SCALAR_GRAD(NAME, x, DX)                                                   \
+CG_SCALAR_HESSIAN(NAME, x, HX)                                                \
+CG_UNARY_FORWARD(NAME, NAFLAG)                                                \
+CG_UNARY_GRAD(NAME)                                                           \
+CG_UNARY_TANGENT(NAME)                                                        \
+CG_UNARY_HESSIAN(NAME)                                                        \
+static const cg_kernel_elementwise_t cg_##NAME##_elementwise = {              \
+  cg_##NAME##_f, {cg_##NAME##_dx, NULL}, NAFLAG                               \
+};                                                                            \
+static const cg_kernel_t cg_##NAME##_kernel = {                               \
+  #NAME, 1, cg_check_unary, cg_alloc_unary, cg_length_unary,                  \
+  cg_##NAME##_forward, {cg_##NAME##_grad}, &cg_##NAME##_elementwise,          \
+  {cg_##NAME##_tangent}, {cg_##NAME##_hessian}, cg_reuse_unary, NULL          \
+};
+
+#define CG_BINARY_FORWARD(NAME)                                               \
+static void cg_##NAME##_forward(cg_kernel_data_t *data)                       \
+{                                                                             \
+  const double *px = data->x[0], *py = data->x[1];                            \
+                                                                              \
+  R_xlen_t nx = data->len[0], ny = data->len[1];                              \
+                                                                              \
+  double *po = data->out;                                                     \
+                                                                              \
+  R_xlen_t n = data->out_len;                                                 \
+                                                                              \
+  for(R_xlen_t i = 0, ix = 0, iy = 0; i < n; i++)                             \
+  {                                                                           \
+    po[i] = cg_##NAME##_f(px[ix], py[iy]);                                    \
+                                                                              \
+    if(++ix == nx) ix = 0;                                                    \
+    if(++iy == ny) iy = 0;                                                    \
+  }                                                                           \
+}
+
+// Note: the gradient with respect to a recycled input is summed over the
+// positions at which the input is recycled (similarly as function bsum).
+#define CG_BINARY_GRAD(NAME, SUFFIX, INDEX)                                   \
+static void cg_##NAME##_grad_##SUFFIX(cg_kernel_data_t *data)                 \
+{                                                                             \
+  const double *px = data->x[0], *py = data->x[1];                            \
+  const double *pv = data->value;                                             \
+                                                                              \
+  R_xlen_t nx = data->len[0], ny = data->len[1];                              \
+                                                                              \
+  R_xlen_t m = data->out_len, n = (nx > ny) ? nx : ny;                        \
+                                                                              \
+  for(int b = 0; b < data->batch; b++)                                        \
+  {                                                                           \
+    const double *pg = data->grad + b * n;                                    \
+                                                                              \
+    double *po = data->out + b * m;                                           \
+                                                                              \
+    if(m != n && !data->accumulate)                                           \
+    {                                                                         \
+      memset(po, 0, m * sizeof(double));                                      \
+    }                                                                         \
+                                                                              \
+    for(R_xlen_t i = 0, ix = 0, iy = 0; i < n; i++)                           \
+    {                                                                         \
+      double d = cg_##NAME##_d##SUFFIX(px[ix], py[iy], pv[i], pg[i]);         \
+                                                                              \
+      if(m == n)                                                              \
+      {                                                                       \
+        po[i] = data->accumulate ? po[i] + d : d;                             \
+      }                                                                       \
+      else                                                                    \
+      {                                                                       \
+        po[INDEX] += d;                                                       \
+      }                                                                       \
+                                                                              \
+      if(++ix == nx) ix = 0;                                                  \
+      if(++iy == ny) iy = 0;                                                  \
+    }                                                                         \
+  }                                                                           \
+}
+
+// Note: the tangent of a recycled input is recycled in the same way as the
+// input itself
+#define CG_BINARY_TANGENT(NAME, SUFFIX, INDEX)                                \
+static void cg_##NAME##_tangent_##SUFFIX(cg_kernel_data_t *data)              \
+{                                                                             \
+  const double *px = data->x[0], *py = data->x[1];                            \
+  const double *pv = data->value;                                             \
+  const double *pt = data->tangent;                                           \
+                                                                              \
+  R_xlen_t nx = data->len[0], ny = data->len[1];                              \
+                                                                              \
+  double *po = data->out;                                                     \
+                                                                              \
+  R_xlen_t n = data->out_len;                                                 \
+                                                                              \
+  for(R_xlen_t i = 0, ix = 0, iy = 0; i < n; i++)                             \
+  {                                                                           \
+    double d = cg_##NAME##_d##SUFFIX(px[ix], py[iy], pv[i], pt[INDEX]);       \
+                                                                              \
+    po[i] = data->accumulate ? po[i] + d : d;                                 \
+                                                                              \
+    if(++ix == nx) ix = 0;                                                    \
+    if(++iy == ny) iy = 0;                                                    \
+  }                                                                           \
+}
+
+// Note: the second-order term of a recycled input is summed over the
+// positions at which the input is recycled
+#define CG_BINARY_HESSIAN(NAME, SUFFIX, INDEX)                                \
+static void cg_##NAME##_hessian_##SUFFIX(cg_kernel_data_t *data)              \
+{                                                                             \
+  const double *px = data->x[0], *py = data->x[1];                            \
+  const double *ptx = data->tx[0], *pty = data->tx[1];                        \
+  const double *pv = data->value;                                             \
+  const double *pg = data->grad;                                              \
+  const double *ptv = data->tvalue;                                           \
+                                                                              \
+  R_xlen_t nx = data->len[0], ny = data->len[1];                              \
+                                                                              \
+  R_xlen_t n = (nx > ny) ? nx : ny;                                           \
+                                                                              \
+  double *po = data->out;                                                     \
+                                                                              \
+  for(R_xlen_t i = 0, ix = 0, iy = 0; i < n; i++)                             \
+  {                                                                           \
+    po[INDEX] += cg_##NAME##_h##SUFFIX(px[ix], py[iy], pv[i], pg[i],          \
+                                       ptx[ix], pty[iy], ptv[i]);             \
+                                                                              \
+    if(++ix == nx) ix = 0;                                                    \
+    if(++iy == ny) iy = 0;                                                    \
+  }                                                                           \
+}
+
+#define CG_BINARY_KERNEL(NAME, FX, DX, DY, HX, HY)                            \
+CG_SCALAR(NAME, FX)                                                           \
+CG_SCALAR_GRAD(NAME, x, DX)                                                   \
+CG_SCALAR_GRAD(NAME, y, DY)                                                   \
+CG_SCALAR_HESSIAN(NAME, x, HX)                                                \
+CG_SCALAR_HESSIAN(NAME, y, HY)                                                \
+CG_BINARY_FORWARD(NAME)                                                       \
+CG_BINARY_GRAD(NAME, x, ix)                                                   \
+CG_BINARY_GRAD(NAME, y, iy)                                                   \
+CG_BINARY_TANGENT(NAME, x, ix)                                                \
+CG_BINARY_TANGENT(NAME, y, iy)                                                \
+CG_BINARY_HESSIAN(NAME, x, ix)                                                \
+CG_BINARY_HESSIAN(NAME, y, iy)                                                \
+static const cg_kernel_elementwise_t cg_##NAME##_elementwise = {              \
+  cg_##NAME##_f, {cg_##NAME##_dx, cg_##NAME##_dy}, 0                          \
+};                                                                            \
+static const cg_kernel_t cg_##NAME##_kernel = {                               \
+  #NAME, 2, cg_check_binary, cg_alloc_binary, cg_length_binary,               \
+  cg_##NAME##_forward, {cg_##NAME##_grad_x, cg_##NAME##_grad_y},              \
+  &cg_##NAME##_elementwise, {cg_##NAME##_tangent_x, cg_##NAME##_tangent_y},   \
+  {cg_##NAME##_hessian_x, cg_##NAME##_hessian_y}, cg_reuse_binary, NULL       \
+};
+
+CG_UNARY_KERNEL(pos, x, grad,
+                0, 0)
+CG_UNARY_KERNEL(neg, -x, -grad,
+                0, 0)
+CG_UNARY_KERNEL(square, x * x, 2 * grad * x,
+                2 * grad * tx, 0)
+CG_UNARY_KERNEL(sqrt, sqrt(x), grad * 1 / (2 * value),
+                -grad * tv / (2 * value * value), 1)
+CG_UNARY_KERNEL(exp, exp(x), grad * value,
+                grad * tv, 1)
+CG_UNARY_KERNEL(ln, log(x), grad / x,
+                -grad * tx / (x * x), 1)
+CG_UNARY_KERNEL(log2, log2(x), grad / (x * M_LN2),
+                -grad * tx / (x * x * M_LN2), 1)
+CG_UNARY_KERNEL(log10, log10(x), grad / (x * M_LN10),
+                -grad * tx / (x * x * M_LN10), 1)
+CG_UNARY_KERNEL(abs, fabs(x), grad * (x / value),
+                grad * (tx * value - x * tv) / (value * value), 0)
+CG_UNARY_KERNEL(sin, sin(x), grad * cos(x),
+                -grad * sin(x) * tx, 1)
+CG_UNARY_KERNEL(cos, cos(x), -grad * sin(x),
+                -grad * cos(x) * tx, 1)
+CG_UNARY_KERNEL(tan, tan(x), grad / (cos(x) * cos(x)),
+                2 * grad * tan(x) * tx / (cos(x) * cos(x)), 1)
+CG_UNARY_KERNEL(sinh, sinh(x), grad * cosh(x),
+                grad * sinh(x) * tx, 1)
+CG_UNARY_KERNEL(cosh, cosh(x), grad * sinh(x),
+                grad * cosh(x) * tx, 1)
+CG_UNARY_KERNEL(tanh, tanh(x), grad * (1 - value * value),
+                -2 * grad * value * tv, 1)
+CG_UNARY_KERNEL(asin, asin(x), grad / sqrt(1 - x * x),
+                grad * x * tx / ((1 - x * x) * sqrt(1 - x * x)), 1)
+CG_UNARY_KERNEL(acos, acos(x), -grad / sqrt(1 - x * x),
+                -grad * x * tx / ((1 - x * x) * sqrt(1 - x * x)), 1)
+CG_UNARY_KERNEL(atan, atan(x), grad / (x * x + 1),
+                -2 * grad * x * tx / ((x * x + 1) * (x * x + 1)), 1)
+CG_UNARY_KERNEL(asinh, asinh(x), grad / sqrt(x * x + 1),
+                -grad * x * tx / ((x * x + 1) * sqrt(x * x + 1)), 1)
+CG_UNARY_KERNEL(acosh, acosh(x), grad / sqrt(x * x - 1),
+                -grad * x * tx / ((x * x - 1) * sqrt(x * x - 1)), 1)
+CG_UNARY_KERNEL(atanh, atanh(x), grad / (1 - x * x),
+                2 * grad * x * tx / ((1 - x * x) * (1 - x * x)), 1)
+CG_UNARY_KERNEL(sigmoid, cg_sigmoid(x), grad * value * (1 - value),
+                grad * (1 - 2 * value) * tv, 0)
+
+CG_BINARY_KERNEL(add, x + y, grad, grad,
+                 0,
+                 0)
+CG_BINARY_KERNEL(sub, x - y, grad, -grad,
+                 0,
+                 0)
+CG_BINARY_KERNEL(mul, x * y, grad * y, grad * x,
+                 grad * ty,
+                 grad * tx)
+CG_BINARY_KERNEL(div, x / y, grad / y, -grad * x / (y * y),
+                 -grad * ty / (y * y),
+                 -grad * (tx - 2 * x * ty / y) / (y * y))
+CG_BINARY_KERNEL(pow, R_pow(x, y), grad * y * R_pow(x, y - 1), grad * value * log(x),
+                 grad * ((y - 1) * y * R_pow(x, y - 2) * tx + (ty != 0 ? ty * R_pow(x, y - 1) * (1 + y * log(x)) : 0)),
+                 grad * (tv * log(x) + value * tx / x))
+
+static void cg_sum_forward(cg_kernel_data_t *data)
+{
+  const double *px = data->x[0];
+
+  R_xlen_t n = data->len[0];
+
+  long double sum = 0;
+
+  for(R_xlen_t i = 0; i < n; i++)
+  {
+    sum += px[i];
+  }
+
+  data->out[0] = (double)sum;
+}
+
+static void cg_sum_grad(cg_kernel_data_t *data)
+{
+  R_xlen_t n = data->out_len;
+
+  for(int b = 0; b < data->batch; b++)
+  {
+    const double grad = data->grad[b];
+
+    double *po = data->out + b * n;
+
+    for(R_xlen_t i = 0; i < n; i++)
+    {
+      po[i] = data->accumulate ? po[i] + grad : grad;
+    }
+  }
+}
+
+static void cg_sum_tangent(cg_kernel_data_t *data)
+{
+  const double *pt = data->tangent;
+
+  R_xlen_t n = data->len[0];
+
+  long double sum = 0;
+
+  for(R_xlen_t i = 0; i < n; i++)
+  {
+    sum += pt[i];
+  }
+
+  data->out[0] = data->accumulate ? data->out[0] + (double)sum : (double)sum;
+}
+
+// Note: the gradient of sum does not depend on the values of its input, so
+// the kernel has no second-order function
+static const cg_kernel_t cg_sum_kernel = {
+  "sum", 1, cg_check_sum, cg_alloc_sum, cg_length_sum,
+  cg_sum_forward, {cg_sum_grad}, NULL, {cg_sum_tangent}, {NULL}, cg_reuse_sum, NULL
+};
+
+// Note: the matrix products of the matmul and linear kernels are evaluated
+// by the functions below, which multiply input i by input i + 1
+static inline void cg_gemm_grad_x(cg_kernel_data_t *data, const int i)
+{
+  const double one = 1, beta = data->accumulate;
+
+  int m = data->nrow[i], k = data->ncol[i], n = data->ncol[i + 1];
+
+  for(int b = 0; b < data->batch; b++)
+  {
+    F77_CALL(dgemm)("N", "T", &m, &k, &n, &one, data->grad + (R_xlen_t)b * m * n, &m,
+                    data->x[i + 1], &k, &beta, data->out + (R_xlen_t)b * m * k, &m FCONE FCONE);
+  }
+}
+
+// Note: the blocks of the gradient are stored side by side, so the gradients
+// with respect to y are computed for all blocks by a single matrix product
+static inline void cg_gemm_grad_y(cg_kernel_data_t *data, const int i)
+{
+  const double one = 1, beta = data->accumulate;
+
+  int m = data->nrow[i], k = data->ncol[i], n = data->ncol[i + 1] * data->batch;
+
+  F77_CALL(dgemm)("T", "N", &k, &n, &m, &one, data->x[i], &m,
+                  data->grad, &m, &beta, data->out, &k FCONE FCONE);
+}
+
+static inline void cg_gemm_tangent_x(cg_kernel_data_t *data, const int i)
+{
+  const double one = 1, beta = data->accumulate;
+
+  int m = data->nrow[i], k = data->ncol[i], n = data->ncol[i + 1];
+
+  F77_CALL(dgemm)("N", "N", &m, &n, &k, &one, data->tangent, &m,
+                  data->x[i + 1], &k, &beta, data->out, &m FCONE FCONE);
+}
+
+static inline void cg_gemm_tangent_y(cg_kernel_data_t *data, const int i)
+{
+  const double one = 1, beta = data->accumulate;
+
+  int m = data->nrow[i], k = data->ncol[i], n = data->ncol[i + 1];
+
+  F77_CALL(dgemm)("N", "N", &m, &n, &k, &one, data->x[i], &m,
+                  data->tangent, &k, &beta, data->out, &m FCONE FCONE);
+}
+
+static inline void cg_gemm_hessian_x(cg_kernel_data_t *data, const int i)
+{
+  const double one = 1;
+
+  int m = data->nrow[i], k = data->ncol[i], n = data->ncol[i + 1];
+
+  F77_CALL(dgemm)("N", "T", &m, &k, &n, &one, data->grad, &m,
+                  data->tx[i + 1], &k, &one, data->out, &m FCONE FCONE);
+}
+
+static inline void cg_gemm_hessian_y(cg_kernel_data_t *data, const int i)
+{
+  const double one = 1;
+
+  int m = data->nrow[i], k = data->ncol[i], n = data->ncol[i + 1];
+
+  F77_CALL(dgemm)("T", "N", &k, &n, &m, &one, data->tx[i], &m,
+                  data->grad, &m, &one, data->out, &k FCONE FCONE);
+}
+
+static void cg_matmul_forward(cg_kernel_data_t *data)
+{
+  const double one = 1, zero = 0;
+
+  int m = data->nrow[0], k = data->ncol[0], n = data->ncol[1];
+
+  F77_CALL(dgemm)("N", "N", &m, &n, &k, &one, data->x[0], &m,
+                  data->x[1], &k, &zero, data->out, &m FCONE FCONE);
+}
+
+static void cg_matmul_grad_x(cg_kernel_data_t *data)
+{
+  cg_gemm_grad_x(data, 0);
+}
+
+static void cg_matmul_grad_y(cg_kernel_data_t *data)
+{
+  cg_gemm_grad_y(data, 0);
+}
+
+static void cg_matmul_tangent_x(cg_kernel_data_t *data)
+{
+  cg_gemm_tangent_x(data, 0);
+}
+
+static void cg_matmul_tangent_y(cg_kernel_data_t *data)
+{
+  cg_gemm_tangent_y(data, 0);
+}
+
+static void cg_matmul_hessian_x(cg_kernel_data_t *data)
+{
+  cg_gemm_hessian_x(data, 0);
+}
+
+static void cg_matmul_hessian_y(cg_kernel_data_t *data)
+{
+  cg_gemm_hessian_y(data, 0);
+}
+
+static const cg_kernel_t cg_matmul_kernel = {
+  "matmul", 2, cg_check_matmul, cg_alloc_matmul, cg_length_matmul,
+  cg_matmul_forward, {cg_matmul_grad_x, cg_matmul_grad_y}, NULL,
+  {cg_matmul_tangent_x, cg_matmul_tangent_y},
+  {cg_matmul_hessian_x, cg_matmul_hessian_y}, cg_reuse_matmul, NULL
+};
+
+// Note: the value is initialized by the (recycled) bias, to which the matrix
+// products are added. The bias is always the last input.
+static void cg_linear_forward(cg_kernel_data_t *data)
+{
+  const double one = 1;
+
+  const int z = data->n - 1;
+
+  const double *pz = data->x[z];
+
+  double *po = data->out;
+
+  R_xlen_t nz = data->len[z], l = data->out_len;
+
+  for(R_xlen_t i = 0, iz = 0; i < l; i++)
+  {
+    po[i] = pz[iz];
+
+    if(++iz == nz) iz = 0;
+  }
+
+  for(int i = 0; i < z; i += 2)
+  {
+    int m = data->nrow[i], k = data->ncol[i], n = data->ncol[i + 1];
+
+    F77_CALL(dgemm)("N", "N", &m, &n, &k, &one, data->x[i], &m,
+                    data->x[i + 1], &k, &one, po, &m FCONE FCONE);
+  }
+}
+
+// Note: without a bias, the value is initialized by the first matrix product
+static void cg_linear_forward_nobias(cg_kernel_data_t *data)
+{
+  const double one = 1, zero = 0;
+
+  for(int i = 0; i < data->n; i += 2)
+  {
+    int m = data->nrow[i], k = data->ncol[i], n = data->ncol[i + 1];
+
+    F77_CALL(dgemm)("N", "N", &m, &n, &k, &one, data->x[i], &m,
+                    data->x[i + 1], &k, i == 0 ? &zero : &one, data->out, &m FCONE FCONE);
+  }
+}
+
+static void cg_linear_grad_z(cg_kernel_data_t *data)
+{
+  R_xlen_t m = data->out_len, n = (R_xlen_t)data->nrow[0] * data->ncol[1];
+
+  for(int b = 0; b < data->batch; b++)
+  {
+    const double *pg = data->grad + b * n;
+
+    double *po = data->out + b * m;
+
+    if(!data->accumulate)
+    {
+      memset(po, 0, m * sizeof(double));
+    }
+
+    for(R_xlen_t i = 0, iz = 0; i < n; i++)
+    {
+      po[iz] += pg[i];
+
+      if(++iz == m) iz = 0;
+    }
+  }
+}
+
+static void cg_linear_tangent_z(cg_kernel_data_t *data)
+{
+  const double *pt = data->tangent;
+
+  double *po = data->out;
+
+  R_xlen_t nz = data->len[data->n - 1], n = data->out_len;
+
+  for(R_xlen_t i = 0, iz = 0; i < n; i++)
+  {
+    po[i] = data->accumulate ? po[i] + pt[iz] : pt[iz];
+
+    if(++iz == nz) iz = 0;
+  }
+}
+
+static void cg_linear_grad_x2(cg_kernel_data_t *data)
+{
+  cg_gemm_grad_x(data, 2);
+}
+
+static void cg_linear_grad_y2(cg_kernel_data_t *data)
+{
+  cg_gemm_grad_y(data, 2);
+}
+
+static void cg_linear_tangent_x2(cg_kernel_data_t *data)
+{
+  cg_gemm_tangent_x(data, 2);
+}
+
+static void cg_linear_tangent_y2(cg_kernel_data_t *data)
+{
+  cg_gemm_tangent_y(data, 2);
+}
+
+static void cg_linear_hessian_x2(cg_kernel_data_t *data)
+{
+  cg_gemm_hessian_x(data, 2);
+}
+
+static void cg_linear_hessian_y2(cg_kernel_data_t *data)
+{
+  cg_gemm_hessian_y(data, 2);
+}
+
+// Note: the variants of the linear kernels without a bias are chained to
+// the variants with a bias. The gradient of the bias does not depend on the
+// values of the inputs, so the bias has no second-order function.
+static const cg_kernel_t cg_linear1_nobias_kernel = {
+  "linear1", 2, cg_check_matmul, cg_alloc_matmul, cg_length_matmul,
+  cg_linear_forward_nobias, {cg_matmul_grad_x, cg_matmul_grad_y}, NULL,
+  {cg_matmul_tangent_x, cg_matmul_tangent_y},
+  {cg_matmul_hessian_x, cg_matmul_hessian_y}, cg_reuse_matmul, NULL
+};
+
+static const cg_kernel_t cg_linear1_kernel = {
+  "linear1", 3, cg_check_linear1, cg_alloc_matmul, cg_length_matmul,
+  cg_linear_forward, {cg_matmul_grad_x, cg_matmul_grad_y, cg_linear_grad_z}, NULL,
+  {cg_matmul_tangent_x, cg_matmul_tangent_y, cg_linear_tangent_z},
+  {cg_matmul_hessian_x, cg_matmul_hessian_y, NULL}, cg_reuse_matmul,
+  &cg_linear1_nobias_kernel
+};
+
+static const cg_kernel_t cg_linear2_nobias_kernel = {
+  "linear2", 4, cg_check_linear2, cg_alloc_matmul, cg_length_matmul,
+  cg_linear_forward_nobias,
+  {cg_matmul_grad_x, cg_matmul_grad_y, cg_linear_grad_x2, cg_linear_grad_y2}, NULL,
+  {cg_matmul_tangent_x, cg_matmul_tangent_y, cg_linear_tangent_x2, cg_linear_tangent_y2},
+  {cg_matmul_hessian_x, cg_matmul_hessian_y, cg_linear_hessian_x2, cg_linear_hessian_y2},
+  cg_reuse_matmul, NULL
+};
+
+static const cg_kernel_t cg_linear2_kernel = {
+  "linear2", 5, cg_check_linear2, cg_alloc_matmul, cg_length_matmul,
+  cg_linear_forward,
+  {cg_matmul_grad_x, cg_matmul_grad_y, cg_linear_grad_x2, cg_linear_grad_y2, cg_linear_grad_z}, NULL,
+  {cg_matmul_tangent_x, cg_matmul_tangent_y, cg_linear_tangent_x2, cg_linear_tangent_y2, cg_linear_tangent_z},
+  {cg_matmul_hessian_x, cg_matmul_hessian_y, cg_linear_hessian_x2, cg_linear_hessian_y2, NULL},
+  cg_reuse_matmul, &cg_linear2_nobias_kernel
+};
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void cg_kernel_data_init(cg_kernel_data_t *data, SEXP *args, const int n)
+{
+  memset(data, 0, sizeof(cg_kernel_data_t));
+
+  data->n = n;
+
+  data->batch = 1;
+
+  for(int i = 0; i < n; i++)
+  {
+    data->x[i] = REAL(args[i]);
+
+    data->len[i] = XLENGTH(args[i]);
+
+    if(Rf_isMatrix(args[i]))
+    {
+      data->nrow[i] = Rf_nrows(args[i]);
+      data->ncol[i] = Rf_ncols(args[i]);
+    }
+    else
+    {
+      data->nrow[i] = (int)data->len[i];
+      data->ncol[i] = 1;
+    }
+  }
+}
+
+const cg_kernel_t* cg_kernel_find(const char *name)
+{
+  for(int i = cg_kernel_registry_size - 1; i >= 0; i--)
+  {
+    if(strcmp(cg_kernel_registry[i]->name, name) == 0)
+    {
+      return cg_kernel_registry[i];
+    }
+  }
+
+  return NULL;
+}
+
+const cg_kernel_t* cg_kernel_variant(const cg_kernel_t *kernel, const int n)
+{
+  while(kernel != NULL && kernel->n != n)
+  {
+    kernel = kernel->variant;
+  }
+
+  return kernel;
+}
+
+int cg_kernel_register(const cg_kernel_t *kernel)
+{
+  if(kernel == NULL || kernel->name == NULL || kernel->forward == NULL ||
+     kernel->check == NULL || kernel->alloc == NULL || kernel->length == NULL)
+  {
+    return 0;
+  }
+
+  if(kernel->n < 0 || kernel->n > CG_KERNEL_MAX_INPUTS)
+  {
+    return 0;
+  }
+
+  for(int i = 0; i < cg_kernel_registry_size; i++)
+  {
+    if(strcmp(cg_kernel_registry[i]->name, kernel->name) == 0)
+    {
+      cg_kernel_registry[i] = kernel;
+
+      return 1;
+    }
+  }
+
+  if(cg_kernel_registry_size >= CG_KERNEL_REGISTRY_SIZE)
+  {
+    return 0;
+  }
+
+  cg_kernel_registry[cg_kernel_registry_size++] = kernel;
+
+  return 1;
+}
+
+void cg_kernel_init()
+{
+  cg_kernel_register(&cg_pos_kernel);
+  cg_kernel_register(&cg_neg_kernel);
+  cg_kernel_register(&cg_add_kernel);
+  cg_kernel_register(&cg_sub_kernel);
+  cg_kernel_register(&cg_mul_kernel);
+  cg_kernel_register(&cg_div_kernel);
+  cg_kernel_register(&cg_pow_kernel);
+  cg_kernel_register(&cg_square_kernel);
+  cg_kernel_register(&cg_sqrt_kernel);
+  cg_kernel_register(&cg_exp_kernel);
+  cg_kernel_register(&cg_ln_kernel);
+  cg_kernel_register(&cg_log2_kernel);
+  cg_kernel_register(&cg_log10_kernel);
+  cg_kernel_register(&cg_abs_kernel);
+  cg_kernel_register(&cg_sin_kernel);
+  cg_kernel_register(&cg_cos_kernel);
+  cg_kernel_register(&cg_tan_kernel);
+  cg_kernel_register(&cg_sinh_kernel);
+  cg_kernel_register(&cg_cosh_kernel);
+  cg_kernel_register(&cg_tanh_kernel);
+  cg_kernel_register(&cg_asin_kernel);
+  cg_kernel_register(&cg_acos_kernel);
+  cg_kernel_register(&cg_atan_kernel);
+  cg_kernel_register(&cg_asinh_kernel);
+  cg_kernel_register(&cg_acosh_kernel);
+  cg_kernel_register(&cg_atanh_kernel);
+  cg_kernel_register(&cg_sigmoid_kernel);
+  cg_kernel_register(&cg_sum_kernel);
+  cg_kernel_register(&cg_matmul_kernel);
+  cg_kernel_register(&cg_linear1_kernel);
+  cg_kernel_register(&cg_linear2_kernel);
+}
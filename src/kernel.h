@@ -0,0 +1,140 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+/*
+ * MACROS
+ */
+
+#define CG_KERNEL_MAX_INPUTS 5
+
+/*
+ * KERNEL STRUCTURES
+ */
+
+typedef struct
+{
+  int n;                                  /* Number of inputs */
+  const double *x[CG_KERNEL_MAX_INPUTS];  /* Values of the inputs */
+  R_xlen_t len[CG_KERNEL_MAX_INPUTS];     /* Lengths of the inputs */
+  int nrow[CG_KERNEL_MAX_INPUTS];         /* Number of rows of the inputs */
+  int ncol[CG_KERNEL_MAX_INPUTS];         /* Number of columns of the inputs */
+  const double *value;                    /* Value of the node */
+  const double *grad;                     /* Gradient of the node */
+  const double *tangent;                  /* Tangent of an input */
+  const double *tx[CG_KERNEL_MAX_INPUTS]; /* Tangents of the inputs */
+  const double *tvalue;                   /* Tangent of the node */
+  double *out;                            /* Output buffer */
+  R_xlen_t out_len;                       /* Length of the output buffer */
+  int naflag;                             /* Set if NaNs are produced */
+  int accumulate;                         /* Add to the output buffer */
+  int batch;                              /* Number of gradient blocks */
+} cg_kernel_data_t;
+
+typedef int (*cg_kernel_check_t)(SEXP *args, const int n);
+
+typedef SEXP (*cg_kernel_alloc_t)(SEXP *args, const int n);
+
+typedef R_xlen_t (*cg_kernel_length_t)(SEXP *args, const int n);
+
+typedef int (*cg_kernel_reuse_t)(SEXP *args, const int n, SEXP value);
+
+typedef void (*cg_kernel_eval_t)(cg_kernel_data_t *data);
+
+typedef double (*cg_kernel_scalar_t)(const double x, const double y);
+
+typedef double (*cg_kernel_scalar_grad_t)(const double x, const double y,
+                                          const double value, const double grad);
+
+/*
+ * Scalar definition of an element-wise function of (at most) two inputs. The
+ * scalar functions are used to fuse chains of element-wise functions into a
+ * single loop (see fusion.h).
+ */
+typedef struct
+{
+  cg_kernel_scalar_t f;
+  cg_kernel_scalar_grad_t grads[2];
+  int naflag;
+} cg_kernel_elementwise_t;
+
+/*
+ * A kernel evaluates a function and its gradients natively. Function 'check'
+ * determines whether the kernel can process the values of the inputs and
+ * function 'alloc' allocates the value of the node. Function 'length' returns
+ * the length of the value of the node without allocating it (these functions
+ * are called on the main thread). The evaluation functions only read and write the buffers in
+ * the kernel data and do not call the R API. A gradient function writes the
+ * gradient directly into the output buffer, which is overwritten unless flag
+ * 'accumulate' is set (in which case the gradient is added to the buffer). The
+ * gradient of the node and the output buffer can hold several consecutive
+ * blocks (one for each seed of a batched backward pass), in which case the
+ * length of the output buffer refers to the length of a single block. A
+ * tangent function writes the product of the partial derivative of the node
+ * with respect to an input and the tangent of the input to the output buffer
+ * (which is again overwritten unless flag 'accumulate' is set). A hessian
+ * function adds the directional derivative of a gradient function along the
+ * tangents of the inputs and the node (holding the gradient of the node
+ * fixed) to the output buffer. It is NULL if the gradient does not depend on
+ * the values of the inputs. A kernel that cannot process its inputs falls
+ * back to the R definition of the function.
+ * Element-wise kernels can additionally provide a scalar definition of the
+ * function. Function 'reuse' determines whether an existing vector of the
+ * right length has the attributes that 'alloc' would give the value of the
+ * node, so that the previous value of the node can be overwritten instead of
+ * allocating a new one. It can be NULL. A function that accepts a different
+ * number of inputs (e.g. an optional bias) can chain a kernel for each number
+ * of inputs by field 'variant'. Only the first kernel of a chain is
+ * registered.
+ */
+typedef struct cg_kernel
+{
+  const char *name;
+  int n;
+  cg_kernel_check_t check;
+  cg_kernel_alloc_t alloc;
+  cg_kernel_length_t length;
+  cg_kernel_eval_t forward;
+  cg_kernel_eval_t grads[CG_KERNEL_MAX_INPUTS];
+  const cg_kernel_elementwise_t *elementwise;
+  cg_kernel_eval_t tangents[CG_KERNEL_MAX_INPUTS];
+  cg_kernel_eval_t hessians[CG_KERNEL_MAX_INPUTS];
+  cg_kernel_reuse_t reuse;
+  const struct cg_kernel *variant;
+} cg_kernel_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void cg_kernel_data_init(cg_kernel_data_t *data, SEXP *args, const int n);
+
+const cg_kernel_t* cg_kernel_find(const char *name);
+
+const cg_kernel_t* cg_kernel_variant(const cg_kernel_t *kernel, const int n);
+
+int cg_kernel_register(const cg_kernel_t *kernel);
+
+void cg_kernel_init();
+
+#endif
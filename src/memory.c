@@ -0,0 +1,560 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "node.h"
+#include "plan.h"
+#include "table.h"
+#include "fusion.h"
+#include "memory.h"
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static int cg_memory_compare(const void *a, const void *b)
+{
+  return *(const int*)a - *(const int*)b;
+}
+
+// Note: the gradient of a released operator is zeroed in place since the
+// length of the gradient can no longer be determined from the value
+static void cg_memory_zero_grad(SEXP node)
+{
+  if(!Rf_isNull(cg_node_value(node)))
+  {
+    cg_node_zero_grad(node);
+
+    return;
+  }
+
+  SEXP grad = cg_node_grad(node);
+
+  if(Rf_isReal(grad))
+  {
+    memset(REAL(grad), 0, XLENGTH(grad) * sizeof(double));
+  }
+}
+
+typedef struct
+{
+  const cg_table_t *table;                /* Node table */
+  SEXP groups;                            /* Fusion groups */
+  int *entries;                           /* Forward entry of each node (or 0) */
+  int *stored;                            /* Set if a value is never released */
+  int *recomputed;                        /* Ids of the recomputed operators */
+  int n;                                  /* Number of recomputed operators */
+} cg_memory_context_t;
+
+static void cg_memory_recompute(cg_memory_context_t *context, int entry);
+
+// Note: inputs that precede the segment (e.g. inputs of skip connections)
+// may have been released by the forward pass or discarded after an earlier
+// segment was differentiated
+static void cg_memory_recompute_inputs(cg_memory_context_t *context, int entry)
+{
+  int m, *members = cg_plan_members(context->groups, &entry, &m);
+
+  for(int j = 0; j < m; j++)
+  {
+    const cg_table_entry_t *node = cg_table_entry(context->table, members[j]);
+
+    int *inputs = cg_table_inputs(context->table, node);
+
+    for(int r = 0; r < node->n; r++)
+    {
+      int id = inputs[r];
+
+      if(context->entries[id] == 0 || cg_plan_is_member(members, m, id))
+      {
+        continue;
+      }
+
+      if(Rf_isNull(cg_node_value(context->table->entries[id - 1].node)))
+      {
+        cg_memory_recompute(context, context->entries[id]);
+      }
+    }
+  }
+}
+
+static void cg_memory_recompute(cg_memory_context_t *context, int entry)
+{
+  R_CheckStack();
+
+  int m, *members = cg_plan_members(context->groups, &entry, &m);
+
+  cg_memory_recompute_inputs(context, entry);
+
+  if(cg_plan_is_group(entry))
+  {
+    cg_fusion_forward(context->table, cg_plan_group(context->groups, entry));
+  }
+  else
+  {
+    cg_table_forward(context->table, entry);
+  }
+
+  for(int j = 0; j < m; j++)
+  {
+    if(!context->stored[members[j]])
+    {
+      context->recomputed[context->n++] = members[j];
+    }
+  }
+}
+
+static void cg_memory_discard(cg_memory_context_t *context)
+{
+  for(int i = 0; i < context->n; i++)
+  {
+    cg_node_set_value(context->table->entries[context->recomputed[i] - 1].node, R_NilValue);
+  }
+
+  context->n = 0;
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+cg_release_t cg_memory_mode(SEXP free)
+{
+  if(!IS_SCALAR(free, STRSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'free' must be a character scalar");
+  }
+
+  const char *pf = CHAR(STRING_ELT(free, 0));
+
+  if(strcmp(pf, "none") == 0)
+  {
+    return CGRNONE;
+  }
+
+  if(strcmp(pf, "all") == 0)
+  {
+    return CGRALL;
+  }
+
+  if(strcmp(pf, "unused") == 0)
+  {
+    return CGRUNUSED;
+  }
+
+  if(strcmp(pf, "checkpoint") == 0)
+  {
+    return CGRCHECKPOINT;
+  }
+
+  Rf_errorcall(R_NilValue, "argument 'free' must be 'none', 'all', 'unused', or 'checkpoint'");
+}
+
+SEXP cg_memory_segments(const cg_table_t *table, SEXP order, SEXP groups, SEXP checkpoints)
+{
+  int *po = INTEGER(order);
+
+  R_len_t k = XLENGTH(order), l = 0;
+
+  int *ends = (int*)R_alloc(k, sizeof(int));
+
+  if(TYPEOF(checkpoints) == VECSXP)
+  {
+    int *position = (int*)R_alloc(table->size + 1, sizeof(int));
+
+    for(int i = 0; i <= table->size; i++)
+    {
+      position[i] = -1;
+    }
+
+    for(int i = 0; i < k; i++)
+    {
+      int m, *members = cg_plan_members(groups, &po[i], &m);
+
+      for(int j = 0; j < m; j++)
+      {
+        position[members[j]] = i;
+      }
+    }
+
+    R_len_t n = XLENGTH(checkpoints);
+
+    for(int i = 0; i < n; i++)
+    {
+      SEXP node = VECTOR_ELT(checkpoints, i);
+
+      if(!cg_is(node, "cg_node"))
+      {
+        Rf_errorcall(R_NilValue, "argument 'checkpoints' must be a list of cg_node objects");
+      }
+
+      int id = cg_table_id(table, node);
+
+      // Checkpoints that are not evaluated by the pass are ignored
+      if(position[id] >= 0 && l < k)
+      {
+        ends[l++] = position[id];
+      }
+    }
+  }
+  else
+  {
+    int budget;
+
+    if(Rf_isNull(checkpoints))
+    {
+      budget = (int)ceil(sqrt((double)k));
+    }
+    else if(Rf_isNumeric(checkpoints) && XLENGTH(checkpoints) == 1 && Rf_asInteger(checkpoints) >= 1)
+    {
+      budget = Rf_asInteger(checkpoints);
+    }
+    else
+    {
+      Rf_errorcall(R_NilValue, "argument 'checkpoints' must be NULL, a positive numeric scalar, or a list of cg_node objects");
+    }
+
+    // Note: the checkpoints are spread evenly over the forward order
+    int size = (int)ceil((double)k / (budget + 1));
+
+    for(int i = size - 1; i < k - 1 && l < budget; i += size)
+    {
+      ends[l++] = i;
+    }
+  }
+
+  // The target always ends the last segment
+  ends[l++] = k - 1;
+
+  qsort(ends, l, sizeof(int), cg_memory_compare);
+
+  int r = 0;
+
+  for(int i = 0; i < l; i++)
+  {
+    if(r == 0 || ends[i] != ends[r - 1])
+    {
+      ends[r++] = ends[i];
+    }
+  }
+
+  SEXP segments = PROTECT(Rf_allocVector(INTSXP, r));
+
+  memcpy(INTEGER(segments), ends, r * sizeof(int));
+
+  UNPROTECT(1);
+
+  return segments;
+}
+
+cg_memory_plan_t* cg_memory_plan(const cg_table_t *table, const int target, SEXP order,
+                                 SEXP groups, SEXP backward, SEXP levels, SEXP segments,
+                                 const cg_release_t mode)
+{
+  R_len_t n = table->size;
+
+  int *last = (int*)R_alloc(n + 1, sizeof(int));
+  int *keep = (int*)R_alloc(n + 1, sizeof(int));
+
+  for(int i = 0; i <= n; i++)
+  {
+    last[i] = -1;
+    keep[i] = 0;
+  }
+
+  keep[target] = 1;
+
+  int *po = INTEGER(order);
+
+  // The values of the operators at the end of each segment are stored
+  if(mode == CGRCHECKPOINT)
+  {
+    int *ps = INTEGER(segments);
+
+    R_len_t l = XLENGTH(segments);
+
+    for(int i = 0; i < l; i++)
+    {
+      int m, *members = cg_plan_members(groups, &po[ps[i]], &m);
+
+      keep[members[m - 1]] = 1;
+    }
+  }
+
+  // The backward pass reads the values of the differentiable operators
+  // and the values of their inputs
+  if(mode == CGRUNUSED && !Rf_isNull(backward))
+  {
+    int *pb = INTEGER(backward);
+
+    R_len_t k = XLENGTH(backward);
+
+    for(int i = 0; i < k; i++)
+    {
+      int m, *members = cg_plan_members(groups, &pb[i], &m);
+
+      for(int j = 0; j < m; j++)
+      {
+        const cg_table_entry_t *entry = cg_table_entry(table, members[j]);
+
+        if(entry->type != CGDOP)
+        {
+          continue;
+        }
+
+        int *inputs = cg_table_inputs(table, entry);
+
+        keep[members[j]] = 1;
+
+        for(int r = 0; r < entry->n; r++)
+        {
+          keep[inputs[r]] = 1;
+        }
+      }
+    }
+  }
+
+  R_len_t k = XLENGTH(order);
+
+  int *pl = Rf_isNull(levels) ? NULL : INTEGER(levels);
+
+  int steps = 0;
+
+  for(int i = 0; i < k; i++)
+  {
+    int m, *members = cg_plan_members(groups, &po[i], &m);
+
+    int step = (pl != NULL) ? pl[i] : i;
+
+    if(step + 1 > steps)
+    {
+      steps = step + 1;
+    }
+
+    for(int j = 0; j < m; j++)
+    {
+      const cg_table_entry_t *entry = cg_table_entry(table, members[j]);
+
+      int *inputs = cg_table_inputs(table, entry);
+
+      for(int r = 0; r < entry->n; r++)
+      {
+        if(step > last[inputs[r]])
+        {
+          last[inputs[r]] = step;
+        }
+      }
+    }
+  }
+
+  // Only operators are released (the values of constants, parameters, and
+  // inputs are supplied by the user)
+  for(int id = 1; id <= n; id++)
+  {
+    cg_node_type_t type = table->entries[id - 1].type;
+
+    if(keep[id] || (type != CGDOP && type != CGNOP))
+    {
+      last[id] = -1;
+    }
+  }
+
+  cg_memory_plan_t *memory = (cg_memory_plan_t*)R_alloc(1, sizeof(cg_memory_plan_t));
+
+  memory->steps = steps;
+
+  memory->zero_grad = (mode == CGRCHECKPOINT);
+
+  memory->start = (int*)R_alloc(steps + 1, sizeof(int));
+
+  memset(memory->start, 0, (steps + 1) * sizeof(int));
+
+  for(int id = 1; id <= n; id++)
+  {
+    if(last[id] >= 0)
+    {
+      memory->start[last[id] + 1]++;
+    }
+  }
+
+  for(int s = 0; s < steps; s++)
+  {
+    memory->start[s + 1] += memory->start[s];
+  }
+
+  memory->ids = (int*)R_alloc(memory->start[steps] + 1, sizeof(int));
+
+  int *count = (int*)R_alloc(steps + 1, sizeof(int));
+
+  memcpy(count, memory->start, (steps + 1) * sizeof(int));
+
+  for(int id = 1; id <= n; id++)
+  {
+    if(last[id] >= 0)
+    {
+      memory->ids[count[last[id]]++] = id;
+    }
+  }
+
+  return memory;
+}
+
+void cg_memory_release(const cg_table_t *table, const cg_memory_plan_t *memory, const int step)
+{
+  if(memory == NULL || step >= memory->steps)
+  {
+    return;
+  }
+
+  for(int i = memory->start[step]; i < memory->start[step + 1]; i++)
+  {
+    const cg_table_entry_t *entry = &table->entries[memory->ids[i] - 1];
+
+    // The gradients of released operators are allocated before the value
+    // is released (a checkpointed backward pass cannot determine their
+    // length until the segment of the operator is recomputed)
+    if(memory->zero_grad && entry->type == CGDOP)
+    {
+      cg_node_zero_grad(entry->node);
+    }
+
+    cg_node_set_value(entry->node, R_NilValue);
+  }
+}
+
+void cg_memory_backward(const cg_table_t *table, SEXP forward, SEXP backward,
+                        SEXP groups, SEXP segments, int *states)
+{
+  R_len_t n = table->size;
+
+  int *po = INTEGER(forward), *pb = INTEGER(backward), *ps = INTEGER(segments);
+
+  R_len_t k = XLENGTH(forward), kb = XLENGTH(backward), l = XLENGTH(segments);
+
+  cg_memory_context_t context;
+
+  context.table = table;
+  context.groups = groups;
+  context.entries = (int*)R_alloc(n + 1, sizeof(int));
+  context.stored = (int*)R_alloc(n + 1, sizeof(int));
+  context.recomputed = (int*)R_alloc(n + 1, sizeof(int));
+  context.n = 0;
+
+  int *differentiate = (int*)R_alloc(n + 1, sizeof(int));
+
+  memset(context.entries, 0, (n + 1) * sizeof(int));
+  memset(context.stored, 0, (n + 1) * sizeof(int));
+  memset(differentiate, 0, (n + 1) * sizeof(int));
+
+  for(int i = 0; i < k; i++)
+  {
+    int m, *members = cg_plan_members(groups, &po[i], &m);
+
+    for(int j = 0; j < m; j++)
+    {
+      context.entries[members[j]] = po[i];
+    }
+  }
+
+  for(int i = 0; i < l; i++)
+  {
+    int m, *members = cg_plan_members(groups, &po[ps[i]], &m);
+
+    context.stored[members[m - 1]] = 1;
+  }
+
+  for(int i = 0; i < kb; i++)
+  {
+    int m, *members = cg_plan_members(groups, &pb[i], &m);
+
+    for(int j = 0; j < m; j++)
+    {
+      differentiate[members[j]] = 1;
+    }
+  }
+
+  // Note: the operators are differentiated in reverse forward order (which
+  // is a valid order for the backward pass) so that each segment only needs
+  // to be recomputed once
+  int current = -1, s = l - 1;
+
+  for(int p = k - 1; p >= 0; p--)
+  {
+    while(s > 0 && p <= ps[s - 1])
+    {
+      s--;
+    }
+
+    if(s != current)
+    {
+      cg_memory_discard(&context);
+
+      current = s;
+
+      for(int q = (s > 0) ? ps[s - 1] + 1 : 0; q <= ps[s]; q++)
+      {
+        int m, *members = cg_plan_members(groups, &po[q], &m);
+
+        // The values of stored entries are kept, but their inputs may have
+        // been released
+        if(Rf_isNull(cg_node_value(cg_table_entry(table, members[m - 1])->node)))
+        {
+          cg_memory_recompute(&context, po[q]);
+        }
+        else
+        {
+          cg_memory_recompute_inputs(&context, po[q]);
+        }
+      }
+    }
+
+    int m, *members = cg_plan_members(groups, &po[p], &m);
+
+    if(!differentiate[members[m - 1]])
+    {
+      continue;
+    }
+
+    if(cg_plan_is_group(po[p]))
+    {
+      cg_fusion_backward(table, cg_plan_group(groups, po[p]), states);
+    }
+    else
+    {
+      cg_table_backward(table, po[p], states);
+    }
+  }
+
+  cg_memory_discard(&context);
+
+  // Zero the gradients of the nodes to which no gradient was propagated
+  for(int i = 0; i < kb; i++)
+  {
+    int m, *members = cg_plan_members(groups, &pb[i], &m);
+
+    for(int j = 0; j < m; j++)
+    {
+      if(states[members[j]] == CGGPENDING)
+      {
+        cg_memory_zero_grad(cg_table_entry(table, members[j])->node);
+      }
+    }
+  }
+}
@@ -0,0 +1,84 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "table.h"
+
+/*
+ * ENUMERATIONS
+ */
+
+typedef enum {
+    CGRNONE   = 0, /* Keep all values */
+    CGRALL    = 1, /* Release all intermediate values */
+    CGRUNUSED = 2, /* Release the intermediate values not used by a backward pass */
+    CGRCHECKPOINT = 3 /* Release all intermediate values except checkpoints */
+} cg_release_t;
+
+/*
+ * A release plan determines when the values of the intermediate operators
+ * of a forward pass can be released. The value of an operator is released
+ * once the last operator in the pass that consumes it has been evaluated.
+ * The value of the target is never released. The ids of the operators that
+ * are released after step s are stored at positions start[s] to
+ * start[s + 1] - 1 of ids. A step is either a position in the forward order
+ * or a level of the scheduler (see schedule.h).
+ *
+ * If the values are released up to checkpoints, the forward order is split
+ * into segments that each end at a checkpoint. The segments are stored as an
+ * integer vector containing the position of the last entry of each segment.
+ * The backward pass evaluates the segments in reverse order and recomputes
+ * the values of the operators in a segment from the preceding checkpoints
+ * just before the segment is differentiated.
+ */
+
+/*
+ * MEMORY STRUCTURES
+ */
+
+typedef struct
+{
+  int steps;                              /* Number of steps */
+  int *start;                             /* Start of each step in ids */
+  int *ids;                               /* Ids of the released operators */
+  int zero_grad;                          /* Zero gradients before release */
+} cg_memory_plan_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+cg_release_t cg_memory_mode(SEXP free);
+
+SEXP cg_memory_segments(const cg_table_t *table, SEXP order, SEXP groups, SEXP checkpoints);
+
+cg_memory_plan_t* cg_memory_plan(const cg_table_t *table, const int target, SEXP order,
+                                 SEXP groups, SEXP backward, SEXP levels, SEXP segments,
+                                 const cg_release_t mode);
+
+void cg_memory_release(const cg_table_t *table, const cg_memory_plan_t *memory, const int step);
+
+void cg_memory_backward(const cg_table_t *table, SEXP forward, SEXP backward,
+                        SEXP groups, SEXP segments, int *states);
+
+#endif
@@ -21,6 +21,7 @@ limitations under the License.
 
 #include "node.h"
 #include "graph.h"
+#include "shape.h"
 #include "session.h"
 #include "function.h"
 
@@ -54,15 +55,647 @@ extern inline SEXP cg_node_grad(SEXP node);
 
 extern inline void cg_node_set_grad(SEXP node, SEXP grad);
 
+extern inline SEXP cg_node_shape(SEXP node);
+
+extern inline void cg_node_set_shape(SEXP node, SEXP shape);
+
+extern inline SEXP cg_node_take_buffer(SEXP node);
+
 extern inline SEXP cg_node_function(SEXP node);
 
 extern inline void cg_node_set_function(SEXP node, SEXP function);
 
+extern inline int cg_node_differentiate(const cg_node_type_t type, const int *states, const int id);
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static int cg_node_call(SEXP node, cg_node_call_t *call)
+{
+  SEXP inputs = PROTECT(cg_node_inputs(node));
+
+  R_len_t n = XLENGTH(inputs);
+
+  call->kernel = cg_kernel_variant(cg_function_kernel(cg_node_function(node)), n);
+
+  if(call->kernel == NULL)
+  {
+    UNPROTECT(1);
+
+    return 0;
+  }
+
+  SEXP input_tags = PROTECT(Rf_getAttrib(inputs, R_NamesSymbol));
+
+  for(int i = 0; i < n; i++)
+  {
+    if(!Rf_isNull(input_tags) && CHAR(STRING_ELT(input_tags, i))[0] != '\0')
+    {
+      UNPROTECT(2);
+
+      return 0;
+    }
+
+    call->inputs[i] = VECTOR_ELT(inputs, i);
+
+    call->ids[i] = cg_node_id(call->inputs[i]);
+
+    call->types[i] = cg_node_type(call->inputs[i]);
+
+    call->args[i] = cg_node_value(call->inputs[i]);
+  }
+
+  UNPROTECT(2);
+
+  return 1;
+}
+
+// Note: the first gradient that is propagated to a node overwrites the
+// gradient of the node, subsequent gradients are accumulated. Hence, the
+// gradients do not need to be zeroed before the backward pass. If 'states'
+// is NULL, all gradients are accumulated.
+static int cg_node_accumulate(SEXP node, const int id, int *states, const int batch)
+{
+  if(states == NULL || states[id] == CGGWRITTEN)
+  {
+    return 1;
+  }
+
+  cg_node_alloc_grad(node, batch);
+
+  states[id] = CGGWRITTEN;
+
+  return 0;
+}
+
+static SEXP cg_node_grad_blocks(SEXP node, const int batch)
+{
+  SEXP blocks = PROTECT(Rf_allocVector(VECSXP, batch));
+
+  if(batch == 1)
+  {
+    SET_VECTOR_ELT(blocks, 0, cg_node_grad(node));
+
+    UNPROTECT(1);
+
+    return blocks;
+  }
+
+  SEXP value = PROTECT(cg_node_value(node));
+
+  SEXP grad = PROTECT(cg_node_grad(node));
+
+  R_xlen_t n = XLENGTH(value);
+
+  for(int b = 0; b < batch; b++)
+  {
+    SEXP block = Rf_allocVector(REALSXP, n);
+
+    SET_VECTOR_ELT(blocks, b, block);
+
+    memcpy(REAL(block), REAL(grad) + b * n, n * sizeof(double));
+
+    SHALLOW_DUPLICATE_ATTRIB(block, value);
+  }
+
+  UNPROTECT(3);
+
+  return blocks;
+}
+
+// Note: the derivative functions (i.e. gradient or tangent functions) are
+// matched to the inputs of a node by position or by name if the inputs are
+// named
+static SEXP cg_node_match(SEXP node, SEXP functions, SEXP input_tags, const int i)
+{
+  R_len_t m = XLENGTH(functions);
+
+  if(Rf_isNull(input_tags))
+  {
+    if(i >= m)
+    {
+      Rf_errorcall(R_NilValue, "cannot differentiate node '%s' at input %d",
+                   cg_node_name_char(node), i + 1);
+    }
+
+    return VECTOR_ELT(functions, i);
+  }
+
+  SEXP input_tag = STRING_ELT(input_tags, i);
+
+  if(CHAR(input_tag)[0] == '\0')
+  {
+    Rf_errorcall(R_NilValue, "cannot differentiate node '%s' at input %d",
+                 cg_node_name_char(node), i + 1);
+  }
+
+  SEXP function_tags = PROTECT(Rf_getAttrib(functions, R_NamesSymbol));
+
+  if(!Rf_isNull(function_tags))
+  {
+    for(int j = 0; j < m; j++)
+    {
+      if(input_tag == STRING_ELT(function_tags, j))
+      {
+        UNPROTECT(1);
+
+        return VECTOR_ELT(functions, j);
+      }
+    }
+  }
+
+  Rf_errorcall(R_NilValue, "cannot differentiate node '%s' at input '%s'",
+               cg_node_name_char(node), CHAR(input_tag));
+
+  return R_NilValue;
+}
+
+static SEXP cg_node_source(SEXP sources, SEXP input, const int id)
+{
+  SEXP source = VECTOR_ELT(sources, id - 1);
+
+  if(Rf_isNull(source))
+  {
+    SEXP value = PROTECT(cg_node_value(input));
+
+    source = PROTECT(Rf_allocVector(REALSXP, XLENGTH(value)));
+
+    memset(REAL(source), 0, XLENGTH(value) * sizeof(double));
+
+    SHALLOW_DUPLICATE_ATTRIB(source, value);
+
+    SET_VECTOR_ELT(sources, id - 1, source);
+
+    UNPROTECT(2);
+  }
+
+  return source;
+}
+
+static SEXP cg_node_shift(SEXP value, SEXP tangent, const double h)
+{
+  R_xlen_t n = XLENGTH(value);
+
+  SEXP shifted = PROTECT(Rf_coerceVector(value, REALSXP));
+
+  shifted = Rf_duplicate(shifted);
+
+  UNPROTECT(1);
+
+  PROTECT(shifted);
+
+  double *ps = REAL(shifted);
+  double *pt = REAL(tangent);
+
+  for(R_xlen_t i = 0; i < n; i++)
+  {
+    ps[i] += h * pt[i];
+  }
+
+  UNPROTECT(1);
+
+  return shifted;
+}
+
+// Note: the previous value of a node is overwritten by its kernel if it has
+// the length and attributes of a newly allocated value and is not referenced
+// elsewhere (e.g. by an R variable or another node). Kernels without a reuse
+// function only overwrite values whose shape was inferred (see shape.h) if
+// the values of the inputs still have the shapes from which it was inferred.
+static int cg_node_reuse_value(SEXP node, const cg_node_call_t *call, SEXP value)
+{
+  const cg_kernel_t *kernel = call->kernel;
+
+  SEXP *args = (SEXP*)call->args;
+
+  if(TYPEOF(value) != REALSXP || MAYBE_SHARED(value) || XLENGTH(value) != kernel->length(args, kernel->n))
+  {
+    return 0;
+  }
+
+  if(kernel->reuse != NULL)
+  {
+    return kernel->reuse(args, kernel->n, value);
+  }
+
+  int reuse = cg_shape_matches(value, cg_node_shape(node));
+
+  for(int i = 0; i < kernel->n && reuse; i++)
+  {
+    reuse = cg_shape_matches(args[i], cg_node_shape(call->inputs[i]));
+  }
+
+  return reuse;
+}
+
+// Note: if the previous value cannot be overwritten, the buffer that was
+// preallocated by shape inference is taken instead (if it still fits)
+static SEXP cg_node_alloc_value(SEXP node, const cg_node_call_t *call)
+{
+  const cg_kernel_t *kernel = call->kernel;
+
+  SEXP *args = (SEXP*)call->args;
+
+  SEXP value = PROTECT(CG_GET(node, CG_VALUE_SYMBOL));
+
+  if(!cg_node_reuse_value(node, call, value))
+  {
+    SEXP buffer = PROTECT(cg_node_take_buffer(node));
+
+    value = cg_node_reuse_value(node, call, buffer) ? buffer : kernel->alloc(args, kernel->n);
+
+    UNPROTECT(1);
+  }
+
+  UNPROTECT(1);
+
+  return value;
+}
+
 /*
  * PUBLIC FUNCTIONS
  */
 
-void cg_node_zero_grad(SEXP node)
+int cg_node_forward_prepare(SEXP node, const cg_node_call_t *call, cg_node_task_t *task)
+{
+  const cg_kernel_t *kernel = call->kernel;
+
+  SEXP *args = (SEXP*)call->args;
+
+  if(!kernel->check(args, kernel->n))
+  {
+    return 0;
+  }
+
+  SEXP value = PROTECT(cg_node_alloc_value(node, call));
+
+  cg_kernel_data_init(&task->data, args, kernel->n);
+
+  task->data.out = REAL(value);
+
+  task->data.out_len = XLENGTH(value);
+
+  task->eval = kernel->forward;
+
+  task->node = node;
+
+  task->input = R_NilValue;
+
+  CG_SET(node, CG_VALUE_SYMBOL, value);
+
+  UNPROTECT(1);
+
+  return 1;
+}
+
+void cg_node_forward_finish(cg_node_task_t *task)
+{
+  if(task->data.naflag)
+  {
+    Rf_warningcall(R_NilValue, "NaNs produced");
+  }
+}
+
+int cg_node_backward_prepare(SEXP node, const cg_node_call_t *call, cg_node_task_t *tasks, int *n,
+                             int *states, SEXP *buffer)
+{
+  const cg_kernel_t *kernel = call->kernel;
+
+  SEXP *args = (SEXP*)call->args;
+
+  if(!kernel->check(args, kernel->n))
+  {
+    return 0;
+  }
+
+  SEXP value = PROTECT(cg_node_value(node));
+
+  SEXP grad = PROTECT(cg_node_grad(node));
+
+  R_xlen_t m = kernel->length(args, kernel->n);
+
+  int batch = cg_node_grad_batch(node);
+
+  if(!Rf_isReal(value) || !Rf_isReal(grad) || XLENGTH(value) != m || XLENGTH(grad) != m * batch)
+  {
+    UNPROTECT(2);
+
+    return 0;
+  }
+
+  cg_kernel_data_t data;
+
+  cg_kernel_data_init(&data, args, kernel->n);
+
+  data.value = REAL(value);
+
+  data.grad = REAL(grad);
+
+  data.batch = batch;
+
+  R_xlen_t l = 0;
+
+  for(int i = 0; i < kernel->n; i++)
+  {
+    if(!cg_node_differentiate(call->types[i], states, call->ids[i]))
+    {
+      continue;
+    }
+
+    if(kernel->grads[i] == NULL)
+    {
+      Rf_errorcall(R_NilValue, "cannot differentiate node '%s' at input %d",
+                   cg_node_name_char(node), i + 1);
+    }
+
+    if(states == NULL || states[call->ids[i]] == CGGWRITTEN)
+    {
+      SEXP input_grad = cg_node_grad(call->inputs[i]);
+
+      if(!Rf_isReal(input_grad) || XLENGTH(input_grad) != data.len[i] * batch)
+      {
+        Rf_errorcall(R_NilValue, "cannot accumulate gradients of lengths %d and %d for node '%s'",
+                     XLENGTH(input_grad), data.len[i] * batch, cg_node_name_char(node));
+      }
+    }
+
+    l += data.len[i] * batch;
+  }
+
+  // Note: if a buffer is requested, the gradients with respect to all inputs
+  // are written to a single buffer which is merged into the gradients of the
+  // inputs by function cg_node_backward_finish. Otherwise, the gradients are
+  // written directly to the gradients of the inputs.
+  double *pb = NULL;
+
+  if(buffer != NULL)
+  {
+    *buffer = Rf_allocVector(REALSXP, l);
+
+    pb = REAL(*buffer);
+  }
+
+  int k = 0;
+
+  for(int i = 0; i < kernel->n; i++)
+  {
+    if(!cg_node_differentiate(call->types[i], states, call->ids[i]))
+    {
+      continue;
+    }
+
+    tasks[k].data = data;
+
+    if(buffer != NULL)
+    {
+      tasks[k].data.out = pb;
+
+      pb += data.len[i] * batch;
+    }
+    else
+    {
+      tasks[k].data.accumulate = cg_node_accumulate(call->inputs[i], call->ids[i], states, batch);
+
+      tasks[k].data.out = REAL(cg_node_grad(call->inputs[i]));
+    }
+
+    tasks[k].data.out_len = data.len[i];
+
+    tasks[k].eval = kernel->grads[i];
+
+    tasks[k].node = node;
+
+    tasks[k].input = call->inputs[i];
+
+    tasks[k].id = call->ids[i];
+
+    k++;
+  }
+
+  *n = k;
+
+  UNPROTECT(2);
+
+  return 1;
+}
+
+void cg_node_backward_finish(cg_node_task_t *task, int *states)
+{
+  int accumulate = cg_node_accumulate(task->input, task->id, states, task->data.batch);
+
+  SEXP input_grad = PROTECT(cg_node_grad(task->input));
+
+  double *po = task->data.out;
+  double *pi = REAL(input_grad);
+
+  R_xlen_t l = task->data.out_len * task->data.batch;
+
+  if(accumulate)
+  {
+    for(R_xlen_t k = 0; k < l; k++)
+    {
+      pi[k] += po[k];
+    }
+  }
+  else
+  {
+    memcpy(pi, po, l * sizeof(double));
+  }
+
+  UNPROTECT(1);
+}
+
+int cg_node_tangent_prepare(SEXP node, const cg_node_call_t *call, cg_node_task_t *tasks, int *n,
+                            SEXP tangents)
+{
+  const cg_kernel_t *kernel = call->kernel;
+
+  SEXP *args = (SEXP*)call->args;
+
+  if(!kernel->check(args, kernel->n))
+  {
+    return 0;
+  }
+
+  SEXP value = PROTECT(cg_node_value(node));
+
+  R_xlen_t m = kernel->length(args, kernel->n);
+
+  if(!Rf_isReal(value) || XLENGTH(value) != m)
+  {
+    UNPROTECT(1);
+
+    return 0;
+  }
+
+  for(int i = 0; i < kernel->n; i++)
+  {
+    if(!Rf_isNull(VECTOR_ELT(tangents, call->ids[i] - 1)) && kernel->tangents[i] == NULL)
+    {
+      UNPROTECT(1);
+
+      return 0;
+    }
+  }
+
+  cg_kernel_data_t data;
+
+  cg_kernel_data_init(&data, args, kernel->n);
+
+  data.value = REAL(value);
+
+  SEXP tangent = R_NilValue;
+
+  int k = 0;
+
+  for(int i = 0; i < kernel->n; i++)
+  {
+    SEXP input_tangent = VECTOR_ELT(tangents, call->ids[i] - 1);
+
+    if(Rf_isNull(input_tangent))
+    {
+      continue;
+    }
+
+    if(XLENGTH(input_tangent) != data.len[i])
+    {
+      Rf_errorcall(R_NilValue, "cannot propagate tangent of length %d to node '%s' at input %d",
+                   XLENGTH(input_tangent), cg_node_name_char(node), i + 1);
+    }
+
+    // The tangent of the node is allocated once the first input with a
+    // tangent is encountered
+    if(k == 0)
+    {
+      tangent = Rf_allocVector(REALSXP, m);
+
+      SHALLOW_DUPLICATE_ATTRIB(tangent, value);
+
+      SET_VECTOR_ELT(tangents, cg_node_id(node) - 1, tangent);
+    }
+
+    tasks[k].data = data;
+
+    tasks[k].data.tangent = REAL(input_tangent);
+
+    tasks[k].data.accumulate = k > 0;
+
+    tasks[k].data.out = REAL(tangent);
+
+    tasks[k].data.out_len = m;
+
+    tasks[k].eval = kernel->tangents[i];
+
+    tasks[k].node = node;
+
+    tasks[k].input = call->inputs[i];
+
+    tasks[k].id = call->ids[i];
+
+    k++;
+  }
+
+  *n = k;
+
+  UNPROTECT(1);
+
+  return 1;
+}
+
+int cg_node_hessian_prepare(SEXP node, const cg_node_call_t *call, cg_node_task_t *tasks, int *n,
+                            SEXP tangents, SEXP sources, const int *states)
+{
+  const cg_kernel_t *kernel = call->kernel;
+
+  SEXP *args = (SEXP*)call->args;
+
+  if(!kernel->check(args, kernel->n))
+  {
+    return 0;
+  }
+
+  SEXP value = PROTECT(cg_node_value(node));
+
+  SEXP grad = PROTECT(cg_node_grad(node));
+
+  R_xlen_t m = kernel->length(args, kernel->n);
+
+  if(!Rf_isReal(value) || !Rf_isReal(grad) || XLENGTH(value) != m || XLENGTH(grad) != m)
+  {
+    UNPROTECT(2);
+
+    return 0;
+  }
+
+  cg_kernel_data_t data;
+
+  cg_kernel_data_init(&data, args, kernel->n);
+
+  data.value = REAL(value);
+
+  data.grad = REAL(grad);
+
+  // Note: a missing tangent is zero, the kernels read a zero buffer instead
+  R_xlen_t l = m;
+
+  for(int i = 0; i < kernel->n; i++)
+  {
+    if(data.len[i] > l)
+    {
+      l = data.len[i];
+    }
+  }
+
+  double *zero = (double*)R_alloc(l, sizeof(double));
+
+  memset(zero, 0, l * sizeof(double));
+
+  for(int i = 0; i < kernel->n; i++)
+  {
+    SEXP input_tangent = VECTOR_ELT(tangents, call->ids[i] - 1);
+
+    data.tx[i] = Rf_isNull(input_tangent) ? zero : REAL(input_tangent);
+  }
+
+  SEXP tangent = VECTOR_ELT(tangents, cg_node_id(node) - 1);
+
+  data.tvalue = Rf_isNull(tangent) ? zero : REAL(tangent);
+
+  int k = 0;
+
+  for(int i = 0; i < kernel->n; i++)
+  {
+    if(!cg_node_differentiate(call->types[i], states, call->ids[i]) || kernel->hessians[i] == NULL)
+    {
+      continue;
+    }
+
+    tasks[k].data = data;
+
+    tasks[k].data.out = REAL(cg_node_source(sources, call->inputs[i], call->ids[i]));
+
+    tasks[k].data.out_len = data.len[i];
+
+    tasks[k].eval = kernel->hessians[i];
+
+    tasks[k].node = node;
+
+    tasks[k].input = call->inputs[i];
+
+    tasks[k].id = call->ids[i];
+
+    k++;
+  }
+
+  *n = k;
+
+  UNPROTECT(2);
+
+  return 1;
+}
+
+SEXP cg_node_alloc_grad(SEXP node, const int batch)
 {
   SEXP value = PROTECT(cg_node_value(node));
 
@@ -78,20 +711,49 @@ void cg_node_zero_grad(SEXP node)
 
   PROTECT_WITH_INDEX(grad = cg_node_grad(node), &index_grad);
 
-  R_len_t n = XLENGTH(value);
+  R_xlen_t n = XLENGTH(value) * batch;
 
   if(!Rf_isReal(grad) || XLENGTH(grad) != n)
   {
     REPROTECT(grad = Rf_allocVector(REALSXP, n), index_grad);
   }
 
-  memset(REAL(grad), 0, n * sizeof(double));
-
-  SHALLOW_DUPLICATE_ATTRIB(grad, value);
+  // The gradient of a batched backward pass holds one block for each seed
+  if(batch == 1)
+  {
+    SHALLOW_DUPLICATE_ATTRIB(grad, value);
+  }
 
   CG_SET(node, CG_GRAD_SYMBOL, grad);
 
   UNPROTECT(2);
+
+  return grad;
+}
+
+int cg_node_grad_batch(SEXP node)
+{
+  SEXP value = PROTECT(cg_node_value(node));
+
+  SEXP grad = PROTECT(cg_node_grad(node));
+
+  int batch = 1;
+
+  if(Rf_isNumeric(value) && Rf_isReal(grad) && XLENGTH(value) > 0 && XLENGTH(grad) % XLENGTH(value) == 0)
+  {
+    batch = XLENGTH(grad) / XLENGTH(value);
+  }
+
+  UNPROTECT(2);
+
+  return batch;
+}
+
+void cg_node_zero_grad(SEXP node)
+{
+  SEXP grad = cg_node_alloc_grad(node, 1);
+
+  memset(REAL(grad), 0, XLENGTH(grad) * sizeof(double));
 }
 
 void cg_node_init_grad(SEXP node, SEXP index)
@@ -140,22 +802,99 @@ void cg_node_init_grad(SEXP node, SEXP index)
     pg[k - 1] = 1;
   }
 
-  SHALLOW_DUPLICATE_ATTRIB(grad, value);
+  SHALLOW_DUPLICATE_ATTRIB(grad, value);
+
+  CG_SET(node, CG_GRAD_SYMBOL, grad);
+
+  UNPROTECT(2);
+}
+
+void cg_node_forward(SEXP node)
+{
+  SEXP inputs = PROTECT(cg_node_inputs(node));
+
+  SEXP input_tags = PROTECT(Rf_getAttrib(inputs, R_NamesSymbol));
+
+  SEXP function = PROTECT(cg_node_function(node));
+
+  cg_node_call_t kernel_call;
+
+  cg_node_task_t task;
+
+  if(cg_node_call(node, &kernel_call) && cg_node_forward_prepare(node, &kernel_call, &task))
+  {
+    task.eval(&task.data);
+
+    cg_node_forward_finish(&task);
+
+    UNPROTECT(3);
+
+    return;
+  }
+
+  R_len_t n = XLENGTH(inputs);
+
+  SEXP args = PROTECT(Rf_allocVector(LISTSXP, n));
+
+  SEXP arg = args;
+
+  for(int i = 0; i < n; i++)
+  {
+    SEXP input = VECTOR_ELT(inputs, i);
+
+    SETCAR(arg, cg_node_value(input));
+
+    if(!Rf_isNull(input_tags))
+    {
+      SEXP input_tag = STRING_ELT(input_tags, i);
+
+      if(CHAR(input_tag)[0] != '\0')
+      {
+        SET_TAG(arg, Rf_installChar(input_tag));
+      }
+    }
+
+    arg = CDR(arg);
+  }
+
+  SEXP call = PROTECT(Rf_lcons(cg_function_def(function), args));
+
+  SEXP value = PROTECT(Rf_eval(call, R_EmptyEnv));
 
-  CG_SET(node, CG_GRAD_SYMBOL, grad);
+  CG_SET(node, CG_VALUE_SYMBOL, value);
 
-  UNPROTECT(2);
+  UNPROTECT(6);
 }
 
-void cg_node_forward(SEXP node)
+void cg_node_backward(SEXP node, int *states)
 {
   SEXP inputs = PROTECT(cg_node_inputs(node));
 
   SEXP input_tags = PROTECT(Rf_getAttrib(inputs, R_NamesSymbol));
 
+  SEXP function = PROTECT(cg_node_function(node));
+
+  int k;
+
+  cg_node_call_t kernel_call;
+
+  cg_node_task_t tasks[CG_KERNEL_MAX_INPUTS];
+
+  if(cg_node_call(node, &kernel_call) && cg_node_backward_prepare(node, &kernel_call, tasks, &k, states, NULL))
+  {
+    for(int i = 0; i < k; i++)
+    {
+      tasks[i].eval(&tasks[i].data);
+    }
+
+    UNPROTECT(3);
+
+    return;
+  }
+
   R_len_t n = XLENGTH(inputs);
 
-  SEXP args = PROTECT(Rf_allocVector(LISTSXP, n));
+  SEXP args = PROTECT(Rf_allocVector(LISTSXP, n + 2));
 
   SEXP arg = args;
 
@@ -178,23 +917,117 @@ void cg_node_forward(SEXP node)
     arg = CDR(arg);
   }
 
-  SEXP function = PROTECT(cg_node_function(node));
+  SETCAR(arg, cg_node_value(node));
 
-  SEXP call = PROTECT(Rf_lcons(cg_function_def(function), args));
+  SET_TAG(arg, CG_VALUE_SYMBOL);
 
-  SEXP value = PROTECT(Rf_eval(call, R_EmptyEnv));
+  SETCADR(arg, cg_node_grad(node));
 
-  CG_SET(node, CG_VALUE_SYMBOL, value);
+  SET_TAG(CDR(arg), CG_GRAD_SYMBOL);
+
+  SEXP function_grads = PROTECT(cg_function_grads(function));
+
+  // Note: the gradient functions are evaluated for each block of a batched
+  // gradient separately
+  int batch = cg_node_grad_batch(node);
+
+  SEXP blocks = PROTECT(cg_node_grad_blocks(node, batch));
+
+  for(int i = 0; i < n; i++)
+  {
+    SEXP input = VECTOR_ELT(inputs, i);
+
+    int input_id = cg_node_id(input);
+
+    if(!cg_node_differentiate(cg_node_type(input), states, input_id))
+    {
+      continue;
+    }
+
+    SEXP function_grad = cg_node_match(node, function_grads, input_tags, i);
+
+    if(!Rf_isFunction(function_grad))
+    {
+      Rf_errorcall(R_NilValue, "cannot process gradient function of type '%s' for node '%s'",
+                   Rf_type2char(TYPEOF(function_grad)), cg_node_name_char(node));
+    }
+
+    int accumulate = cg_node_accumulate(input, input_id, states, batch);
+
+    SEXP input_grad = PROTECT(cg_node_grad(input));
+
+    R_xlen_t l = XLENGTH(input_grad) / batch;
+
+    SEXP call = PROTECT(Rf_lcons(function_grad, args));
+
+    for(int b = 0; b < batch; b++)
+    {
+      SETCADR(arg, VECTOR_ELT(blocks, b));
+
+      SEXP grad = PROTECT(Rf_eval(call, R_EmptyEnv));
+
+      if(!Rf_isReal(grad))
+      {
+        Rf_errorcall(R_NilValue, "cannot accumulate gradient of type '%s' for node '%s'",
+                     Rf_type2char(TYPEOF(grad)), cg_node_name_char(node));
+      }
+
+      if(l != XLENGTH(grad))
+      {
+        Rf_errorcall(R_NilValue, "cannot accumulate gradients of lengths %d and %d for node '%s'",
+                     l, XLENGTH(grad), cg_node_name_char(node));
+      }
+
+      double *pg = REAL(grad);
+      double *pi = REAL(input_grad) + b * l;
+
+      if(accumulate)
+      {
+        for(R_xlen_t k = 0; k < l; k++)
+        {
+          pi[k] += pg[k];
+        }
+      }
+      else
+      {
+        memcpy(pi, pg, l * sizeof(double));
+      }
+
+      UNPROTECT(1);
+    }
+
+    UNPROTECT(2);
+  }
 
   UNPROTECT(6);
 }
 
-void cg_node_backward(SEXP node)
+void cg_node_tangent(SEXP node, SEXP tangents)
 {
   SEXP inputs = PROTECT(cg_node_inputs(node));
 
   SEXP input_tags = PROTECT(Rf_getAttrib(inputs, R_NamesSymbol));
 
+  SEXP function = PROTECT(cg_node_function(node));
+
+  int k;
+
+  cg_node_call_t kernel_call;
+
+  cg_node_task_t tasks[CG_KERNEL_MAX_INPUTS];
+
+  if(cg_node_call(node, &kernel_call) && cg_node_tangent_prepare(node, &kernel_call, tasks, &k, tangents))
+  {
+    for(int i = 0; i < k; i++)
+    {
+      tasks[i].eval(&tasks[i].data);
+    }
+
+    UNPROTECT(3);
+
+    return;
+  }
+
   R_len_t n = XLENGTH(inputs);
 
   SEXP args = PROTECT(Rf_allocVector(LISTSXP, n + 2));
@@ -220,114 +1053,271 @@ void cg_node_backward(SEXP node)
     arg = CDR(arg);
   }
 
-  SETCAR(arg, cg_node_value(node));
+  SEXP value = PROTECT(cg_node_value(node));
 
-  SET_TAG(arg, CG_VALUE_SYMBOL);
+  SETCAR(arg, value);
 
-  SETCADR(arg, cg_node_grad(node));
+  SET_TAG(arg, CG_VALUE_SYMBOL);
 
-  SET_TAG(CDR(arg), CG_GRAD_SYMBOL);
+  SET_TAG(CDR(arg), CG_TANGENT_SYMBOL);
 
-  SEXP function = PROTECT(cg_node_function(node));
+  SEXP function_tangents = PROTECT(cg_function_tangents(function));
 
-  SEXP function_grads = PROTECT(cg_function_grads(function));
+  if(!Rf_isNumeric(value))
+  {
+    Rf_errorcall(R_NilValue, "cannot differentiate object of type '%s' for node '%s'",
+                 Rf_type2char(TYPEOF(value)), cg_node_name_char(node));
+  }
 
-  SEXP function_grad_tags = PROTECT(Rf_getAttrib(function_grads, R_NamesSymbol));
+  R_xlen_t m = XLENGTH(value);
 
-  R_len_t m = XLENGTH(function_grads);
+  SEXP tangent = R_NilValue;
 
   for(int i = 0; i < n; i++)
   {
-    SEXP input = VECTOR_ELT(inputs, i);
+    SEXP input_tangent = VECTOR_ELT(tangents, cg_node_id(VECTOR_ELT(inputs, i)) - 1);
 
-    cg_node_type_t type = cg_node_type(input);
-
-    if(type == CGCST || type == CGIPT || type == CGNOP)
+    if(Rf_isNull(input_tangent))
     {
       continue;
     }
 
-    SEXP function_grad;
+    SEXP function_tangent = cg_node_match(node, function_tangents, input_tags, i);
+
+    if(!Rf_isFunction(function_tangent))
+    {
+      Rf_errorcall(R_NilValue, "cannot process tangent function of type '%s' for node '%s'",
+                   Rf_type2char(TYPEOF(function_tangent)), cg_node_name_char(node));
+    }
+
+    SETCADR(arg, input_tangent);
+
+    SEXP call = PROTECT(Rf_lcons(function_tangent, args));
+
+    SEXP result = PROTECT(Rf_eval(call, R_EmptyEnv));
+
+    if(!Rf_isReal(result))
+    {
+      Rf_errorcall(R_NilValue, "cannot accumulate tangent of type '%s' for node '%s'",
+                   Rf_type2char(TYPEOF(result)), cg_node_name_char(node));
+    }
+
+    R_xlen_t l = XLENGTH(result);
+
+    // Note: a tangent that is shorter than the value of the node (e.g. the
+    // tangent of a recycled input) is recycled
+    if(l == 0 || m % l != 0)
+    {
+      Rf_errorcall(R_NilValue, "cannot accumulate tangents of lengths %d and %d for node '%s'",
+                   m, l, cg_node_name_char(node));
+    }
+
+    double *pr = REAL(result);
 
-    if(Rf_isNull(input_tags))
+    if(Rf_isNull(tangent))
     {
-      if(i >= m)
+      tangent = Rf_allocVector(REALSXP, m);
+
+      SHALLOW_DUPLICATE_ATTRIB(tangent, value);
+
+      SET_VECTOR_ELT(tangents, cg_node_id(node) - 1, tangent);
+
+      double *pt = REAL(tangent);
+
+      for(R_xlen_t j = 0; j < m; j++)
       {
-        Rf_errorcall(R_NilValue, "cannot differentiate node '%s' at input %d",
-                     cg_node_name_char(node), i + 1);
+        pt[j] = pr[j % l];
       }
-
-      function_grad = VECTOR_ELT(function_grads, i);
     }
     else
     {
-      SEXP input_tag = STRING_ELT(input_tags, i);
+      double *pt = REAL(tangent);
 
-      if(CHAR(input_tag)[0] == '\0')
+      for(R_xlen_t j = 0; j < m; j++)
       {
-        Rf_errorcall(R_NilValue, "cannot differentiate node '%s' at input %d",
-                     cg_node_name_char(node), i + 1);
+        pt[j] += pr[j % l];
       }
+    }
 
-      int match = 0;
+    UNPROTECT(2);
+  }
 
-      if(!Rf_isNull(function_grad_tags))
-      {
-        for(int j = 0; j < m; j++)
-        {
-          if(input_tag == STRING_ELT(function_grad_tags, j))
-          {
-            function_grad = VECTOR_ELT(function_grads, j);
+  UNPROTECT(6);
+}
+
+// Note: the directional derivatives of the gradient functions are
+// approximated by central differences if the node has no native kernel and
+// the approximation is requested (see cg_graph_hvp). This is exact (up to
+// rounding) for gradients that are linear in the values of the inputs.
+void cg_node_hessian(SEXP node, SEXP tangents, SEXP sources, const int *states)
+{
+  SEXP inputs = PROTECT(cg_node_inputs(node));
 
-            match = 1;
+  SEXP input_tags = PROTECT(Rf_getAttrib(inputs, R_NamesSymbol));
 
-            break;
-          }
-        }
+  SEXP function = PROTECT(cg_node_function(node));
+
+  int k;
+
+  cg_node_call_t kernel_call;
+
+  cg_node_task_t tasks[CG_KERNEL_MAX_INPUTS];
+
+  if(cg_node_call(node, &kernel_call) &&
+     cg_node_hessian_prepare(node, &kernel_call, tasks, &k, tangents, sources, states))
+  {
+    for(int i = 0; i < k; i++)
+    {
+      tasks[i].eval(&tasks[i].data);
+    }
+
+    UNPROTECT(3);
+
+    return;
+  }
+
+  R_len_t n = XLENGTH(inputs);
+
+  SEXP value = PROTECT(cg_node_value(node));
+
+  SEXP tangent = VECTOR_ELT(tangents, cg_node_id(node) - 1);
+
+  // The step size is scaled by the magnitudes of the values and tangents
+  double scale = 0, norm = 0;
+
+  for(int i = 0; i <= n; i++)
+  {
+    SEXP x = (i < n) ? cg_node_value(VECTOR_ELT(inputs, i)) : value;
+
+    SEXP t = (i < n) ? VECTOR_ELT(tangents, cg_node_id(VECTOR_ELT(inputs, i)) - 1) : tangent;
+
+    if(Rf_isNull(t))
+    {
+      continue;
+    }
+
+    double *pt = REAL(t);
+
+    R_xlen_t l = XLENGTH(t);
+
+    for(R_xlen_t j = 0; j < l; j++)
+    {
+      double a = fabs(Rf_isReal(x) ? REAL(x)[j] : (double)INTEGER(x)[j]);
+
+      if(a > scale) scale = a;
+
+      if(fabs(pt[j]) > norm) norm = fabs(pt[j]);
+    }
+  }
+
+  if(norm == 0)
+  {
+    UNPROTECT(4);
+
+    return;
+  }
+
+  double h = cbrt(DBL_EPSILON) * (1 + scale) / norm;
+
+  SEXP args = PROTECT(Rf_allocVector(VECSXP, 2));
+
+  for(int d = 0; d < 2; d++)
+  {
+    double step = (d == 0) ? h : -h;
+
+    SEXP args_d = Rf_allocVector(LISTSXP, n + 2);
+
+    SET_VECTOR_ELT(args, d, args_d);
+
+    SEXP arg = args_d;
+
+    for(int i = 0; i < n; i++)
+    {
+      SEXP input = VECTOR_ELT(inputs, i);
+
+      SEXP input_tangent = VECTOR_ELT(tangents, cg_node_id(input) - 1);
+
+      if(Rf_isNull(input_tangent))
+      {
+        SETCAR(arg, cg_node_value(input));
+      }
+      else
+      {
+        SETCAR(arg, cg_node_shift(cg_node_value(input), input_tangent, step));
       }
 
-      if(!match)
+      if(!Rf_isNull(input_tags))
       {
-        Rf_errorcall(R_NilValue, "cannot differentiate node '%s' at input '%s'",
-                     cg_node_name_char(node), CHAR(input_tag));
+        SEXP input_tag = STRING_ELT(input_tags, i);
+
+        if(CHAR(input_tag)[0] != '\0')
+        {
+          SET_TAG(arg, Rf_installChar(input_tag));
+        }
       }
+
+      arg = CDR(arg);
     }
 
+    SETCAR(arg, Rf_isNull(tangent) ? value : cg_node_shift(value, tangent, step));
+
+    SET_TAG(arg, CG_VALUE_SYMBOL);
+
+    SETCADR(arg, cg_node_grad(node));
+
+    SET_TAG(CDR(arg), CG_GRAD_SYMBOL);
+  }
+
+  SEXP function_grads = PROTECT(cg_function_grads(function));
+
+  for(int i = 0; i < n; i++)
+  {
+    SEXP input = VECTOR_ELT(inputs, i);
+
+    int input_id = cg_node_id(input);
+
+    if(!cg_node_differentiate(cg_node_type(input), states, input_id))
+    {
+      continue;
+    }
+
+    SEXP function_grad = cg_node_match(node, function_grads, input_tags, i);
+
     if(!Rf_isFunction(function_grad))
     {
       Rf_errorcall(R_NilValue, "cannot process gradient function of type '%s' for node '%s'",
                    Rf_type2char(TYPEOF(function_grad)), cg_node_name_char(node));
     }
 
-    SEXP call = PROTECT(Rf_lcons(function_grad, args));
+    SEXP call_plus = PROTECT(Rf_lcons(function_grad, VECTOR_ELT(args, 0)));
 
-    SEXP grad = PROTECT(Rf_eval(call, R_EmptyEnv));
+    SEXP call_minus = PROTECT(Rf_lcons(function_grad, VECTOR_ELT(args, 1)));
 
-    if(!Rf_isReal(grad))
-    {
-      Rf_errorcall(R_NilValue, "cannot accumulate gradient of type '%s' for node '%s'",
-                   Rf_type2char(TYPEOF(grad)), cg_node_name_char(node));
-    }
+    SEXP grad_plus = PROTECT(Rf_eval(call_plus, R_EmptyEnv));
 
-    SEXP input_grad = PROTECT(cg_node_grad(input));
+    SEXP grad_minus = PROTECT(Rf_eval(call_minus, R_EmptyEnv));
 
-    R_len_t l = XLENGTH(input_grad);
+    SEXP source = PROTECT(cg_node_source(sources, input, input_id));
 
-    if(l != XLENGTH(grad))
+    R_xlen_t l = XLENGTH(source);
+
+    if(!Rf_isReal(grad_plus) || !Rf_isReal(grad_minus) ||
+       XLENGTH(grad_plus) != l || XLENGTH(grad_minus) != l)
     {
-      Rf_errorcall(R_NilValue, "cannot accumulate gradients of lengths %d and %d for node '%s'",
-                   l, XLENGTH(grad), cg_node_name_char(node));
+      Rf_errorcall(R_NilValue, "cannot accumulate gradient of type '%s' for node '%s'",
+                   Rf_type2char(TYPEOF(grad_plus)), cg_node_name_char(node));
     }
 
-    double *pg = REAL(grad);
-    double *pi = REAL(input_grad);
+    double *pp = REAL(grad_plus);
+    double *pm = REAL(grad_minus);
+    double *ps = REAL(source);
 
-    for(int k = 0; k < l; k++)
+    for(R_xlen_t j = 0; j < l; j++)
     {
-      pi[k] += pg[k];
+      ps[j] += (pp[j] - pm[j]) / (2 * h);
     }
 
-    UNPROTECT(3);
+    UNPROTECT(5);
   }
 
   UNPROTECT(6);
@@ -340,6 +1330,46 @@ SEXP cg_node_print(SEXP node)
   return R_NilValue;
 }
 
+SEXP cg_node_rename(SEXP node, SEXP name)
+{
+  if(!cg_is(node, "cg_node"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'node' must be a cg_node object");
+  }
+
+  if(!Rf_isNull(name) && !IS_SCALAR(name, STRSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'name' must be NULL or a character scalar");
+  }
+
+  SEXP graph = PROTECT(CG_GET(node, CG_GRAPH_SYMBOL));
+
+  SEXP id = PROTECT(CG_GET(node, CG_ID_SYMBOL));
+
+  // Note: nodes that are no longer part of their graph are not indexed
+  if(cg_is(graph, "cg_graph") && IS_SCALAR(id, INTSXP))
+  {
+    cg_table_t *table = cg_graph_table(graph);
+
+    int k = INTEGER(id)[0];
+
+    if(k >= 1 && k <= table->size && table->entries[k - 1].node == node)
+    {
+      cg_table_rename(table, k, name);
+
+      UNPROTECT(2);
+
+      return node;
+    }
+  }
+
+  cg_node_set_name(node, name);
+
+  UNPROTECT(2);
+
+  return node;
+}
+
 /*
  * PUBLIC CONSTRUCTORS
  */
@@ -353,28 +1383,15 @@ SEXP cg_constant(SEXP value, SEXP name)
     Rf_errorcall(R_NilValue, "argument 'name' must be NULL or a character scalar");
   }
 
-  SEXP nodes = PROTECT(CG_GET(graph, CG_NODES_SYMBOL));
-
-  if(TYPEOF(nodes) == VECSXP)
-  {
-    R_len_t n = XLENGTH(nodes);
-
-    for(int i = 0; i < n; i++)
-    {
-      SEXP node = VECTOR_ELT(nodes, i);
+  cg_table_t *table = cg_graph_table(graph);
 
-      if(cg_node_type(node) != CGCST || !Rf_isNull(cg_node_name(node)))
-      {
-        continue;
-      }
+  int id = cg_table_find_constant(table, value);
 
-      if(R_compute_identical(value, cg_node_value(node), 16))
-      {
-        UNPROTECT(2);
+  if(id > 0)
+  {
+    UNPROTECT(1);
 
-        return node;
-      }
-    }
+    return table->entries[id - 1].node;
   }
 
   SEXP node = PROTECT(cg_class("cg_node"));
@@ -391,7 +1408,7 @@ SEXP cg_constant(SEXP value, SEXP name)
 
   cg_graph_add_node(graph, node);
 
-  UNPROTECT(3);
+  UNPROTECT(2);
 
   return node;
 }
@@ -23,6 +23,7 @@ limitations under the License.
 #include <Rinternals.h>
 
 #include "class.h"
+#include "kernel.h"
 #include "symbols.h"
 
 /*
@@ -37,6 +38,52 @@ typedef enum {
     CGNOP = 4  /* Non-differentiable Operator */
 } cg_node_type_t;
 
+/*
+ * The state of the gradient of a node during a backward pass. The first
+ * gradient that is propagated to a pending node overwrites the gradient of
+ * the node, subsequent gradients are accumulated. No gradients are propagated
+ * to pruned nodes. Inputs are only differentiated when they are requested.
+ */
+typedef enum {
+    CGGPRUNED = -1,   /* Pruned */
+    CGGPENDING = 0,   /* Pending */
+    CGGWRITTEN = 1,   /* Written */
+    CGGREQUESTED = 2  /* Requested */
+} cg_grad_state_t;
+
+/*
+ * NODE STRUCTURES
+ */
+
+/*
+ * A task evaluates the native kernel of a node (or the gradient of the node
+ * with respect to one of its inputs). Tasks are prepared and finished on the
+ * main thread while the evaluation of the kernel itself does not call the R
+ * API, so tasks of independent nodes can be evaluated concurrently.
+ */
+typedef struct
+{
+  cg_kernel_eval_t eval;                  /* Kernel function */
+  cg_kernel_data_t data;                  /* Kernel data */
+  SEXP node;                              /* Node that is evaluated */
+  SEXP input;                             /* Input that is differentiated */
+  int id;                                 /* Id of the input */
+} cg_node_task_t;
+
+/*
+ * A call binds the native kernel of a node to the nodes that it consumes and
+ * their values. Calls are resolved either from the environment of a node or
+ * from the node table of a graph (see table.h).
+ */
+typedef struct
+{
+  const cg_kernel_t *kernel;              /* Kernel of the function */
+  SEXP inputs[CG_KERNEL_MAX_INPUTS];      /* Inputs of the node */
+  int ids[CG_KERNEL_MAX_INPUTS];          /* Ids of the inputs */
+  cg_node_type_t types[CG_KERNEL_MAX_INPUTS]; /* Types of the inputs */
+  SEXP args[CG_KERNEL_MAX_INPUTS];        /* Values of the inputs */
+} cg_node_call_t;
+
 /*
  * INLINED GET/SET FUNCTIONS
  */
@@ -195,6 +242,44 @@ inline void cg_node_set_grad(SEXP node, SEXP grad)
     CG_SET(node, CG_GRAD_SYMBOL, grad);
 }
 
+inline SEXP cg_node_shape(SEXP node)
+{
+    SEXP shape = PROTECT(CG_GET(node, CG_SHAPE_SYMBOL));
+
+    if(TYPEOF(shape) != INTSXP)
+    {
+        UNPROTECT(1);
+
+        return R_NilValue;
+    }
+
+    UNPROTECT(1);
+
+    return shape;
+}
+
+inline void cg_node_set_shape(SEXP node, SEXP shape)
+{
+    CG_SET(node, CG_SHAPE_SYMBOL, shape);
+}
+
+// Note: the buffer that is preallocated for the value of a node (see
+// shape.h) is removed from the node once it is taken, so the caller needs to
+// protect it
+inline SEXP cg_node_take_buffer(SEXP node)
+{
+    SEXP buffer = PROTECT(CG_GET(node, CG_BUFFER_SYMBOL));
+
+    if(!Rf_isNull(buffer))
+    {
+        CG_SET(node, CG_BUFFER_SYMBOL, R_NilValue);
+    }
+
+    UNPROTECT(1);
+
+    return buffer;
+}
+
 inline SEXP cg_node_function(SEXP node)
 {
     SEXP function = PROTECT(CG_GET(node, CG_FUN_SYMBOL));
@@ -219,20 +304,60 @@ inline void cg_node_set_function(SEXP node, SEXP function)
     CG_SET(node, CG_FUN_SYMBOL, function);
 }
 
+inline int cg_node_differentiate(const cg_node_type_t type, const int *states, const int id)
+{
+    if(states != NULL && states[id] == CGGPRUNED)
+    {
+        return 0;
+    }
+
+    if(type == CGDOP || type == CGPRM)
+    {
+        return 1;
+    }
+
+    return type == CGIPT && states != NULL && states[id] != CGGPENDING;
+}
+
 /*
  * PUBLIC FUNCTIONS
  */
 
+int cg_node_forward_prepare(SEXP node, const cg_node_call_t *call, cg_node_task_t *task);
+
+void cg_node_forward_finish(cg_node_task_t *task);
+
+int cg_node_backward_prepare(SEXP node, const cg_node_call_t *call, cg_node_task_t *tasks, int *n,
+                             int *states, SEXP *buffer);
+
+void cg_node_backward_finish(cg_node_task_t *task, int *states);
+
+int cg_node_tangent_prepare(SEXP node, const cg_node_call_t *call, cg_node_task_t *tasks, int *n,
+                            SEXP tangents);
+
+int cg_node_hessian_prepare(SEXP node, const cg_node_call_t *call, cg_node_task_t *tasks, int *n,
+                            SEXP tangents, SEXP sources, const int *states);
+
+SEXP cg_node_alloc_grad(SEXP node, const int batch);
+
+int cg_node_grad_batch(SEXP node);
+
 void cg_node_zero_grad(SEXP node);
 
 void cg_node_init_grad(SEXP node, SEXP index);
 
 void cg_node_forward(SEXP node);
 
-void cg_node_backward(SEXP node);
+void cg_node_backward(SEXP node, int *states);
+
+void cg_node_tangent(SEXP node, SEXP tangents);
+
+void cg_node_hessian(SEXP node, SEXP tangents, SEXP sources, const int *states);
 
 SEXP cg_node_print(SEXP node);
 
+SEXP cg_node_rename(SEXP node, SEXP name);
+
 /*
  * PUBLIC CONSTRUCTORS
  */
@@ -20,6 +20,8 @@ limitations under the License.
 #include <Rinternals.h>
 
 #include "node.h"
+#include "trace.h"
+#include "profile.h"
 #include "optimizer.h"
 
 /*
@@ -532,6 +534,8 @@ SEXP cg_optim_step(SEXP optim)
     Rf_errorcall(R_NilValue, "argument 'optim' must be a cg_optim object");
   }
 
+  double start = cg_trace_active() ? cg_profile_time() : 0;
+
   switch(cg_optim_type(optim))
   {
     case CGSGD :
@@ -553,6 +557,11 @@ SEXP cg_optim_step(SEXP optim)
       Rf_errorcall(R_NilValue, "optimizer is not (yet) implemented");
   }
 
+  if(cg_trace_active())
+  {
+    cg_trace_event("cg_optim_step", "optim", 0, start, cg_profile_time(), 0);
+  }
+
   return R_NilValue;
 }
 
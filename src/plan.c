@@ -0,0 +1,335 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "node.h"
+#include "plan.h"
+#include "graph.h"
+#include "table.h"
+#include "fusion.h"
+#include "schedule.h"
+
+/*
+ * INLINED GET/SET FUNCTIONS
+ */
+
+extern inline SEXP cg_plan_graph(SEXP plan);
+
+extern inline SEXP cg_plan_target(SEXP plan);
+
+extern inline int cg_plan_version(SEXP plan);
+
+extern inline int cg_plan_fuse(SEXP plan);
+
+extern inline SEXP cg_plan_groups(SEXP plan);
+
+extern inline SEXP cg_plan_forward(SEXP plan);
+
+extern inline SEXP cg_plan_backward(SEXP plan);
+
+extern inline SEXP cg_plan_forward_levels(SEXP plan);
+
+extern inline SEXP cg_plan_backward_levels(SEXP plan);
+
+extern inline SEXP cg_plan_segments(SEXP plan);
+
+extern inline void cg_plan_set_segments(SEXP plan, SEXP segments);
+
+extern inline int cg_plan_group_entry(const int g);
+
+extern inline int cg_plan_is_group(const int entry);
+
+extern inline SEXP cg_plan_group(SEXP groups, const int entry);
+
+extern inline int* cg_plan_members(SEXP groups, const int *entry, int *m);
+
+extern inline int cg_plan_is_member(const int *members, const int m, const int id);
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static SEXP cg_plan_dfs_from(const cg_table_t *table, SEXP target, int (*filter)(cg_node_type_t type))
+{
+  int id = cg_table_id(table, target);
+
+  R_len_t n = table->size;
+
+  int k = 0, top = 0;
+
+  int *visited = Calloc(n, int);
+
+  int *queue = (int*)R_alloc(n, sizeof(int));
+
+  int *stack = (int*)R_alloc(n, sizeof(int));
+
+  // Note: the position of the next input that is traversed is stored for
+  // each node, so the inputs of each node are visited only once.
+  int *next = (int*)R_alloc(n, sizeof(int));
+
+  memset(next, 0, n * sizeof(int));
+
+  stack[0] = id;
+
+  visited[id - 1] = 1;
+
+  while(top >= 0)
+  {
+    int can_traverse = 0;
+
+    const cg_table_entry_t *entry = &table->entries[stack[top] - 1];
+
+    int *inputs = cg_table_inputs(table, entry);
+
+    int *pn = &next[stack[top] - 1];
+
+    while(*pn < entry->n)
+    {
+      int input_id = inputs[(*pn)++];
+
+      if(!visited[input_id - 1] && filter(table->entries[input_id - 1].type))
+      {
+        stack[++top] = input_id;
+
+        visited[input_id - 1] = 1;
+
+        can_traverse = 1;
+
+        break;
+      }
+    }
+
+    if(!can_traverse)
+    {
+      queue[k++] = stack[top--];
+    }
+  }
+
+  Free(visited);
+
+  SEXP order = PROTECT(Rf_allocVector(INTSXP, k));
+
+  memcpy(INTEGER(order), queue, k * sizeof(int));
+
+  UNPROTECT(1);
+
+  return order;
+}
+
+static inline int forward_filter(cg_node_type_t type)
+{
+  if(type == CGDOP || type == CGNOP)
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+static inline int backward_filter(cg_node_type_t type)
+{
+  if(type == CGDOP || type == CGPRM)
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+// Note: the operators in a fusion group are replaced by a single entry that
+// refers to the group at the position of the last operator in the group.
+static SEXP cg_plan_fuse_order(SEXP order, SEXP groups, R_len_t n)
+{
+  int *role = (int*)R_alloc(n + 1, sizeof(int));
+
+  memset(role, 0, (n + 1) * sizeof(int));
+
+  R_len_t l = XLENGTH(groups);
+
+  for(int g = 0; g < l; g++)
+  {
+    SEXP group = VECTOR_ELT(groups, g);
+
+    int *ids = INTEGER(group);
+
+    R_len_t m = XLENGTH(group);
+
+    for(int j = 0; j < m - 1; j++)
+    {
+      role[ids[j]] = 1;
+    }
+
+    role[ids[m - 1]] = cg_plan_group_entry(g);
+  }
+
+  int *po = INTEGER(order);
+
+  R_len_t k = XLENGTH(order), r = 0;
+
+  SEXP fused = PROTECT(Rf_allocVector(INTSXP, k));
+
+  int *pf = INTEGER(fused);
+
+  for(int i = 0; i < k; i++)
+  {
+    int id = po[i];
+
+    if(role[id] > 0)
+    {
+      continue;
+    }
+
+    pf[r++] = (role[id] < 0) ? role[id] : id;
+  }
+
+  fused = Rf_lengthgets(fused, r);
+
+  UNPROTECT(1);
+
+  return fused;
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void cg_plan_compile(SEXP plan)
+{
+  SEXP graph = PROTECT(cg_plan_graph(plan));
+
+  SEXP target = PROTECT(cg_plan_target(plan));
+
+  cg_node_type_t type = cg_node_type(target);
+
+  if(type != CGDOP && type != CGNOP)
+  {
+    Rf_errorcall(R_NilValue, "argument 'target' must be an operator");
+  }
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  int index_forward, index_backward, index_groups;
+
+  SEXP forward = R_NilValue, backward = R_NilValue, groups = R_NilValue;
+
+  PROTECT_WITH_INDEX(forward = cg_plan_dfs_from(table, target, forward_filter), &index_forward);
+
+  PROTECT_WITH_INDEX(backward = R_NilValue, &index_backward);
+
+  PROTECT_WITH_INDEX(groups = R_NilValue, &index_groups);
+
+  if(type == CGDOP)
+  {
+    REPROTECT(backward = cg_plan_dfs_from(table, target, backward_filter), index_backward);
+  }
+
+  int fuse = cg_graph_fuse(graph);
+
+  if(fuse)
+  {
+    REPROTECT(groups = cg_fusion_groups(table, target, forward), index_groups);
+
+    if(!Rf_isNull(groups))
+    {
+      REPROTECT(forward = cg_plan_fuse_order(forward, groups, table->size), index_forward);
+
+      if(!Rf_isNull(backward))
+      {
+        REPROTECT(backward = cg_plan_fuse_order(backward, groups, table->size), index_backward);
+      }
+    }
+  }
+
+  CG_SET(plan, CG_FORWARD_SYMBOL, forward);
+
+  CG_SET(plan, CG_FORWARD_LEVELS_SYMBOL, cg_schedule_levels(table, forward, groups, 0));
+
+  CG_SET(plan, CG_BACKWARD_SYMBOL, backward);
+
+  if(!Rf_isNull(backward))
+  {
+    CG_SET(plan, CG_BACKWARD_LEVELS_SYMBOL, cg_schedule_levels(table, backward, groups, 1));
+  }
+  else
+  {
+    CG_SET(plan, CG_BACKWARD_LEVELS_SYMBOL, R_NilValue);
+  }
+
+  CG_SET(plan, CG_GROUPS_SYMBOL, groups);
+
+  CG_SET(plan, CG_SEGMENTS_SYMBOL, R_NilValue);
+
+  CG_SET(plan, CG_FUSE_SYMBOL, Rf_ScalarLogical(fuse));
+
+  CG_SET(plan, CG_VERSION_SYMBOL, Rf_ScalarInteger(cg_graph_version(graph)));
+
+  UNPROTECT(5);
+}
+
+SEXP cg_plan_update(SEXP plan)
+{
+  SEXP graph = PROTECT(cg_plan_graph(plan));
+
+  if(cg_plan_version(plan) != cg_graph_version(graph) ||
+     cg_plan_fuse(plan) != cg_graph_fuse(graph))
+  {
+    cg_plan_compile(plan);
+  }
+
+  UNPROTECT(1);
+
+  return plan;
+}
+
+SEXP cg_plan_print(SEXP plan)
+{
+  Rprintf("<cg_plan>\n");
+
+  return R_NilValue;
+}
+
+/*
+ * PUBLIC CONSTRUCTORS
+ */
+
+SEXP cg_plan(SEXP graph, SEXP target)
+{
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  if(!cg_is(target, "cg_node"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'target' must be a cg_node object");
+  }
+
+  SEXP plan = PROTECT(cg_class("cg_plan"));
+
+  CG_SET(plan, CG_TARGET_SYMBOL, target);
+
+  CG_SET(plan, CG_GRAPH_SYMBOL, graph);
+
+  cg_plan_compile(plan);
+
+  UNPROTECT(1);
+
+  return plan;
+}
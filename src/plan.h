@@ -0,0 +1,254 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef PLAN_H
+#define PLAN_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "class.h"
+#include "symbols.h"
+
+/*
+ * INLINED GET/SET FUNCTIONS
+ */
+
+inline SEXP cg_plan_graph(SEXP plan)
+{
+    SEXP graph = PROTECT(CG_GET(plan, CG_GRAPH_SYMBOL));
+
+    if(!cg_is(graph, "cg_graph"))
+    {
+        Rf_errorcall(R_NilValue, "plan has no graph");
+    }
+
+    UNPROTECT(1);
+
+    return graph;
+}
+
+inline SEXP cg_plan_target(SEXP plan)
+{
+    SEXP target = PROTECT(CG_GET(plan, CG_TARGET_SYMBOL));
+
+    if(!cg_is(target, "cg_node"))
+    {
+        Rf_errorcall(R_NilValue, "plan has no target");
+    }
+
+    UNPROTECT(1);
+
+    return target;
+}
+
+inline int cg_plan_version(SEXP plan)
+{
+    SEXP version = PROTECT(CG_GET(plan, CG_VERSION_SYMBOL));
+
+    if(!IS_SCALAR(version, INTSXP))
+    {
+        UNPROTECT(1);
+
+        return -1;
+    }
+
+    UNPROTECT(1);
+
+    return INTEGER(version)[0];
+}
+
+inline int cg_plan_fuse(SEXP plan)
+{
+    SEXP fuse = PROTECT(CG_GET(plan, CG_FUSE_SYMBOL));
+
+    if(!IS_SCALAR(fuse, LGLSXP))
+    {
+        UNPROTECT(1);
+
+        return 0;
+    }
+
+    UNPROTECT(1);
+
+    return INTEGER(fuse)[0];
+}
+
+inline SEXP cg_plan_groups(SEXP plan)
+{
+    SEXP groups = PROTECT(CG_GET(plan, CG_GROUPS_SYMBOL));
+
+    if(TYPEOF(groups) != VECSXP)
+    {
+        UNPROTECT(1);
+
+        return R_NilValue;
+    }
+
+    UNPROTECT(1);
+
+    return groups;
+}
+
+inline SEXP cg_plan_forward(SEXP plan)
+{
+    SEXP forward = PROTECT(CG_GET(plan, CG_FORWARD_SYMBOL));
+
+    if(TYPEOF(forward) != INTSXP)
+    {
+        Rf_errorcall(R_NilValue, "plan has no forward order");
+    }
+
+    UNPROTECT(1);
+
+    return forward;
+}
+
+inline SEXP cg_plan_backward(SEXP plan)
+{
+    SEXP backward = PROTECT(CG_GET(plan, CG_BACKWARD_SYMBOL));
+
+    if(TYPEOF(backward) != INTSXP)
+    {
+        Rf_errorcall(R_NilValue, "plan has no backward order");
+    }
+
+    UNPROTECT(1);
+
+    return backward;
+}
+
+inline SEXP cg_plan_forward_levels(SEXP plan)
+{
+    SEXP levels = PROTECT(CG_GET(plan, CG_FORWARD_LEVELS_SYMBOL));
+
+    if(TYPEOF(levels) != INTSXP)
+    {
+        Rf_errorcall(R_NilValue, "plan has no forward levels");
+    }
+
+    UNPROTECT(1);
+
+    return levels;
+}
+
+inline SEXP cg_plan_backward_levels(SEXP plan)
+{
+    SEXP levels = PROTECT(CG_GET(plan, CG_BACKWARD_LEVELS_SYMBOL));
+
+    if(TYPEOF(levels) != INTSXP)
+    {
+        Rf_errorcall(R_NilValue, "plan has no backward levels");
+    }
+
+    UNPROTECT(1);
+
+    return levels;
+}
+
+inline SEXP cg_plan_segments(SEXP plan)
+{
+    SEXP segments = PROTECT(CG_GET(plan, CG_SEGMENTS_SYMBOL));
+
+    if(TYPEOF(segments) != INTSXP)
+    {
+        UNPROTECT(1);
+
+        return R_NilValue;
+    }
+
+    UNPROTECT(1);
+
+    return segments;
+}
+
+inline void cg_plan_set_segments(SEXP plan, SEXP segments)
+{
+    CG_SET(plan, CG_SEGMENTS_SYMBOL, segments);
+}
+
+/*
+ * An entry of the forward or backward order of a plan is either the id of a
+ * node or a negative number that refers to a fusion group in the list of
+ * groups of the plan. The functions below are the only functions that encode
+ * and decode these entries.
+ */
+
+inline int cg_plan_group_entry(const int g)
+{
+    return -(g + 1);
+}
+
+inline int cg_plan_is_group(const int entry)
+{
+    return entry < 0;
+}
+
+inline SEXP cg_plan_group(SEXP groups, const int entry)
+{
+    return VECTOR_ELT(groups, -entry - 1);
+}
+
+// Note: the members of an entry that refers to a node consist of the node
+// itself, so the entry must point into the order
+inline int* cg_plan_members(SEXP groups, const int *entry, int *m)
+{
+    if(cg_plan_is_group(*entry))
+    {
+        SEXP group = cg_plan_group(groups, *entry);
+
+        *m = XLENGTH(group);
+
+        return INTEGER(group);
+    }
+
+    *m = 1;
+
+    return (int*)entry;
+}
+
+inline int cg_plan_is_member(const int *members, const int m, const int id)
+{
+    for(int j = 0; j < m; j++)
+    {
+        if(members[j] == id)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void cg_plan_compile(SEXP plan);
+
+SEXP cg_plan_update(SEXP plan);
+
+SEXP cg_plan_print(SEXP plan);
+
+/*
+ * PUBLIC CONSTRUCTORS
+ */
+
+SEXP cg_plan(SEXP graph, SEXP target);
+
+#endif
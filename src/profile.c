@@ -0,0 +1,182 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <time.h>
+
+#include "node.h"
+#include "class.h"
+#include "graph.h"
+#include "table.h"
+#include "profile.h"
+#include "function.h"
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+double cg_profile_time()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+double cg_profile_bytes(SEXP x)
+{
+  if(x == R_NilValue || x == R_UnboundValue)
+  {
+    return 0;
+  }
+
+  double n = (double)XLENGTH(x);
+
+  switch(TYPEOF(x))
+  {
+    case LGLSXP:
+    case INTSXP:
+      return n * sizeof(int);
+    case REALSXP:
+      return n * sizeof(double);
+    case CPLXSXP:
+      return n * sizeof(Rcomplex);
+    case RAWSXP:
+      return n;
+    case STRSXP:
+    case VECSXP:
+      return n * sizeof(SEXP);
+    default:
+      return 0;
+  }
+}
+
+SEXP cg_graph_profile(SEXP graph, SEXP reset)
+{
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  if(!IS_SCALAR(reset, LGLSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'reset' must be a logical scalar");
+  }
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  int k = 0;
+
+  for(int id = 1; id <= table->size; id++)
+  {
+    cg_node_type_t type = cg_table_entry(table, id)->type;
+
+    k += type == CGDOP || type == CGNOP;
+  }
+
+  SEXP builtins = PROTECT(cg_function_builtins());
+
+  SEXP ids = PROTECT(Rf_allocVector(INTSXP, k));
+  SEXP names = PROTECT(Rf_allocVector(STRSXP, k));
+  SEXP functions = PROTECT(Rf_allocVector(STRSXP, k));
+  SEXP calls[2], time[2], bytes[2];
+
+  for(int p = 0; p < 2; p++)
+  {
+    calls[p] = PROTECT(Rf_allocVector(INTSXP, k));
+    time[p] = PROTECT(Rf_allocVector(REALSXP, k));
+    bytes[p] = PROTECT(Rf_allocVector(REALSXP, k));
+  }
+
+  for(int id = 1, i = 0; id <= table->size; id++)
+  {
+    const cg_table_entry_t *entry = cg_table_entry(table, id);
+
+    if(entry->type != CGDOP && entry->type != CGNOP)
+    {
+      continue;
+    }
+
+    INTEGER(ids)[i] = id;
+
+    SET_STRING_ELT(names, i, Rf_mkChar(cg_node_name_char(entry->node)));
+
+    // Functions that are not provided by the package have no name
+    SEXP name = cg_function_builtin_name(builtins, cg_node_function(entry->node));
+
+    SET_STRING_ELT(functions, i, Rf_isNull(name) ? R_NaString : Rf_mkChar(CHAR(name) + 1));
+
+    for(int p = 0; p < 2; p++)
+    {
+      const cg_profile_entry_t *profile = (table->profile != NULL) ? &table->profile[id - 1] : NULL;
+
+      INTEGER(calls[p])[i] = (profile != NULL) ? profile->calls[p] : 0;
+      REAL(time[p])[i] = (profile != NULL) ? profile->time[p] : 0;
+      REAL(bytes[p])[i] = (profile != NULL) ? profile->bytes[p] : 0;
+    }
+
+    i++;
+  }
+
+  if(Rf_asLogical(reset) == TRUE && table->profile != NULL)
+  {
+    memset(table->profile, 0, table->size * sizeof(cg_profile_entry_t));
+  }
+
+  const char *columns[] = {"id", "name", "function", "forward_calls", "forward_time", "forward_bytes",
+                           "backward_calls", "backward_time", "backward_bytes"};
+
+  SEXP profile = PROTECT(Rf_allocVector(VECSXP, 9));
+
+  SET_VECTOR_ELT(profile, 0, ids);
+  SET_VECTOR_ELT(profile, 1, names);
+  SET_VECTOR_ELT(profile, 2, functions);
+
+  for(int p = 0; p < 2; p++)
+  {
+    SET_VECTOR_ELT(profile, 3 + 3 * p, calls[p]);
+    SET_VECTOR_ELT(profile, 4 + 3 * p, time[p]);
+    SET_VECTOR_ELT(profile, 5 + 3 * p, bytes[p]);
+  }
+
+  SEXP column_names = PROTECT(Rf_allocVector(STRSXP, 9));
+
+  for(int j = 0; j < 9; j++)
+  {
+    SET_STRING_ELT(column_names, j, Rf_mkChar(columns[j]));
+  }
+
+  Rf_setAttrib(profile, R_NamesSymbol, column_names);
+
+  // Note: the row names are stored in the compact form c(NA, -k)
+  SEXP row_names = PROTECT(Rf_allocVector(INTSXP, 2));
+
+  INTEGER(row_names)[0] = NA_INTEGER;
+  INTEGER(row_names)[1] = -k;
+
+  Rf_setAttrib(profile, R_RowNamesSymbol, row_names);
+
+  Rf_setAttrib(profile, R_ClassSymbol, Rf_mkString("data.frame"));
+
+  UNPROTECT(13);
+
+  return profile;
+}
@@ -0,0 +1,73 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+/*
+ * The profiler records the number of evaluations, the wall time, and the
+ * number of bytes allocated for values and gradients of each node in a graph.
+ * Forward evaluations are charged with the value of the node and backward
+ * evaluations with the gradients of its inputs. A fused group of operators is
+ * charged to the last operator in the group. Only newly allocated vectors are
+ * counted, gradients that are accumulated in place do not allocate memory.
+ */
+
+/*
+ * ENUMERATIONS
+ */
+
+typedef enum {
+    CGPFORWARD  = 0, /* Forward evaluation */
+    CGPBACKWARD = 1  /* Backward evaluation */
+} cg_profile_pass_t;
+
+/*
+ * PROFILE STRUCTURES
+ */
+
+typedef struct
+{
+  int calls[2];                           /* Number of evaluations per pass */
+  double time[2];                         /* Wall time (in seconds) per pass */
+  double bytes[2];                        /* Bytes allocated per pass */
+} cg_profile_entry_t;
+
+typedef struct
+{
+  cg_profile_pass_t pass;                 /* Pass that is profiled */
+  double start;                           /* Start time of the evaluation */
+  int n;                                  /* Number of objects */
+  SEXP *objects;                          /* Values or gradients before the evaluation */
+} cg_profile_sample_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+double cg_profile_time();
+
+double cg_profile_bytes(SEXP x);
+
+SEXP cg_graph_profile(SEXP graph, SEXP reset);
+
+#endif
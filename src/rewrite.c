@@ -0,0 +1,525 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdint.h>
+
+#include "node.h"
+#include "class.h"
+#include "graph.h"
+#include "table.h"
+#include "rewrite.h"
+#include "function.h"
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static int* cg_rewrite_targets(const cg_table_t *table, SEXP targets)
+{
+  if(TYPEOF(targets) != VECSXP)
+  {
+    Rf_errorcall(R_NilValue, "argument 'targets' must be a list of cg_node objects");
+  }
+
+  int *target = (int*)R_alloc(table->size + 1, sizeof(int));
+
+  memset(target, 0, (table->size + 1) * sizeof(int));
+
+  R_len_t n = XLENGTH(targets);
+
+  for(int i = 0; i < n; i++)
+  {
+    SEXP node = VECTOR_ELT(targets, i);
+
+    if(!cg_is(node, "cg_node"))
+    {
+      Rf_errorcall(R_NilValue, "argument 'targets' must be a list of cg_node objects");
+    }
+
+    int id = cg_table_id(table, node);
+
+    target[id] = 1;
+  }
+
+  return target;
+}
+
+// Note: the inputs of an operator are replaced by their representatives. A
+// new list of inputs is created (keeping the names of the inputs), since the
+// list may be shared with other objects.
+static void cg_rewrite_inputs(const cg_table_t *table, const cg_table_entry_t *entry, const int *map)
+{
+  int *inputs = cg_table_inputs(table, entry);
+
+  int changed = 0;
+
+  for(int q = 0; q < entry->n; q++)
+  {
+    changed = changed || map[inputs[q]] != inputs[q];
+  }
+
+  if(!changed)
+  {
+    return;
+  }
+
+  SEXP old_inputs = PROTECT(cg_node_inputs(entry->node));
+
+  SEXP new_inputs = PROTECT(Rf_allocVector(VECSXP, entry->n));
+
+  for(int q = 0; q < entry->n; q++)
+  {
+    SET_VECTOR_ELT(new_inputs, q, cg_table_entry(table, map[inputs[q]])->node);
+  }
+
+  Rf_setAttrib(new_inputs, R_NamesSymbol, Rf_getAttrib(old_inputs, R_NamesSymbol));
+
+  CG_SET(entry->node, CG_INPUTS_SYMBOL, new_inputs);
+
+  UNPROTECT(2);
+}
+
+static uint64_t cg_rewrite_hash(const cg_table_t *table, const cg_table_entry_t *entry, const int *map)
+{
+  int *inputs = cg_table_inputs(table, entry);
+
+  uint64_t h = (uintptr_t)CG_GET(entry->node, CG_FUN_SYMBOL);
+
+  h ^= (uint64_t)entry->n + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+
+  for(int q = 0; q < entry->n; q++)
+  {
+    h ^= (uint64_t)map[inputs[q]] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  }
+
+  return h;
+}
+
+// Note: two operators are equal if they call the same function with the
+// same (representatives of their) inputs under the same names
+static int cg_rewrite_equal(const cg_table_t *table, const int a, const int b, const int *map)
+{
+  const cg_table_entry_t *x = cg_table_entry(table, a), *y = cg_table_entry(table, b);
+
+  if(x->n != y->n || CG_GET(x->node, CG_FUN_SYMBOL) != CG_GET(y->node, CG_FUN_SYMBOL))
+  {
+    return 0;
+  }
+
+  int *xi = cg_table_inputs(table, x), *yi = cg_table_inputs(table, y);
+
+  for(int q = 0; q < x->n; q++)
+  {
+    if(map[xi[q]] != map[yi[q]])
+    {
+      return 0;
+    }
+  }
+
+  SEXP x_tags = PROTECT(Rf_getAttrib(cg_node_inputs(x->node), R_NamesSymbol));
+
+  SEXP y_tags = PROTECT(Rf_getAttrib(cg_node_inputs(y->node), R_NamesSymbol));
+
+  int equal = 1;
+
+  for(int q = 0; q < x->n && equal; q++)
+  {
+    SEXP x_tag = Rf_isNull(x_tags) ? R_BlankString : STRING_ELT(x_tags, q);
+    SEXP y_tag = Rf_isNull(y_tags) ? R_BlankString : STRING_ELT(y_tags, q);
+
+    equal = strcmp(CHAR(x_tag), CHAR(y_tag)) == 0;
+  }
+
+  UNPROTECT(2);
+
+  return equal;
+}
+
+// Note: the operator is evaluated once and turned into a constant that holds
+// its value. Its function and inputs are dropped so that the inputs can be
+// removed from the graph.
+static void cg_rewrite_fold(SEXP node)
+{
+  cg_node_forward(node);
+
+  CG_SET(node, CG_GRAD_SYMBOL, R_NilValue);
+
+  CG_SET(node, CG_FUN_SYMBOL, R_NilValue);
+
+  CG_SET(node, CG_INPUTS_SYMBOL, R_NilValue);
+
+  cg_node_set_type(node, CGCST);
+}
+
+// Note: the functions of the package are bound to (delayed) variables in
+// the namespace of the package
+static SEXP cg_rewrite_function(SEXP ns, const char *name)
+{
+  SEXP function = Rf_eval(Rf_install(name), ns);
+
+  if(!cg_is(function, "cg_function"))
+  {
+    Rf_errorcall(R_NilValue, "cannot find function '%s'", name);
+  }
+
+  return function;
+}
+
+static int cg_rewrite_is_tagged(SEXP inputs)
+{
+  SEXP input_tags = Rf_getAttrib(inputs, R_NamesSymbol);
+
+  if(Rf_isNull(input_tags))
+  {
+    return 0;
+  }
+
+  for(int i = 0; i < XLENGTH(input_tags); i++)
+  {
+    if(CHAR(STRING_ELT(input_tags, i))[0] != '\0')
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Note: a matrix product (or a linear transformation without bias) can be
+// absorbed by its consumer if it has no other consumers, has no name, and is
+// not a target.
+// The factors of the products are written to argument 'terms' and their
+// number is returned.
+static int cg_rewrite_terms(const int id, const int *count, const int *target, const cg_node_type_t *types,
+                            SEXP *functions, SEXP node, SEXP *terms)
+{
+  if(types[id] != CGDOP || count[id] != 1 || target[id] || !Rf_isNull(cg_node_name(node)))
+  {
+    return 0;
+  }
+
+  SEXP function = CG_GET(node, CG_FUN_SYMBOL), inputs = CG_GET(node, CG_INPUTS_SYMBOL);
+
+  R_len_t n = XLENGTH(inputs);
+
+  if((function == functions[0] && n == 2) || (function == functions[1] && n == 2) ||
+     (function == functions[2] && n == 4))
+  {
+    if(cg_rewrite_is_tagged(inputs))
+    {
+      return 0;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+      terms[i] = VECTOR_ELT(inputs, i);
+    }
+
+    return n / 2;
+  }
+
+  return 0;
+}
+
+// Note: the sum of a matrix product and another node is replaced by function
+// linear1 and the sum of two matrix products by function linear2. The
+// operators are visited in topological order, so that sums of sums (e.g. the
+// sum of two matrix products and a bias) are absorbed one by one. The sum is
+// rewritten in place and the absorbed operators are marked dead.
+static void cg_rewrite_linear(const cg_table_t *table, const int *map, const cg_node_type_t *types,
+                              const int *target, int *live)
+{
+  int n = table->size;
+
+  SEXP ns = PROTECT(cg_function_namespace());
+
+  SEXP functions[4];
+
+  functions[0] = PROTECT(cg_rewrite_function(ns, ".matmul"));
+  functions[1] = PROTECT(cg_rewrite_function(ns, ".linear1"));
+  functions[2] = PROTECT(cg_rewrite_function(ns, ".linear2"));
+  functions[3] = PROTECT(cg_rewrite_function(ns, ".add"));
+
+  int *count = (int*)R_alloc(n + 1, sizeof(int));
+
+  memset(count, 0, (n + 1) * sizeof(int));
+
+  for(int id = 1; id <= n; id++)
+  {
+    if(!live[id] || map[id] != id || (types[id] != CGDOP && types[id] != CGNOP))
+    {
+      continue;
+    }
+
+    const cg_table_entry_t *entry = cg_table_entry(table, id);
+
+    int *inputs = cg_table_inputs(table, entry);
+
+    for(int q = 0; q < entry->n; q++)
+    {
+      count[map[inputs[q]]]++;
+    }
+  }
+
+  for(int id = 1; id <= n; id++)
+  {
+    if(!live[id] || map[id] != id || types[id] != CGDOP)
+    {
+      continue;
+    }
+
+    SEXP node = cg_table_entry(table, id)->node;
+
+    SEXP inputs = CG_GET(node, CG_INPUTS_SYMBOL);
+
+    if(CG_GET(node, CG_FUN_SYMBOL) != functions[3] || XLENGTH(inputs) != 2 || cg_rewrite_is_tagged(inputs))
+    {
+      continue;
+    }
+
+    SEXP x = VECTOR_ELT(inputs, 0), y = VECTOR_ELT(inputs, 1), terms[6];
+
+    int a = cg_node_id(x), b = cg_node_id(y);
+
+    int ta = cg_rewrite_terms(a, count, target, types, functions, x, terms);
+
+    int tb = (ta < 2) ? cg_rewrite_terms(b, count, target, types, functions, y, terms + 2 * ta) : 0;
+
+    SEXP bias = R_NilValue;
+
+    if(ta == 0 && tb == 0)
+    {
+      continue;
+    }
+
+    if(ta + tb > 2 || tb == 0)
+    {
+      // The matrix products of x are kept and y is the bias
+      tb = 0;
+
+      bias = y;
+    }
+    else if(ta == 0)
+    {
+      bias = x;
+    }
+
+    int t = ta + tb, m = 2 * t + !Rf_isNull(bias);
+
+    SEXP new_inputs = PROTECT(Rf_allocVector(VECSXP, m));
+
+    for(int i = 0; i < 2 * t; i++)
+    {
+      SET_VECTOR_ELT(new_inputs, i, terms[i]);
+    }
+
+    if(!Rf_isNull(bias))
+    {
+      SET_VECTOR_ELT(new_inputs, 2 * t, bias);
+    }
+
+    CG_SET(node, CG_FUN_SYMBOL, functions[t]);
+
+    CG_SET(node, CG_INPUTS_SYMBOL, new_inputs);
+
+    if(ta > 0)
+    {
+      live[a] = 0;
+    }
+
+    if(tb > 0)
+    {
+      live[b] = 0;
+    }
+
+    UNPROTECT(1);
+  }
+
+  UNPROTECT(5);
+}
+
+// Note: the graph is emptied and the nodes are re-added, which assigns new
+// ids to the nodes and rebuilds the node table. The cached plans of the
+// graph are invalidated.
+static void cg_rewrite_replace(SEXP graph, SEXP nodes)
+{
+  CG_SET(graph, CG_SIZE_SYMBOL, Rf_ScalarInteger(0));
+
+  CG_SET(graph, CG_STORAGE_SYMBOL, R_NilValue);
+
+  cg_graph_add_nodes(graph, nodes);
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+SEXP cg_graph_optimize(SEXP graph, SEXP targets)
+{
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  int n = table->size;
+
+  int *target = cg_rewrite_targets(table, targets);
+
+  // The representative of each node (i.e. the node that replaces it) and the
+  // type of each node after constant folding
+  int *map = (int*)R_alloc(n + 1, sizeof(int));
+
+  cg_node_type_t *types = (cg_node_type_t*)R_alloc(n + 1, sizeof(cg_node_type_t));
+
+  // Operators are hashed by their function and the representatives of their
+  // inputs. The hash table uses open addressing and is kept at most half full.
+  int capacity = 16;
+
+  while(capacity < 2 * n)
+  {
+    capacity *= 2;
+  }
+
+  int *slots = (int*)R_alloc(capacity, sizeof(int));
+
+  memset(slots, 0, capacity * sizeof(int));
+
+  for(int id = 1; id <= n; id++)
+  {
+    const cg_table_entry_t *entry = cg_table_entry(table, id);
+
+    map[id] = id;
+
+    types[id] = entry->type;
+
+    if(entry->type != CGDOP && entry->type != CGNOP)
+    {
+      continue;
+    }
+
+    cg_rewrite_inputs(table, entry, map);
+
+    // Note: named operators are neither merged nor folded so that they can
+    // still be retrieved by name
+    int named = !Rf_isNull(cg_node_name(entry->node));
+
+    // Common subexpression elimination
+    size_t i = cg_rewrite_hash(table, entry, map) & (capacity - 1);
+
+    while(slots[i] != 0 && !cg_rewrite_equal(table, slots[i], id, map))
+    {
+      i = (i + 1) & (capacity - 1);
+    }
+
+    if(slots[i] != 0 && !target[id] && !named)
+    {
+      map[id] = slots[i];
+
+      continue;
+    }
+
+    if(slots[i] == 0)
+    {
+      slots[i] = id;
+    }
+
+    // Constant folding
+    int *inputs = cg_table_inputs(table, entry), constant = !target[id] && !named;
+
+    for(int q = 0; q < entry->n && constant; q++)
+    {
+      constant = types[map[inputs[q]]] == CGCST;
+    }
+
+    if(constant)
+    {
+      cg_rewrite_fold(entry->node);
+
+      types[id] = CGCST;
+    }
+  }
+
+  // Dead node elimination (parameters and inputs are always kept)
+  int *live = (int*)R_alloc(n + 1, sizeof(int));
+
+  for(int id = 1; id <= n; id++)
+  {
+    live[id] = target[id] || types[id] == CGPRM || types[id] == CGIPT;
+  }
+
+  for(int id = n; id >= 1; id--)
+  {
+    if(!live[id] || map[id] != id)
+    {
+      continue;
+    }
+
+    if(types[id] == CGDOP || types[id] == CGNOP)
+    {
+      const cg_table_entry_t *entry = cg_table_entry(table, id);
+
+      int *inputs = cg_table_inputs(table, entry);
+
+      for(int q = 0; q < entry->n; q++)
+      {
+        live[map[inputs[q]]] = 1;
+      }
+    }
+  }
+
+  // Fusion of matrix products and sums into linear transformations
+  cg_rewrite_linear(table, map, types, target, live);
+
+  int k = 0;
+
+  for(int id = 1; id <= n; id++)
+  {
+    k += live[id] && map[id] == id;
+  }
+
+  SEXP nodes = PROTECT(Rf_allocVector(VECSXP, k));
+
+  for(int id = 1, j = 0; id <= n; id++)
+  {
+    SEXP node = cg_table_entry(table, id)->node;
+
+    if(live[id] && map[id] == id)
+    {
+      SET_VECTOR_ELT(nodes, j++, node);
+    }
+    else
+    {
+      // The id of a removed node is cleared so that the node can no longer
+      // be mistaken for the node that is assigned its id
+      CG_SET(node, CG_ID_SYMBOL, R_NilValue);
+
+      CG_SET(node, CG_GRAPH_SYMBOL, R_NilValue);
+    }
+  }
+
+  cg_rewrite_replace(graph, nodes);
+
+  UNPROTECT(1);
+
+  return R_NilValue;
+}
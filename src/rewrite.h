@@ -0,0 +1,41 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#ifndef REWRITE_H
+#define REWRITE_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+/*
+ * A rewrite pass transforms the nodes of a graph into an equivalent (but
+ * smaller) set of nodes. The nodes that are kept are re-added to the graph
+ * in their original order, so that they receive consecutive ids and the node
+ * table, the name index, and the constant pool are rebuilt. Nodes that are
+ * removed by a pass no longer belong to the graph. The targets supplied to a
+ * pass are never removed or replaced.
+ */
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+SEXP cg_graph_optimize(SEXP graph, SEXP targets);
+
+#endif
@@ -0,0 +1,348 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "node.h"
+#include "plan.h"
+#include "table.h"
+#include "fusion.h"
+#include "memory.h"
+#include "trace.h"
+#include "schedule.h"
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+// Note: the entries are sorted by level using a counting sort. The entries
+// in level l are stored at positions start[l] to start[l + 1] - 1.
+static int* cg_schedule_sort(const int *levels, const int k, int **start, int *l)
+{
+  int max = 0;
+
+  for(int i = 0; i < k; i++)
+  {
+    if(levels[i] > max)
+    {
+      max = levels[i];
+    }
+  }
+
+  int *ps = (int*)R_alloc(max + 2, sizeof(int));
+
+  memset(ps, 0, (max + 2) * sizeof(int));
+
+  for(int i = 0; i < k; i++)
+  {
+    ps[levels[i] + 1]++;
+  }
+
+  for(int j = 0; j <= max; j++)
+  {
+    ps[j + 1] += ps[j];
+  }
+
+  int *sorted = (int*)R_alloc(k, sizeof(int));
+
+  int *count = (int*)R_alloc(max + 1, sizeof(int));
+
+  memcpy(count, ps, (max + 1) * sizeof(int));
+
+  for(int i = 0; i < k; i++)
+  {
+    sorted[count[levels[i]]++] = i;
+  }
+
+  *start = ps;
+
+  *l = max + 1;
+
+  return sorted;
+}
+
+static int cg_schedule_thread()
+{
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+// Note: if a trace is recorded, the threads only record the times at which
+// the tasks are evaluated. The events are written by the main thread.
+static void cg_schedule_run(cg_node_task_t *tasks, const int n, const int threads, const char *category)
+{
+  double *times = cg_trace_active() ? (double*)R_alloc(2 * (size_t)n + 1, sizeof(double)) : NULL;
+
+  int *tids = (times != NULL) ? (int*)R_alloc(n + 1, sizeof(int)) : NULL;
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(threads) schedule(dynamic, 1) if(n > 1)
+#endif
+  for(int i = 0; i < n; i++)
+  {
+    if(times != NULL)
+    {
+      times[2 * i] = cg_profile_time();
+    }
+
+    tasks[i].eval(&tasks[i].data);
+
+    if(times != NULL)
+    {
+      times[2 * i + 1] = cg_profile_time();
+
+      tids[i] = cg_schedule_thread();
+    }
+  }
+
+  if(times != NULL)
+  {
+    for(int i = 0; i < n; i++)
+    {
+      cg_trace_event(cg_node_name_char(tasks[i].node), category, tids[i],
+                     times[2 * i], times[2 * i + 1], cg_node_id(tasks[i].node));
+    }
+  }
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+SEXP cg_schedule_levels(const cg_table_t *table, SEXP order, SEXP groups, const int backward)
+{
+  R_len_t n = table->size;
+
+  int *level = (int*)R_alloc(n + 1, sizeof(int));
+
+  memset(level, 0, (n + 1) * sizeof(int));
+
+  int *po = INTEGER(order);
+
+  R_len_t k = XLENGTH(order);
+
+  SEXP levels = PROTECT(Rf_allocVector(INTSXP, k));
+
+  int *pl = INTEGER(levels);
+
+  for(int r = 0; r < k; r++)
+  {
+    // The forward levels are determined from the inputs to the target and
+    // the backward levels from the target to the inputs
+    int i = backward ? k - r - 1 : r, m;
+
+    int *members = cg_plan_members(groups, &po[i], &m);
+
+    int id = members[m - 1], l = 0;
+
+    if(backward)
+    {
+      pl[i] = level[id];
+    }
+
+    for(int j = 0; j < m; j++)
+    {
+      const cg_table_entry_t *row = cg_table_entry(table, members[j]);
+
+      int *inputs = cg_table_inputs(table, row);
+
+      for(int q = 0; q < row->n; q++)
+      {
+        int input_id = inputs[q];
+
+        if(cg_plan_is_member(members, m, input_id))
+        {
+          continue;
+        }
+
+        if(backward)
+        {
+          if(level[input_id] < pl[i] + 1)
+          {
+            level[input_id] = pl[i] + 1;
+          }
+        }
+        else
+        {
+          if(level[input_id] > l)
+          {
+            l = level[input_id];
+          }
+        }
+      }
+    }
+
+    if(!backward)
+    {
+      pl[i] = l + 1;
+
+      level[id] = l + 1;
+    }
+  }
+
+  UNPROTECT(1);
+
+  return levels;
+}
+
+void cg_schedule_forward(const cg_table_t *table, SEXP order, SEXP groups, SEXP levels, const int threads,
+                         const cg_memory_plan_t *memory)
+{
+  int *po = INTEGER(order);
+
+  R_len_t k = XLENGTH(order);
+
+  int *start, l;
+
+  int *sorted = cg_schedule_sort(INTEGER(levels), k, &start, &l);
+
+  cg_node_task_t *tasks = (cg_node_task_t*)R_alloc(k, sizeof(cg_node_task_t));
+
+  for(int j = 0; j < l; j++)
+  {
+    int t = 0;
+
+    for(int i = start[j]; i < start[j + 1]; i++)
+    {
+      int entry = po[sorted[i]];
+
+      if(cg_plan_is_group(entry))
+      {
+        cg_fusion_forward(table, cg_plan_group(groups, entry));
+
+        continue;
+      }
+
+      const cg_table_entry_t *row = cg_table_entry(table, entry);
+
+      cg_node_call_t call;
+
+      if(cg_table_call(table, row, &call) && cg_node_forward_prepare(row->node, &call, &tasks[t]))
+      {
+        t++;
+      }
+      else
+      {
+        double start = cg_trace_active() ? cg_profile_time() : 0;
+
+        cg_node_forward(row->node);
+
+        if(cg_trace_active())
+        {
+          cg_trace_node(row->node, "forward", start);
+        }
+      }
+    }
+
+    cg_schedule_run(tasks, t, threads, "forward");
+
+    for(int i = 0; i < t; i++)
+    {
+      cg_node_forward_finish(&tasks[i]);
+    }
+
+    cg_memory_release(table, memory, j);
+  }
+}
+
+void cg_schedule_backward(const cg_table_t *table, SEXP order, SEXP groups, SEXP levels, const int threads,
+                          int *states)
+{
+  int *po = INTEGER(order);
+
+  R_len_t k = XLENGTH(order);
+
+  int *start, l;
+
+  int *sorted = cg_schedule_sort(INTEGER(levels), k, &start, &l);
+
+  cg_node_task_t *tasks = (cg_node_task_t*)R_alloc((size_t)k * CG_KERNEL_MAX_INPUTS, sizeof(cg_node_task_t));
+
+  SEXP buffers = PROTECT(Rf_allocVector(VECSXP, k));
+
+  for(int j = 0; j < l; j++)
+  {
+    int t = 0, b = 0;
+
+    for(int i = start[j]; i < start[j + 1]; i++)
+    {
+      int entry = po[sorted[i]];
+
+      if(cg_plan_is_group(entry))
+      {
+        cg_fusion_backward(table, cg_plan_group(groups, entry), states);
+
+        continue;
+      }
+
+      const cg_table_entry_t *row = cg_table_entry(table, entry);
+
+      if(row->type != CGDOP || states[entry] == CGGPRUNED)
+      {
+        continue;
+      }
+
+      int n;
+
+      SEXP buffer;
+
+      cg_node_call_t call;
+
+      if(cg_table_call(table, row, &call) &&
+         cg_node_backward_prepare(row->node, &call, &tasks[t], &n, states, &buffer))
+      {
+        SET_VECTOR_ELT(buffers, b++, buffer);
+
+        t += n;
+      }
+      else
+      {
+        double start = cg_trace_active() ? cg_profile_time() : 0;
+
+        cg_node_backward(row->node, states);
+
+        if(cg_trace_active())
+        {
+          cg_trace_node(row->node, "backward", start);
+        }
+      }
+    }
+
+    cg_schedule_run(tasks, t, threads, "backward");
+
+    for(int i = 0; i < t; i++)
+    {
+      cg_node_backward_finish(&tasks[i], states);
+    }
+
+    for(int i = 0; i < b; i++)
+    {
+      SET_VECTOR_ELT(buffers, i, R_NilValue);
+    }
+  }
+
+  UNPROTECT(1);
+}
@@ -0,0 +1,47 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "table.h"
+#include "memory.h"
+
+/*
+ * The scheduler evaluates the entries of a plan level by level. The entries
+ * in the same level do not depend on each other. The native kernels of the
+ * nodes in a level are evaluated concurrently while all other nodes (i.e.
+ * nodes that need the R interpreter) are evaluated on the main thread.
+ */
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+SEXP cg_schedule_levels(const cg_table_t *table, SEXP order, SEXP groups, const int backward);
+
+void cg_schedule_forward(const cg_table_t *table, SEXP order, SEXP groups, SEXP levels, const int threads,
+                         const cg_memory_plan_t *memory);
+
+void cg_schedule_backward(const cg_table_t *table, SEXP order, SEXP groups, SEXP levels, const int threads,
+                          int *states);
+
+#endif
@@ -0,0 +1,823 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "node.h"
+#include "class.h"
+#include "graph.h"
+#include "shape.h"
+#include "table.h"
+#include "function.h"
+
+/*
+ * SHAPE RULES
+ */
+
+// Note: argument 'args' holds the values of the inputs that are constants
+// (or R_NilValue for other inputs) and argument 'tags' the tags of the inputs
+// (or R_NilValue if the inputs are not tagged)
+typedef int (*cg_shape_rule_t)(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out);
+
+typedef struct
+{
+  const char *name;
+  cg_shape_rule_t rule;
+  int tagged;
+} cg_shape_def_t;
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static R_xlen_t cg_shape_length(const cg_shape_t *shape)
+{
+  R_xlen_t n = 1;
+
+  for(int j = 0; j < shape->k; j++)
+  {
+    n *= shape->dims[j];
+  }
+
+  return n;
+}
+
+static int cg_shape_vector(cg_shape_t *shape, const R_xlen_t n)
+{
+  if(n > INT_MAX)
+  {
+    return 0;
+  }
+
+  shape->k = 1;
+
+  shape->dims[0] = (int)n;
+
+  return 1;
+}
+
+static int cg_shape_matrix(cg_shape_t *shape, const int nrow, const int ncol)
+{
+  shape->k = 2;
+
+  shape->dims[0] = nrow;
+  shape->dims[1] = ncol;
+
+  return 1;
+}
+
+static int cg_shape_equal(const cg_shape_t *x, const cg_shape_t *y)
+{
+  if(x->k != y->k)
+  {
+    return 0;
+  }
+
+  for(int j = 0; j < x->k; j++)
+  {
+    if(x->dims[j] != y->dims[j])
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Note: vectors are treated as column matrices (as by crossprod)
+static void cg_shape_column(const cg_shape_t *x, int *nrow, int *ncol)
+{
+  *nrow = x->dims[0];
+
+  *ncol = (x->k == 1) ? 1 : x->dims[1];
+}
+
+static int cg_shape_elementwise(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 1)
+  {
+    return 0;
+  }
+
+  *out = in[0];
+
+  return 1;
+}
+
+// Note: the shapes follow the attributes of the result of R's arithmetic
+// operators. Cases in which R emits a warning or error have no shape.
+static int cg_shape_binary(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 2)
+  {
+    return 0;
+  }
+
+  const cg_shape_t *x = &in[0], *y = &in[1];
+
+  R_xlen_t nx = cg_shape_length(x), ny = cg_shape_length(y);
+
+  if(nx == 0 || ny == 0 || (nx > ny ? nx % ny : ny % nx) != 0)
+  {
+    return 0;
+  }
+
+  if(x->k > 1 && y->k > 1)
+  {
+    if(!cg_shape_equal(x, y))
+    {
+      return 0;
+    }
+
+    *out = *x;
+
+    return 1;
+  }
+
+  if(x->k > 1)
+  {
+    *out = *x;
+
+    return nx >= ny;
+  }
+
+  if(y->k > 1)
+  {
+    *out = *y;
+
+    return ny >= nx;
+  }
+
+  return cg_shape_vector(out, nx > ny ? nx : ny);
+}
+
+// Note: pmax and pmin copy the attributes of their first argument if it is
+// as long as the result
+static int cg_shape_parallel(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 2)
+  {
+    return 0;
+  }
+
+  R_xlen_t nx = cg_shape_length(&in[0]), ny = cg_shape_length(&in[1]);
+
+  if(nx == 0 || ny == 0)
+  {
+    return 0;
+  }
+
+  if(in[0].k > 1 && nx >= ny)
+  {
+    *out = in[0];
+
+    return 1;
+  }
+
+  return cg_shape_vector(out, nx > ny ? nx : ny);
+}
+
+static int cg_shape_scalar(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 1)
+  {
+    return 0;
+  }
+
+  return cg_shape_vector(out, 1);
+}
+
+static int cg_shape_matmul(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n < 2)
+  {
+    return 0;
+  }
+
+  const cg_shape_t *x = &in[0], *y = &in[1];
+
+  if(x->k > 2 || y->k > 2)
+  {
+    return 0;
+  }
+
+  if(x->k == 2 && y->k == 2)
+  {
+    return x->dims[1] == y->dims[0] && cg_shape_matrix(out, x->dims[0], y->dims[1]);
+  }
+
+  // A vector is promoted to a row or column matrix to make the arguments
+  // conformable
+  if(x->k == 1 && y->k == 2)
+  {
+    if(x->dims[0] == y->dims[0])
+    {
+      return cg_shape_matrix(out, 1, y->dims[1]);
+    }
+
+    return y->dims[0] == 1 && cg_shape_matrix(out, x->dims[0], y->dims[1]);
+  }
+
+  if(x->k == 2 && y->k == 1)
+  {
+    if(x->dims[1] == y->dims[0])
+    {
+      return cg_shape_matrix(out, x->dims[0], 1);
+    }
+
+    return x->dims[1] == 1 && cg_shape_matrix(out, x->dims[0], y->dims[0]);
+  }
+
+  return x->dims[0] == y->dims[0] && cg_shape_matrix(out, 1, 1);
+}
+
+static int cg_shape_bias(const cg_shape_t *z, const cg_shape_t *out)
+{
+  R_xlen_t nz = cg_shape_length(z), m = cg_shape_length(out);
+
+  return nz > 0 && nz <= m && m % nz == 0;
+}
+
+static int cg_shape_linear1(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 2 && n != 3)
+  {
+    return 0;
+  }
+
+  if(!cg_shape_matmul(in, args, tags, 2, out))
+  {
+    return 0;
+  }
+
+  return n == 2 || cg_shape_bias(&in[2], out);
+}
+
+static int cg_shape_linear2(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 4 && n != 5)
+  {
+    return 0;
+  }
+
+  cg_shape_t out2;
+
+  if(!cg_shape_matmul(in, args, tags, 2, out) || !cg_shape_matmul(in + 2, args + 2, tags, 2, &out2))
+  {
+    return 0;
+  }
+
+  if(!cg_shape_equal(out, &out2))
+  {
+    return 0;
+  }
+
+  return n == 4 || cg_shape_bias(&in[4], out);
+}
+
+static int cg_shape_crossprod(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 1 && n != 2)
+  {
+    return 0;
+  }
+
+  if(in[0].k > 2 || (n == 2 && in[1].k > 2))
+  {
+    return 0;
+  }
+
+  int x_nrow, x_ncol, y_nrow, y_ncol;
+
+  cg_shape_column(&in[0], &x_nrow, &x_ncol);
+
+  cg_shape_column(&in[n - 1], &y_nrow, &y_ncol);
+
+  return x_nrow == y_nrow && cg_shape_matrix(out, x_ncol, y_ncol);
+}
+
+static int cg_shape_tcrossprod(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 1 && n != 2)
+  {
+    return 0;
+  }
+
+  if(in[0].k > 2 || (n == 2 && in[1].k > 2))
+  {
+    return 0;
+  }
+
+  int x_nrow, x_ncol, y_nrow, y_ncol;
+
+  cg_shape_column(&in[0], &x_nrow, &x_ncol);
+
+  cg_shape_column(&in[n - 1], &y_nrow, &y_ncol);
+
+  return x_ncol == y_ncol && cg_shape_matrix(out, x_nrow, y_nrow);
+}
+
+static int cg_shape_transpose(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 1 || in[0].k > 2)
+  {
+    return 0;
+  }
+
+  if(in[0].k == 1)
+  {
+    return cg_shape_matrix(out, 1, in[0].dims[0]);
+  }
+
+  return cg_shape_matrix(out, in[0].dims[1], in[0].dims[0]);
+}
+
+static int cg_shape_rows(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 1 || in[0].k < 2)
+  {
+    return 0;
+  }
+
+  return cg_shape_vector(out, in[0].dims[0]);
+}
+
+static int cg_shape_cols(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 1 || in[0].k < 2)
+  {
+    return 0;
+  }
+
+  if(in[0].k == 2)
+  {
+    return cg_shape_vector(out, in[0].dims[1]);
+  }
+
+  out->k = in[0].k - 1;
+
+  memcpy(out->dims, in[0].dims + 1, out->k * sizeof(int));
+
+  return 1;
+}
+
+static int cg_shape_flatten(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n != 1)
+  {
+    return 0;
+  }
+
+  return cg_shape_vector(out, cg_shape_length(&in[0]));
+}
+
+static int cg_shape_c(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  R_xlen_t m = 0;
+
+  for(int i = 0; i < n; i++)
+  {
+    m += cg_shape_length(&in[i]);
+  }
+
+  return cg_shape_vector(out, m);
+}
+
+// Note: only indices that are constant positive whole numbers within the
+// extent of the subsetted dimension (or missing indices) are processed
+static int cg_shape_index(SEXP index, const R_xlen_t extent, R_xlen_t *n)
+{
+  if(index == R_MissingArg)
+  {
+    *n = extent;
+
+    return 1;
+  }
+
+  if(!Rf_isNull(ATTRIB(index)) || (TYPEOF(index) != INTSXP && TYPEOF(index) != REALSXP))
+  {
+    return 0;
+  }
+
+  R_xlen_t m = XLENGTH(index);
+
+  for(R_xlen_t i = 0; i < m; i++)
+  {
+    double v = (TYPEOF(index) == INTSXP) ?
+      (INTEGER(index)[i] == NA_INTEGER ? NA_REAL : INTEGER(index)[i]) : REAL(index)[i];
+
+    if(ISNAN(v) || v < 1 || v >= (double)extent + 1)
+    {
+      return 0;
+    }
+  }
+
+  *n = m;
+
+  return 1;
+}
+
+static int cg_shape_subset1(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  int drop = 1, m = 0, x = -1;
+
+  SEXP indices[CG_SHAPE_MAX_DIMS];
+
+  for(int i = 0; i < n; i++)
+  {
+    const char *tag = Rf_isNull(tags) ? "" : CHAR(STRING_ELT(tags, i));
+
+    if(strcmp(tag, "x") == 0 || (x < 0 && tag[0] == '\0'))
+    {
+      x = i;
+    }
+    else if(strcmp(tag, "drop") == 0)
+    {
+      if(!IS_SCALAR(args[i], LGLSXP) || LOGICAL(args[i])[0] == NA_LOGICAL)
+      {
+        return 0;
+      }
+
+      drop = LOGICAL(args[i])[0];
+    }
+    else if(tag[0] == '\0' && m < CG_SHAPE_MAX_DIMS && args[i] != R_NilValue)
+    {
+      indices[m++] = args[i];
+    }
+    else
+    {
+      return 0;
+    }
+  }
+
+  if(x < 0 || in[x].k == 0)
+  {
+    return 0;
+  }
+
+  const cg_shape_t *shape = &in[x];
+
+  // Note: x[] returns x as is
+  if(m == 0 || (m == 1 && indices[0] == R_MissingArg))
+  {
+    *out = *shape;
+
+    return 1;
+  }
+
+  R_xlen_t l;
+
+  if(m == 1)
+  {
+    return cg_shape_index(indices[0], cg_shape_length(shape), &l) && cg_shape_vector(out, l);
+  }
+
+  if(m != shape->k)
+  {
+    return 0;
+  }
+
+  out->k = 0;
+
+  for(int j = 0; j < m; j++)
+  {
+    if(!cg_shape_index(indices[j], shape->dims[j], &l))
+    {
+      return 0;
+    }
+
+    if(!drop || l != 1)
+    {
+      out->dims[out->k++] = (int)l;
+    }
+  }
+
+  if(out->k == 0)
+  {
+    return cg_shape_vector(out, 1);
+  }
+
+  // Note: dropping all but one dimension yields a vector
+  return out->k != 1 || cg_shape_vector(out, out->dims[0]);
+}
+
+static int cg_shape_subset2(const cg_shape_t *in, SEXP *args, SEXP tags, const int n, cg_shape_t *out)
+{
+  if(n < 2 || in[0].k == 0)
+  {
+    return 0;
+  }
+
+  return cg_shape_vector(out, 1);
+}
+
+static const cg_shape_def_t cg_shape_defs[] = {
+  {".pos",        cg_shape_elementwise, 0},
+  {".neg",        cg_shape_elementwise, 0},
+  {".square",     cg_shape_elementwise, 0},
+  {".sqrt",       cg_shape_elementwise, 0},
+  {".exp",        cg_shape_elementwise, 0},
+  {".ln",         cg_shape_elementwise, 0},
+  {".log2",       cg_shape_elementwise, 0},
+  {".log10",      cg_shape_elementwise, 0},
+  {".abs",        cg_shape_elementwise, 0},
+  {".sin",        cg_shape_elementwise, 0},
+  {".cos",        cg_shape_elementwise, 0},
+  {".tan",        cg_shape_elementwise, 0},
+  {".sinh",       cg_shape_elementwise, 0},
+  {".cosh",       cg_shape_elementwise, 0},
+  {".tanh",       cg_shape_elementwise, 0},
+  {".asin",       cg_shape_elementwise, 0},
+  {".acos",       cg_shape_elementwise, 0},
+  {".atan",       cg_shape_elementwise, 0},
+  {".asinh",      cg_shape_elementwise, 0},
+  {".acosh",      cg_shape_elementwise, 0},
+  {".atanh",      cg_shape_elementwise, 0},
+  {".sigmoid",    cg_shape_elementwise, 0},
+  {".add",        cg_shape_binary,      0},
+  {".sub",        cg_shape_binary,      0},
+  {".mul",        cg_shape_binary,      0},
+  {".div",        cg_shape_binary,      0},
+  {".pow",        cg_shape_binary,      0},
+  {".pmax",       cg_shape_parallel,    0},
+  {".pmin",       cg_shape_parallel,    0},
+  {".matmul",     cg_shape_matmul,      0},
+  {".crossprod",  cg_shape_crossprod,   0},
+  {".tcrossprod", cg_shape_tcrossprod,  0},
+  {".linear1",    cg_shape_linear1,     0},
+  {".linear2",    cg_shape_linear2,     0},
+  {".t",          cg_shape_transpose,   0},
+  {".sum",        cg_shape_scalar,      0},
+  {".prod",       cg_shape_scalar,      0},
+  {".mean",       cg_shape_scalar,      0},
+  {".max",        cg_shape_scalar,      0},
+  {".min",        cg_shape_scalar,      0},
+  {".length",     cg_shape_scalar,      0},
+  {".rowsums",    cg_shape_rows,        0},
+  {".rowmeans",   cg_shape_rows,        0},
+  {".colsums",    cg_shape_cols,        0},
+  {".colmeans",   cg_shape_cols,        0},
+  {".as_double",  cg_shape_flatten,     0},
+  {".c",          cg_shape_c,           0},
+  {".subset1",    cg_shape_subset1,     1},
+  {".subset2",    cg_shape_subset2,     1},
+  {NULL,          NULL,                 0}
+};
+
+static const cg_shape_def_t* cg_shape_find(SEXP builtins, SEXP function)
+{
+  SEXP name = PROTECT(cg_function_builtin_name(builtins, function));
+
+  if(Rf_isNull(name))
+  {
+    UNPROTECT(1);
+
+    return NULL;
+  }
+
+  for(const cg_shape_def_t *def = cg_shape_defs; def->name != NULL; def++)
+  {
+    if(strcmp(def->name, CHAR(name)) == 0)
+    {
+      UNPROTECT(1);
+
+      return def;
+    }
+  }
+
+  UNPROTECT(1);
+
+  return NULL;
+}
+
+static int cg_shape_infer(const cg_table_t *table, const cg_table_entry_t *entry, const cg_shape_t *shapes,
+                          SEXP builtins, cg_shape_t *out)
+{
+  SEXP function = PROTECT(CG_GET(entry->node, CG_FUN_SYMBOL));
+
+  const cg_shape_def_t *def = cg_is(function, "cg_function") ? cg_shape_find(builtins, function) : NULL;
+
+  UNPROTECT(1);
+
+  if(def == NULL || entry->n > CG_SHAPE_MAX_DIMS + 2)
+  {
+    return 0;
+  }
+
+  SEXP tags = PROTECT(Rf_getAttrib(cg_node_inputs(entry->node), R_NamesSymbol));
+
+  if(!def->tagged && !Rf_isNull(tags))
+  {
+    for(int i = 0; i < entry->n; i++)
+    {
+      if(CHAR(STRING_ELT(tags, i))[0] != '\0')
+      {
+        UNPROTECT(1);
+
+        return 0;
+      }
+    }
+  }
+
+  int *inputs = cg_table_inputs(table, entry);
+
+  cg_shape_t in[CG_SHAPE_MAX_DIMS + 2];
+
+  SEXP args[CG_SHAPE_MAX_DIMS + 2];
+
+  for(int i = 0; i < entry->n; i++)
+  {
+    const cg_table_entry_t *input = cg_table_entry(table, inputs[i]);
+
+    in[i] = shapes[inputs[i]];
+
+    args[i] = (input->type == CGCST) ? CG_GET(input->node, CG_VALUE_SYMBOL) : R_NilValue;
+
+    // Note: only rules of tagged inputs process inputs without a shape (e.g.
+    // missing indices)
+    if(in[i].k == 0 && !def->tagged)
+    {
+      UNPROTECT(1);
+
+      return 0;
+    }
+  }
+
+  int known = def->rule(in, args, tags, entry->n, out);
+
+  UNPROTECT(1);
+
+  return known && out->k > 0;
+}
+
+static SEXP cg_shape_as_vector(const cg_shape_t *shape)
+{
+  SEXP vector = Rf_allocVector(INTSXP, shape->k);
+
+  memcpy(INTEGER(vector), shape->dims, shape->k * sizeof(int));
+
+  return vector;
+}
+
+// Note: a buffer for the value of an operator is preallocated unless its
+// value or its buffer already has the inferred shape. The buffer is kept
+// apart from the value of the operator, so that the operator has no value
+// until it is evaluated (see node.h).
+static void cg_shape_alloc_buffer(SEXP node, SEXP shape)
+{
+  SEXP value = PROTECT(CG_GET(node, CG_VALUE_SYMBOL));
+
+  SEXP buffer = PROTECT(CG_GET(node, CG_BUFFER_SYMBOL));
+
+  if((TYPEOF(value) == REALSXP && cg_shape_matches(value, shape)) ||
+     (TYPEOF(buffer) == REALSXP && cg_shape_matches(buffer, shape)))
+  {
+    UNPROTECT(2);
+
+    return;
+  }
+
+  if(XLENGTH(shape) == 1)
+  {
+    buffer = PROTECT(Rf_allocVector(REALSXP, INTEGER(shape)[0]));
+  }
+  else
+  {
+    buffer = PROTECT(Rf_allocArray(REALSXP, shape));
+  }
+
+  CG_SET(node, CG_BUFFER_SYMBOL, buffer);
+
+  UNPROTECT(3);
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int cg_shape_of(SEXP value, cg_shape_t *shape)
+{
+  shape->k = 0;
+
+  if(TYPEOF(value) != REALSXP && TYPEOF(value) != INTSXP && TYPEOF(value) != LGLSXP)
+  {
+    return 0;
+  }
+
+  SEXP attrib = ATTRIB(value);
+
+  if(attrib == R_NilValue)
+  {
+    return cg_shape_vector(shape, XLENGTH(value));
+  }
+
+  if(TAG(attrib) != R_DimSymbol || CDR(attrib) != R_NilValue)
+  {
+    return 0;
+  }
+
+  SEXP dim = CAR(attrib);
+
+  R_len_t k = XLENGTH(dim);
+
+  if(k < 2 || k > CG_SHAPE_MAX_DIMS)
+  {
+    return 0;
+  }
+
+  shape->k = k;
+
+  memcpy(shape->dims, INTEGER(dim), k * sizeof(int));
+
+  return 1;
+}
+
+int cg_shape_matches(SEXP value, SEXP shape)
+{
+  cg_shape_t x;
+
+  if(TYPEOF(shape) != INTSXP || !cg_shape_of(value, &x))
+  {
+    return 0;
+  }
+
+  if(x.k != XLENGTH(shape))
+  {
+    return 0;
+  }
+
+  return memcmp(x.dims, INTEGER(shape), x.k * sizeof(int)) == 0;
+}
+
+SEXP cg_graph_infer_shapes(SEXP graph)
+{
+  if(!cg_is(graph, "cg_graph"))
+  {
+    Rf_errorcall(R_NilValue, "argument 'graph' must be a cg_graph object");
+  }
+
+  cg_table_t *table = cg_graph_table(graph);
+
+  SEXP builtins = PROTECT(cg_function_builtins());
+
+  R_len_t n = table->size;
+
+  cg_shape_t *shapes = (cg_shape_t*)R_alloc(n + 1, sizeof(cg_shape_t));
+
+  SEXP result = PROTECT(Rf_allocVector(VECSXP, n));
+
+  SEXP names = PROTECT(Rf_allocVector(STRSXP, n));
+
+  // Note: the ids of the nodes are in topological order, so the shapes of the
+  // inputs of a node are inferred before the shape of the node itself
+  for(int id = 1; id <= n; id++)
+  {
+    const cg_table_entry_t *entry = cg_table_entry(table, id);
+
+    shapes[id].k = 0;
+
+    if(entry->type == CGDOP || entry->type == CGNOP)
+    {
+      cg_shape_infer(table, entry, shapes, builtins, &shapes[id]);
+    }
+    else
+    {
+      cg_shape_of(CG_GET(entry->node, CG_VALUE_SYMBOL), &shapes[id]);
+    }
+
+    SEXP shape = (shapes[id].k > 0) ? cg_shape_as_vector(&shapes[id]) : R_NilValue;
+
+    SET_VECTOR_ELT(result, id - 1, shape);
+
+    SET_STRING_ELT(names, id - 1, Rf_mkChar(cg_node_name_char(entry->node)));
+
+    cg_node_set_shape(entry->node, shape);
+
+    if(entry->kernel != NULL && shapes[id].k > 0)
+    {
+      cg_shape_alloc_buffer(entry->node, shape);
+    }
+  }
+
+  Rf_setAttrib(result, R_NamesSymbol, names);
+
+  UNPROTECT(3);
+
+  return result;
+}
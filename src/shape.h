@@ -0,0 +1,60 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+/*
+ * MACROS
+ */
+
+#define CG_SHAPE_MAX_DIMS 8
+
+/*
+ * The shape of a value is stored as an integer vector. A shape of length one
+ * denotes a numeric vector without attributes of the given length and a longer
+ * shape denotes the dimensions of a numeric matrix or array whose only
+ * attribute is its dimensions. Other values (e.g. one-dimensional arrays or
+ * values with names) have no shape. The shape of an operator is inferred from
+ * the shapes of its inputs by a rule of the function that it calls.
+ */
+
+/*
+ * SHAPE STRUCTURES
+ */
+
+typedef struct
+{
+  int k;                                  /* Number of dimensions (0 if unknown) */
+  int dims[CG_SHAPE_MAX_DIMS];            /* Dimensions (or length of a vector) */
+} cg_shape_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int cg_shape_of(SEXP value, cg_shape_t *shape);
+
+int cg_shape_matches(SEXP value, SEXP shape);
+
+SEXP cg_graph_infer_shapes(SEXP graph);
+
+#endif
@@ -31,19 +31,41 @@ extern SEXP CG_DEF_SYMBOL;
 extern SEXP CG_EPS_SYMBOL;
 extern SEXP CG_ETA_SYMBOL;
 extern SEXP CG_FUN_SYMBOL;
+extern SEXP CG_FUSE_SYMBOL;
 extern SEXP CG_GRAD_SYMBOL;
 extern SEXP CG_NAME_SYMBOL;
+extern SEXP CG_SIZE_SYMBOL;
 extern SEXP CG_TYPE_SYMBOL;
 extern SEXP CG_BETAS_SYMBOL;
 extern SEXP CG_EAGER_SYMBOL;
 extern SEXP CG_GAMMA_SYMBOL;
 extern SEXP CG_GRADS_SYMBOL;
+extern SEXP CG_GRAPH_SYMBOL;
 extern SEXP CG_NODES_SYMBOL;
 extern SEXP CG_PARMS_SYMBOL;
+extern SEXP CG_PLANS_SYMBOL;
+extern SEXP CG_SHAPE_SYMBOL;
+extern SEXP CG_STATE_SYMBOL;
+extern SEXP CG_TABLE_SYMBOL;
 extern SEXP CG_VALUE_SYMBOL;
+extern SEXP CG_BUFFER_SYMBOL;
 extern SEXP CG_GAMMAS_SYMBOL;
+extern SEXP CG_GROUPS_SYMBOL;
 extern SEXP CG_INPUTS_SYMBOL;
+extern SEXP CG_KERNEL_SYMBOL;
+extern SEXP CG_TARGET_SYMBOL;
 extern SEXP CG_BUFFER0_SYMBOL;
 extern SEXP CG_BUFFER1_SYMBOL;
+extern SEXP CG_FORWARD_SYMBOL;
+extern SEXP CG_PROFILE_SYMBOL;
+extern SEXP CG_STORAGE_SYMBOL;
+extern SEXP CG_TANGENT_SYMBOL;
+extern SEXP CG_THREADS_SYMBOL;
+extern SEXP CG_VERSION_SYMBOL;
+extern SEXP CG_BACKWARD_SYMBOL;
+extern SEXP CG_SEGMENTS_SYMBOL;
+extern SEXP CG_TANGENTS_SYMBOL;
+extern SEXP CG_FORWARD_LEVELS_SYMBOL;
+extern SEXP CG_BACKWARD_LEVELS_SYMBOL;
 
 #endif
@@ -0,0 +1,869 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include "node.h"
+#include "table.h"
+#include "trace.h"
+#include "function.h"
+
+/*
+ * INLINE FUNCTIONS
+ */
+
+extern inline cg_table_entry_t* cg_table_entry(const cg_table_t *table, const int id);
+
+extern inline int* cg_table_inputs(const cg_table_t *table, const cg_table_entry_t *entry);
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+// Note: the kernel is only stored if it can be called with the inputs of the
+// node as positional arguments (otherwise the node falls back to the R
+// definition of its function).
+static const cg_kernel_t* cg_table_kernel(SEXP node, SEXP inputs)
+{
+  const cg_kernel_t *kernel = cg_kernel_variant(cg_function_kernel(cg_node_function(node)), XLENGTH(inputs));
+
+  if(kernel == NULL)
+  {
+    return NULL;
+  }
+
+  SEXP input_tags = PROTECT(Rf_getAttrib(inputs, R_NamesSymbol));
+
+  if(!Rf_isNull(input_tags))
+  {
+    for(int i = 0; i < kernel->n; i++)
+    {
+      if(CHAR(STRING_ELT(input_tags, i))[0] != '\0')
+      {
+        UNPROTECT(1);
+
+        return NULL;
+      }
+    }
+  }
+
+  UNPROTECT(1);
+
+  return kernel;
+}
+
+static inline size_t cg_table_hash(SEXP key, const int capacity)
+{
+  uintptr_t h = (uintptr_t)key >> 3;
+
+  h ^= h >> 16;
+
+  h *= 0x45d9f3b;
+
+  h ^= h >> 16;
+
+  return (size_t)h & (capacity - 1);
+}
+
+static void cg_table_insert(cg_table_name_t *names, const int capacity, SEXP key, const int id)
+{
+  size_t i = cg_table_hash(key, capacity);
+
+  while(names[i].key != NULL && names[i].key != key)
+  {
+    i = (i + 1) & (capacity - 1);
+  }
+
+  names[i].key = key;
+  names[i].id = id;
+}
+
+static void cg_table_index(cg_table_t *table, SEXP node, const int id)
+{
+  SEXP name = CG_GET(node, CG_NAME_SYMBOL);
+
+  if(!IS_SCALAR(name, STRSXP))
+  {
+    return;
+  }
+
+  // Note: the capacity of the index is a power of two and the index is
+  // kept at most half full
+  if(2 * (table->n_names + 1) > table->capacity_names)
+  {
+    int capacity = (table->capacity_names > 0) ? 2 * table->capacity_names : 64;
+
+    cg_table_name_t *names = Calloc(capacity, cg_table_name_t);
+
+    for(int i = 0; i < table->capacity_names; i++)
+    {
+      if(table->names[i].key != NULL)
+      {
+        cg_table_insert(names, capacity, table->names[i].key, table->names[i].id);
+      }
+    }
+
+    Free(table->names);
+
+    table->names = names;
+    table->capacity_names = capacity;
+  }
+
+  SEXP key = STRING_ELT(name, 0);
+
+  if(cg_table_find(table, key) == 0)
+  {
+    table->n_names++;
+  }
+
+  cg_table_insert(table->names, table->capacity_names, key, id);
+}
+
+static inline uint64_t cg_table_mix(uint64_t h, const uint64_t x)
+{
+  h ^= x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+
+  return h;
+}
+
+static inline uint64_t cg_table_hash_double(const double x)
+{
+  // Note: values that are identical according to R_compute_identical must
+  // have the same hash (i.e. 0 and -0, and NaNs with different payloads)
+  if(ISNAN(x))
+  {
+    return R_IsNA(x) ? 1 : 2;
+  }
+
+  if(x == 0)
+  {
+    return 0;
+  }
+
+  uint64_t h;
+
+  memcpy(&h, &x, sizeof(double));
+
+  return h;
+}
+
+static uint64_t cg_table_hash_value(SEXP x, const int depth)
+{
+  R_xlen_t n = Rf_isVector(x) ? XLENGTH(x) : 0;
+
+  uint64_t h = cg_table_mix(TYPEOF(x), n);
+
+  switch(TYPEOF(x))
+  {
+    case LGLSXP :
+    case INTSXP :
+    {
+      int *px = INTEGER(x);
+
+      for(R_xlen_t i = 0; i < n; i++)
+      {
+        h = cg_table_mix(h, (uint64_t)(unsigned int)px[i]);
+      }
+
+      break;
+    }
+    case REALSXP :
+    {
+      double *px = REAL(x);
+
+      for(R_xlen_t i = 0; i < n; i++)
+      {
+        h = cg_table_mix(h, cg_table_hash_double(px[i]));
+      }
+
+      break;
+    }
+    case CPLXSXP :
+    {
+      Rcomplex *px = COMPLEX(x);
+
+      for(R_xlen_t i = 0; i < n; i++)
+      {
+        h = cg_table_mix(h, cg_table_hash_double(px[i].r));
+
+        h = cg_table_mix(h, cg_table_hash_double(px[i].i));
+      }
+
+      break;
+    }
+    case STRSXP :
+    {
+      for(R_xlen_t i = 0; i < n; i++)
+      {
+        h = cg_table_mix(h, (uint64_t)(uintptr_t)STRING_ELT(x, i));
+      }
+
+      break;
+    }
+    case RAWSXP :
+    {
+      Rbyte *px = RAW(x);
+
+      for(R_xlen_t i = 0; i < n; i++)
+      {
+        h = cg_table_mix(h, px[i]);
+      }
+
+      break;
+    }
+    case VECSXP :
+    {
+      if(depth > 0)
+      {
+        for(R_xlen_t i = 0; i < n; i++)
+        {
+          h = cg_table_mix(h, cg_table_hash_value(VECTOR_ELT(x, i), depth - 1));
+        }
+      }
+
+      break;
+    }
+    default :
+    {
+      break;
+    }
+  }
+
+  // Note: the hashes of the attributes are added up so that the hash does
+  // not depend on the order of the attributes (R_compute_identical compares
+  // the attributes as a set)
+  if(depth > 0)
+  {
+    uint64_t ha = 0;
+
+    for(SEXP a = ATTRIB(x); a != R_NilValue; a = CDR(a))
+    {
+      ha += cg_table_mix((uint64_t)(uintptr_t)TAG(a), cg_table_hash_value(CAR(a), depth - 1));
+    }
+
+    h = cg_table_mix(h, ha);
+  }
+
+  return h;
+}
+
+static void cg_table_pool(cg_table_t *table, SEXP node, const int id)
+{
+  if(!Rf_isNull(CG_GET(node, CG_NAME_SYMBOL)))
+  {
+    return;
+  }
+
+  // Note: the capacity of the pool is a power of two and the pool is kept
+  // at most half full
+  if(2 * (table->n_constants + 1) > table->capacity_constants)
+  {
+    int capacity = (table->capacity_constants > 0) ? 2 * table->capacity_constants : 64;
+
+    cg_table_constant_t *constants = Calloc(capacity, cg_table_constant_t);
+
+    for(int i = 0; i < table->capacity_constants; i++)
+    {
+      if(table->constants[i].id > 0)
+      {
+        size_t j = table->constants[i].hash & (capacity - 1);
+
+        while(constants[j].id > 0)
+        {
+          j = (j + 1) & (capacity - 1);
+        }
+
+        constants[j] = table->constants[i];
+      }
+    }
+
+    Free(table->constants);
+
+    table->constants = constants;
+    table->capacity_constants = capacity;
+  }
+
+  uint64_t h = cg_table_hash_value(cg_node_value(node), 2);
+
+  size_t i = h & (table->capacity_constants - 1);
+
+  while(table->constants[i].id > 0)
+  {
+    i = (i + 1) & (table->capacity_constants - 1);
+  }
+
+  table->constants[i].hash = h;
+  table->constants[i].id = id;
+
+  table->n_constants++;
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void cg_table_add(cg_table_t *table, SEXP node)
+{
+  if(cg_node_id(node) != table->size + 1)
+  {
+    Rf_errorcall(R_NilValue, "cannot add node '%s' to the node table", cg_node_name_char(node));
+  }
+
+  cg_node_type_t type = cg_node_type(node);
+
+  int n = 0;
+
+  SEXP inputs = R_NilValue;
+
+  if(type == CGDOP || type == CGNOP)
+  {
+    inputs = cg_node_inputs(node);
+
+    n = XLENGTH(inputs);
+  }
+
+  if(table->size >= table->capacity)
+  {
+    table->capacity = (table->capacity > 0) ? 2 * table->capacity : 16;
+
+    table->entries = Realloc(table->entries, table->capacity, cg_table_entry_t);
+
+    if(table->profile != NULL)
+    {
+      table->profile = Realloc(table->profile, table->capacity, cg_profile_entry_t);
+    }
+  }
+
+  if(table->n_inputs + n > table->capacity_inputs)
+  {
+    while(table->n_inputs + n > table->capacity_inputs)
+    {
+      table->capacity_inputs = (table->capacity_inputs > 0) ? 2 * table->capacity_inputs : 32;
+    }
+
+    table->inputs = Realloc(table->inputs, table->capacity_inputs, int);
+  }
+
+  int *ids = &table->inputs[table->n_inputs];
+
+  for(int i = 0; i < n; i++)
+  {
+    SEXP input = VECTOR_ELT(inputs, i);
+
+    if(TYPEOF(input) != ENVSXP)
+    {
+      Rf_errorcall(R_NilValue, "node '%s' has an invalid input at index %d",
+                   cg_node_name_char(node), i + 1);
+    }
+
+    ids[i] = cg_table_id(table, input);
+  }
+
+  cg_table_entry_t *entry = &table->entries[table->size];
+
+  entry->node = node;
+  entry->type = type;
+  entry->n = n;
+  entry->offset = table->n_inputs;
+  entry->kernel = (n > 0) ? cg_table_kernel(node, inputs) : NULL;
+
+  table->n_inputs += n;
+
+  if(table->profile != NULL)
+  {
+    memset(&table->profile[table->size], 0, sizeof(cg_profile_entry_t));
+  }
+
+  table->size++;
+
+  cg_table_index(table, node, table->size);
+
+  if(type == CGCST)
+  {
+    cg_table_pool(table, node, table->size);
+  }
+}
+
+// Note: if the old name of the node is indexed by the node, the name is
+// indexed by the last other node with that name (or by no node at all)
+void cg_table_rename(cg_table_t *table, const int id, SEXP name)
+{
+  SEXP node = cg_table_entry(table, id)->node;
+
+  SEXP old = PROTECT(cg_node_name(node));
+
+  cg_node_set_name(node, name);
+
+  if(!Rf_isNull(old) && cg_table_find(table, STRING_ELT(old, 0)) == id)
+  {
+    SEXP key = STRING_ELT(old, 0);
+
+    int last = 0;
+
+    for(int i = table->size; i > 0 && last == 0; i--)
+    {
+      SEXP other = CG_GET(table->entries[i - 1].node, CG_NAME_SYMBOL);
+
+      if(i != id && IS_SCALAR(other, STRSXP) && STRING_ELT(other, 0) == key)
+      {
+        last = i;
+      }
+    }
+
+    cg_table_insert(table->names, table->capacity_names, key, last);
+  }
+
+  if(!Rf_isNull(name) && cg_table_find(table, STRING_ELT(name, 0)) < id)
+  {
+    cg_table_index(table, node, id);
+  }
+
+  UNPROTECT(1);
+}
+
+// Note: the id of a node is only trusted if the node is stored at that id,
+// since nodes that are removed from a graph (see rewrite.h) or belong to
+// another graph may hold the id of another node
+int cg_table_id(const cg_table_t *table, SEXP node)
+{
+  SEXP id = CG_GET(node, CG_ID_SYMBOL);
+
+  if(!IS_SCALAR(id, INTSXP))
+  {
+    Rf_errorcall(R_NilValue, "node is not part of a graph");
+  }
+
+  int k = INTEGER(id)[0];
+
+  if(k < 1 || k > table->size || table->entries[k - 1].node != node)
+  {
+    Rf_errorcall(R_NilValue, "node '%s' is not part of the graph", cg_node_name_char(node));
+  }
+
+  return k;
+}
+
+int cg_table_find(const cg_table_t *table, SEXP name)
+{
+  if(table->capacity_names == 0)
+  {
+    return 0;
+  }
+
+  size_t i = cg_table_hash(name, table->capacity_names);
+
+  while(table->names[i].key != NULL)
+  {
+    if(table->names[i].key == name)
+    {
+      return table->names[i].id;
+    }
+
+    i = (i + 1) & (table->capacity_names - 1);
+  }
+
+  return 0;
+}
+
+int cg_table_find_constant(const cg_table_t *table, SEXP value)
+{
+  if(table->capacity_constants == 0)
+  {
+    return 0;
+  }
+
+  uint64_t h = cg_table_hash_value(value, 2);
+
+  size_t i = h & (table->capacity_constants - 1);
+
+  // Note: the values are only compared if their hashes are equal. The
+  // constant must still be unnamed and hold the value it was pooled with.
+  while(table->constants[i].id > 0)
+  {
+    if(table->constants[i].hash == h)
+    {
+      SEXP node = table->entries[table->constants[i].id - 1].node;
+
+      if(Rf_isNull(cg_node_name(node)) && R_compute_identical(value, cg_node_value(node), 16))
+      {
+        return table->constants[i].id;
+      }
+    }
+
+    i = (i + 1) & (table->capacity_constants - 1);
+  }
+
+  return 0;
+}
+
+int cg_table_call(const cg_table_t *table, const cg_table_entry_t *entry, cg_node_call_t *call)
+{
+  if(entry->kernel == NULL)
+  {
+    return 0;
+  }
+
+  int *ids = cg_table_inputs(table, entry);
+
+  call->kernel = entry->kernel;
+
+  for(int i = 0; i < entry->n; i++)
+  {
+    const cg_table_entry_t *input = &table->entries[ids[i] - 1];
+
+    call->inputs[i] = input->node;
+
+    call->ids[i] = ids[i];
+
+    call->types[i] = input->type;
+
+    call->args[i] = cg_node_value(input->node);
+  }
+
+  return 1;
+}
+
+void cg_table_forward(const cg_table_t *table, const int id)
+{
+  const cg_table_entry_t *entry = cg_table_entry(table, id);
+
+  cg_node_call_t call;
+
+  cg_node_task_t task;
+
+  cg_profile_sample_t sample;
+
+  double start = cg_trace_active() ? cg_profile_time() : 0;
+
+  if(table->profiling)
+  {
+    cg_table_profile_begin(table, &id, 1, CGPFORWARD, &sample);
+  }
+
+  if(cg_table_call(table, entry, &call) && cg_node_forward_prepare(entry->node, &call, &task))
+  {
+    task.eval(&task.data);
+
+    cg_node_forward_finish(&task);
+  }
+  else
+  {
+    cg_node_forward(entry->node);
+  }
+
+  if(table->profiling)
+  {
+    cg_table_profile_end(table, &id, 1, &sample);
+  }
+
+  if(cg_trace_active())
+  {
+    cg_trace_node(entry->node, "forward", start);
+  }
+}
+
+void cg_table_backward(const cg_table_t *table, const int id, int *states)
+{
+  const cg_table_entry_t *entry = cg_table_entry(table, id);
+
+  if(entry->type != CGDOP || (states != NULL && states[id] == CGGPRUNED))
+  {
+    return;
+  }
+
+  int k;
+
+  cg_node_call_t call;
+
+  cg_node_task_t tasks[CG_KERNEL_MAX_INPUTS];
+
+  cg_profile_sample_t sample;
+
+  double start = cg_trace_active() ? cg_profile_time() : 0;
+
+  if(table->profiling)
+  {
+    cg_table_profile_begin(table, &id, 1, CGPBACKWARD, &sample);
+  }
+
+  if(cg_table_call(table, entry, &call) && cg_node_backward_prepare(entry->node, &call, tasks, &k, states, NULL))
+  {
+    for(int i = 0; i < k; i++)
+    {
+      tasks[i].eval(&tasks[i].data);
+    }
+  }
+  else
+  {
+    cg_node_backward(entry->node, states);
+  }
+
+  if(table->profiling)
+  {
+    cg_table_profile_end(table, &id, 1, &sample);
+  }
+
+  if(cg_trace_active())
+  {
+    cg_trace_node(entry->node, "backward", start);
+  }
+}
+
+void cg_table_tangent(const cg_table_t *table, const int id, SEXP tangents)
+{
+  const cg_table_entry_t *entry = cg_table_entry(table, id);
+
+  if(entry->type != CGDOP)
+  {
+    return;
+  }
+
+  int *inputs = cg_table_inputs(table, entry), seeded = 0;
+
+  for(int i = 0; i < entry->n; i++)
+  {
+    if(!Rf_isNull(VECTOR_ELT(tangents, inputs[i] - 1)))
+    {
+      seeded = 1;
+
+      break;
+    }
+  }
+
+  // The tangent of a node that does not depend on the seed is zero and is not
+  // materialized
+  if(!seeded)
+  {
+    return;
+  }
+
+  int k;
+
+  cg_node_call_t call;
+
+  cg_node_task_t tasks[CG_KERNEL_MAX_INPUTS];
+
+  if(cg_table_call(table, entry, &call) && cg_node_tangent_prepare(entry->node, &call, tasks, &k, tangents))
+  {
+    for(int i = 0; i < k; i++)
+    {
+      tasks[i].eval(&tasks[i].data);
+    }
+  }
+  else
+  {
+    cg_node_tangent(entry->node, tangents);
+  }
+}
+
+void cg_table_hessian(const cg_table_t *table, const int id, SEXP tangents, SEXP sources, const int *states,
+                      const int approx)
+{
+  const cg_table_entry_t *entry = cg_table_entry(table, id);
+
+  if(entry->type != CGDOP || states[id] != CGGWRITTEN)
+  {
+    return;
+  }
+
+  int *inputs = cg_table_inputs(table, entry), seeded = !Rf_isNull(VECTOR_ELT(tangents, id - 1));
+
+  for(int i = 0; i < entry->n && !seeded; i++)
+  {
+    seeded = !Rf_isNull(VECTOR_ELT(tangents, inputs[i] - 1));
+  }
+
+  // The gradients of a node that does not depend on the direction have no
+  // second-order terms
+  if(!seeded)
+  {
+    return;
+  }
+
+  int k;
+
+  cg_node_call_t call;
+
+  cg_node_task_t tasks[CG_KERNEL_MAX_INPUTS];
+
+  if(cg_table_call(table, entry, &call) &&
+     cg_node_hessian_prepare(entry->node, &call, tasks, &k, tangents, sources, states))
+  {
+    for(int i = 0; i < k; i++)
+    {
+      tasks[i].eval(&tasks[i].data);
+    }
+  }
+  else if(approx)
+  {
+    cg_node_hessian(entry->node, tangents, sources, states);
+  }
+  else
+  {
+    Rf_errorcall(R_NilValue, "cannot evaluate the second-order terms of node '%s' exactly (see argument 'approx')",
+                 cg_node_name_char(entry->node));
+  }
+}
+
+void cg_table_set_profiling(cg_table_t *table, const int profiling)
+{
+  if(profiling && table->profile == NULL)
+  {
+    table->profile = Calloc((table->capacity > 0) ? table->capacity : 1, cg_profile_entry_t);
+  }
+
+  table->profiling = profiling;
+}
+
+// Note: the values and preallocated buffers (forward pass) or the gradients
+// of the inputs (backward pass) are recorded before the evaluation, so that
+// the vectors that are allocated by the evaluation can be identified
+// afterwards
+void cg_table_profile_begin(const cg_table_t *table, const int *ids, const int m,
+                            const cg_profile_pass_t pass, cg_profile_sample_t *sample)
+{
+  sample->pass = pass;
+
+  if(pass == CGPFORWARD)
+  {
+    SEXP node = cg_table_entry(table, ids[m - 1])->node;
+
+    sample->n = 2;
+
+    sample->objects = (SEXP*)R_alloc(2, sizeof(SEXP));
+
+    sample->objects[0] = CG_GET(node, CG_VALUE_SYMBOL);
+
+    sample->objects[1] = CG_GET(node, CG_BUFFER_SYMBOL);
+  }
+  else
+  {
+    sample->n = 0;
+
+    for(int j = 0; j < m; j++)
+    {
+      sample->n += cg_table_entry(table, ids[j])->n;
+    }
+
+    sample->objects = (SEXP*)R_alloc(sample->n, sizeof(SEXP));
+
+    for(int j = 0, k = 0; j < m; j++)
+    {
+      const cg_table_entry_t *entry = cg_table_entry(table, ids[j]);
+
+      int *inputs = cg_table_inputs(table, entry);
+
+      for(int q = 0; q < entry->n; q++)
+      {
+        sample->objects[k++] = CG_GET(cg_table_entry(table, inputs[q])->node, CG_GRAD_SYMBOL);
+      }
+    }
+  }
+
+  sample->start = cg_profile_time();
+}
+
+void cg_table_profile_end(const cg_table_t *table, const int *ids, const int m,
+                          const cg_profile_sample_t *sample)
+{
+  double time = cg_profile_time() - sample->start, bytes = 0;
+
+  if(sample->pass == CGPFORWARD)
+  {
+    SEXP value = CG_GET(cg_table_entry(table, ids[m - 1])->node, CG_VALUE_SYMBOL);
+
+    if(value != sample->objects[0] && value != sample->objects[1])
+    {
+      bytes += cg_profile_bytes(value);
+    }
+  }
+  else
+  {
+    for(int j = 0, k = 0; j < m; j++)
+    {
+      const cg_table_entry_t *entry = cg_table_entry(table, ids[j]);
+
+      int *inputs = cg_table_inputs(table, entry);
+
+      for(int q = 0; q < entry->n; q++)
+      {
+        SEXP grad = CG_GET(cg_table_entry(table, inputs[q])->node, CG_GRAD_SYMBOL);
+
+        if(grad != sample->objects[k++])
+        {
+          bytes += cg_profile_bytes(grad);
+        }
+      }
+    }
+  }
+
+  cg_profile_entry_t *profile = &table->profile[ids[m - 1] - 1];
+
+  profile->calls[sample->pass]++;
+
+  profile->time[sample->pass] += time;
+
+  profile->bytes[sample->pass] += bytes;
+}
+
+/*
+ * PUBLIC CONSTRUCTORS
+ */
+
+cg_table_t* cg_table_allocate(const int capacity)
+{
+  cg_table_t *table = Calloc(1, cg_table_t);
+
+  table->size = 0;
+  table->capacity = capacity;
+  table->n_inputs = 0;
+  table->capacity_inputs = 2 * capacity;
+  table->n_names = 0;
+  table->capacity_names = 0;
+  table->entries = (capacity > 0) ? Calloc(capacity, cg_table_entry_t) : NULL;
+  table->inputs = (capacity > 0) ? Calloc(2 * capacity, int) : NULL;
+  table->n_constants = 0;
+  table->capacity_constants = 0;
+  table->names = NULL;
+  table->constants = NULL;
+  table->profiling = 0;
+  table->profile = NULL;
+
+  return table;
+}
+
+void cg_table_free(cg_table_t *table)
+{
+  if(table == NULL)
+  {
+    return;
+  }
+
+  Free(table->entries);
+
+  Free(table->inputs);
+
+  Free(table->names);
+
+  Free(table->constants);
+
+  Free(table->profile);
+
+  Free(table);
+}
@@ -0,0 +1,152 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef TABLE_H
+#define TABLE_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdint.h>
+
+#include "node.h"
+#include "kernel.h"
+#include "profile.h"
+
+/*
+ * A node table stores the structure of a graph in contiguous memory. Entry
+ * i - 1 of the table describes the node with id i, i.e. its type, the ids of
+ * its inputs, and the kernel of its function. The table is used to traverse
+ * the graph without looking up the fields of the node environments. The
+ * values and gradients of the nodes are still stored in the environments.
+ *
+ * The table also indexes the names of the nodes. The index is an open
+ * addressing hash table that maps the address of a name (a cached CHARSXP)
+ * to the id of the last node added with that name. The index is updated when
+ * a node is renamed. Similarly, the constant pool maps a hash of the value of
+ * each unnamed constant to its id so that constants with identical values can
+ * be shared.
+ *
+ * If profiling is enabled, the table also stores a profile for each entry
+ * (see profile.h).
+ */
+
+/*
+ * TABLE STRUCTURES
+ */
+
+typedef struct
+{
+  SEXP node;                              /* Node */
+  cg_node_type_t type;                    /* Type of the node */
+  int n;                                  /* Number of inputs */
+  int offset;                             /* Position of the ids of the inputs */
+  const cg_kernel_t *kernel;              /* Kernel of the function (or NULL) */
+} cg_table_entry_t;
+
+typedef struct
+{
+  SEXP key;                               /* Name of the node (CHARSXP) */
+  int id;                                 /* Id of the node */
+} cg_table_name_t;
+
+typedef struct
+{
+  uint64_t hash;                          /* Hash of the value of the constant */
+  int id;                                 /* Id of the constant (0 if empty) */
+} cg_table_constant_t;
+
+typedef struct
+{
+  int size;                               /* Number of entries */
+  int capacity;                           /* Capacity of the entries */
+  int n_inputs;                           /* Number of input ids */
+  int capacity_inputs;                    /* Capacity of the input ids */
+  int n_names;                            /* Number of indexed names */
+  int capacity_names;                     /* Capacity of the name index */
+  int n_constants;                        /* Number of pooled constants */
+  int capacity_constants;                 /* Capacity of the constant pool */
+  cg_table_entry_t *entries;              /* Entries */
+  int *inputs;                            /* Input ids of all entries */
+  cg_table_name_t *names;                 /* Name index */
+  cg_table_constant_t *constants;         /* Constant pool */
+  int profiling;                          /* Set if the entries are profiled */
+  cg_profile_entry_t *profile;            /* Profile of the entries (or NULL) */
+} cg_table_t;
+
+/*
+ * INLINE FUNCTIONS
+ */
+
+inline cg_table_entry_t* cg_table_entry(const cg_table_t *table, const int id)
+{
+  if(id < 1 || id > table->size)
+  {
+    Rf_errorcall(R_NilValue, "cannot retrieve node with id %d", id);
+  }
+
+  return &table->entries[id - 1];
+}
+
+inline int* cg_table_inputs(const cg_table_t *table, const cg_table_entry_t *entry)
+{
+  return &table->inputs[entry->offset];
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void cg_table_add(cg_table_t *table, SEXP node);
+
+int cg_table_id(const cg_table_t *table, SEXP node);
+
+void cg_table_rename(cg_table_t *table, const int id, SEXP name);
+
+int cg_table_find(const cg_table_t *table, SEXP name);
+
+int cg_table_find_constant(const cg_table_t *table, SEXP value);
+
+int cg_table_call(const cg_table_t *table, const cg_table_entry_t *entry, cg_node_call_t *call);
+
+void cg_table_forward(const cg_table_t *table, const int id);
+
+void cg_table_backward(const cg_table_t *table, const int id, int *states);
+
+void cg_table_tangent(const cg_table_t *table, const int id, SEXP tangents);
+
+void cg_table_hessian(const cg_table_t *table, const int id, SEXP tangents, SEXP sources, const int *states,
+                      const int approx);
+
+void cg_table_set_profiling(cg_table_t *table, const int profiling);
+
+void cg_table_profile_begin(const cg_table_t *table, const int *ids, const int m,
+                            const cg_profile_pass_t pass, cg_profile_sample_t *sample);
+
+void cg_table_profile_end(const cg_table_t *table, const int *ids, const int m,
+                          const cg_profile_sample_t *sample);
+
+/*
+ * PUBLIC CONSTRUCTORS
+ */
+
+cg_table_t* cg_table_allocate(const int capacity);
+
+void cg_table_free(cg_table_t *table);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+
+#include "node.h"
+#include "trace.h"
+#include "profile.h"
+
+/*
+ * TRACE DEFINITION
+ */
+
+static FILE *cg_trace_file = NULL;
+
+static double cg_trace_origin = 0;
+
+static int cg_trace_count = 0;
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static void cg_trace_write_string(const char *s)
+{
+  fputc('"', cg_trace_file);
+
+  for(; *s != '\0'; s++)
+  {
+    unsigned char c = (unsigned char)*s;
+
+    if(c == '"' || c == '\\')
+    {
+      fprintf(cg_trace_file, "\\%c", c);
+    }
+    else if(c < 0x20)
+    {
+      fprintf(cg_trace_file, "\\u%04x", c);
+    }
+    else
+    {
+      fputc(c, cg_trace_file);
+    }
+  }
+
+  fputc('"', cg_trace_file);
+}
+
+// Note: the events are written in the JSON array format, for which the
+// closing bracket is optional. Hence, a trace that is not stopped (e.g.
+// because R is terminated) can still be opened.
+static void cg_trace_separate()
+{
+  if(cg_trace_count++ > 0)
+  {
+    fputs(",\n", cg_trace_file);
+  }
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int cg_trace_active()
+{
+  return cg_trace_file != NULL;
+}
+
+void cg_trace_event(const char *name, const char *category, const int tid,
+                    const double start, const double end, const int id)
+{
+  if(cg_trace_file == NULL)
+  {
+    return;
+  }
+
+  cg_trace_separate();
+
+  fputs("{\"name\":", cg_trace_file);
+
+  cg_trace_write_string(name);
+
+  fprintf(cg_trace_file, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d",
+          category, 1e6 * (start - cg_trace_origin), 1e6 * (end - start), tid);
+
+  if(id > 0)
+  {
+    fprintf(cg_trace_file, ",\"args\":{\"id\":%d}", id);
+  }
+
+  fputc('}', cg_trace_file);
+}
+
+void cg_trace_node(SEXP node, const char *category, const double start)
+{
+  cg_trace_event(cg_node_name_char(node), category, 0, start, cg_profile_time(), cg_node_id(node));
+}
+
+SEXP cg_trace_start(SEXP file)
+{
+  if(!IS_SCALAR(file, STRSXP))
+  {
+    Rf_errorcall(R_NilValue, "argument 'file' must be a character scalar");
+  }
+
+  if(cg_trace_file != NULL)
+  {
+    Rf_errorcall(R_NilValue, "a trace is already being recorded");
+  }
+
+  const char *path = R_ExpandFileName(CHAR(STRING_ELT(file, 0)));
+
+  cg_trace_file = fopen(path, "w");
+
+  if(cg_trace_file == NULL)
+  {
+    Rf_errorcall(R_NilValue, "unable to open file '%s'", path);
+  }
+
+  cg_trace_origin = cg_profile_time();
+
+  cg_trace_count = 0;
+
+  fputs("[\n", cg_trace_file);
+
+  cg_trace_separate();
+
+  fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"cgraph\"}}", cg_trace_file);
+
+  return R_NilValue;
+}
+
+SEXP cg_trace_stop()
+{
+  if(cg_trace_file == NULL)
+  {
+    Rf_errorcall(R_NilValue, "no trace is being recorded");
+  }
+
+  fputs("\n]\n", cg_trace_file);
+
+  fclose(cg_trace_file);
+
+  cg_trace_file = NULL;
+
+  return R_NilValue;
+}
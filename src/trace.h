@@ -0,0 +1,49 @@
+/*
+Copyright 2020 Ron Triepels
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+
+/*
+ * The tracer records the evaluation of graphs as a timeline of events in the
+ * Chrome trace event format. Each event spans the evaluation of a graph, an
+ * operator, or an optimization step and is written to the trace file when it
+ * completes. Events of kernels that are evaluated concurrently are recorded by
+ * the threads on which the kernels are evaluated, but are written to the file
+ * by the main thread. Only one trace can be recorded at a time.
+ */
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int cg_trace_active();
+
+void cg_trace_event(const char *name, const char *category, const int tid,
+                    const double start, const double end, const int id);
+
+void cg_trace_node(SEXP node, const char *category, const double start);
+
+SEXP cg_trace_start(SEXP file);
+
+SEXP cg_trace_stop();
+
+#endif